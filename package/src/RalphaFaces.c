@@ -0,0 +1,320 @@
+/* Copyright (C) 2018
+
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+*/
+#include "RcompGeomete.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The faces of every dimension of a Delaunay triangulation with their
+   alpha values, the alpha at which each enters the alpha complex.
+
+   A simplex of the triangulation enters at its circumradius. A lower
+   face is attached to a coface if the vertex of the coface that is not
+   in the face lies strictly inside the smallest sphere through the
+   face; it then enters with the first of those cofaces, and otherwise at
+   the radius of that sphere.
+
+   The faces are found level by level from the top: the faces of each
+   dimension are the facets of those one dimension up, deduplicated
+   through an open-addressing hash table of their sorted vertices, and
+   each is given its alpha value as its cofaces are visited, so only the
+   spheres of one level are held at a time. */
+
+typedef struct
+{
+	int nv;			  /* vertices per face */
+	R_xlen_t count, capacity;
+	int *vertices;	  /* count x nv, 0-based, in increasing order */
+	double *alpha;	  /* -1 until known */
+	double *spheres;  /* count x (dim + 1): the centre and squared radius */
+	R_xlen_t *table;  /* slots of the hash table, -1 if empty */
+	R_xlen_t nslots;
+} faceLevelT;
+
+static void freeFaceLevel(faceLevelT *level)
+{
+	free(level->vertices);
+	free(level->alpha);
+	free(level->spheres);
+	free(level->table);
+	memset(level, 0, sizeof(faceLevelT));
+}
+
+static uint64_t hashFace(const int *v, int nv)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	int i;
+	for (i = 0; i < nv; i++)
+	{
+		h ^= (uint64_t)(unsigned int)v[i];
+		h *= 0x100000001b3ULL;
+		h ^= h >> 29;
+	}
+	/* splitmix64 finaliser */
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	return (h ^ (h >> 31));
+}
+
+/* The slot of face v in the table of level, or the empty slot it would
+   take */
+static R_xlen_t findFace(const faceLevelT *level, const int *v)
+{
+	R_xlen_t slot = hashFace(v, level->nv) & (level->nslots - 1);
+	while (level->table[slot] >= 0 &&
+		   memcmp(level->vertices + level->table[slot] * level->nv, v, level->nv * sizeof(int)))
+		slot = (slot + 1) & (level->nslots - 1);
+	return (slot);
+}
+
+/* Make room for one more face in level, keeping the table at most half
+   full. Returns 0 if out of memory. */
+static int growFaceLevel(faceLevelT *level, int dim)
+{
+	R_xlen_t capacity, i, slot;
+	void *grown;
+
+	if (level->count == level->capacity)
+	{
+		capacity = level->capacity ? 2 * level->capacity : 1024;
+		if (!(grown = realloc(level->vertices, capacity * level->nv * sizeof(int))))
+			return (0);
+		level->vertices = grown;
+		if (!(grown = realloc(level->alpha, capacity * sizeof(double))))
+			return (0);
+		level->alpha = grown;
+		if (!(grown = realloc(level->spheres, capacity * (dim + 1) * sizeof(double))))
+			return (0);
+		level->spheres = grown;
+		level->capacity = capacity;
+	}
+	if (2 * (level->count + 1) > level->nslots)
+	{
+		free(level->table);
+		level->nslots = level->nslots ? 2 * level->nslots : 2048;
+		if (!(level->table = (R_xlen_t *)malloc(level->nslots * sizeof(R_xlen_t))))
+			return (0);
+		for (slot = 0; slot < level->nslots; slot++)
+			level->table[slot] = -1;
+		for (i = 0; i < level->count; i++)
+			level->table[findFace(level, level->vertices + i * level->nv)] = i;
+	}
+	return (1);
+}
+
+/* The centre and squared radius of the smallest sphere through the k + 1
+   points v in dim dimensions, whose centre lies in their affine hull.
+   If the points are affinely dependent, as where qhull splits
+   cospherical points into flat simplices, it is the largest of the
+   spheres of the faces that leave out one of them. */
+static void smallestSphere(const double *const *v, int k, int dim, double *centre, double *r2)
+{
+	double a[MESH_DIMmax * MESH_DIMmax], g[MESH_DIMmax * MESH_DIMmax], b[MESH_DIMmax];
+	double scale = 0, dot, c[MESH_DIMmax], s2;
+	const double *w[MESH_DIMmax + 1];
+	int i, j, m, drop;
+
+	*r2 = 0;
+	memcpy(centre, v[0], dim * sizeof(double));
+	if (k == 0)
+		return;
+
+	/* The Gram system 2 (v_i - v_0).(x - v_0) = |v_i - v_0|^2 for the
+	   combination x - v_0 = sum_j b_j (v_j - v_0) */
+	for (i = 0; i < k; i++)
+		for (j = 0; j <= i; j++)
+		{
+			dot = 0;
+			for (m = 0; m < dim; m++)
+				dot += (v[i + 1][m] - v[0][m]) * (v[j + 1][m] - v[0][m]);
+			a[i * k + j] = a[j * k + i] = 2 * dot;
+			if (i == j)
+			{
+				b[i] = dot;
+				scale = fmax(scale, 2 * dot);
+			}
+		}
+	memcpy(g, a, k * k * sizeof(double));
+	if (fabs(determinant(g, k)) > MESH_EPSILON * pow(scale, k) && solveLinear(a, b, k))
+	{
+		for (m = 0; m < dim; m++)
+		{
+			c[m] = 0;
+			for (j = 0; j < k; j++)
+				c[m] += b[j] * (v[j + 1][m] - v[0][m]);
+			centre[m] = v[0][m] + c[m];
+			*r2 += c[m] * c[m];
+		}
+		return;
+	}
+	for (drop = 0; drop <= k; drop++)
+	{
+		for (i = 0, j = 0; i <= k; i++)
+			if (i != drop)
+				w[j++] = v[i];
+		smallestSphere(w, k - 1, dim, c, &s2);
+		if (s2 >= *r2)
+		{
+			*r2 = s2;
+			memcpy(centre, c, dim * sizeof(double));
+		}
+	}
+}
+
+static void faceSphere(const meshT *mesh, const int *face, int nv, double *sphere)
+{
+	const double *v[MESH_DIMmax + 1];
+	int i;
+	for (i = 0; i < nv; i++)
+		v[i] = mesh->points + (R_xlen_t)face[i] * mesh->dim;
+	smallestSphere(v, nv - 1, mesh->dim, sphere, sphere + mesh->dim);
+}
+
+static int compareInts(const void *a, const void *b)
+{
+	int x = *(const int *)a, y = *(const int *)b;
+	return ((x > y) - (x < y));
+}
+
+/* Fill level with the facets of the faces of upper, giving each its
+   alpha value. Returns 0 if out of memory. */
+static int facetLevel(const meshT *mesh, const faceLevelT *upper, faceLevelT *level)
+{
+	int face[MESH_DIMmax + 1], drop, i, j, w, dim = mesh->dim;
+	R_xlen_t t, slot, f;
+	const double *sphere, *x;
+	double d2, diff;
+
+	level->nv = upper->nv - 1;
+	for (t = 0; t < upper->count; t++)
+		for (drop = 0; drop < upper->nv; drop++)
+		{
+			for (i = 0, j = 0; i < upper->nv; i++)
+				if (i != drop)
+					face[j++] = upper->vertices[t * upper->nv + i];
+			w = upper->vertices[t * upper->nv + drop];
+			if (!growFaceLevel(level, dim))
+				return (0);
+			slot = findFace(level, face);
+			if ((f = level->table[slot]) < 0)
+			{
+				f = level->count++;
+				level->table[slot] = f;
+				memcpy(level->vertices + f * level->nv, face, level->nv * sizeof(int));
+				level->alpha[f] = -1;
+				faceSphere(mesh, face, level->nv, level->spheres + f * (dim + 1));
+			}
+
+			/* Attached to this coface if its other vertex is inside */
+			sphere = level->spheres + f * (dim + 1);
+			x = mesh->points + (R_xlen_t)w * dim;
+			d2 = 0;
+			for (i = 0; i < dim; i++)
+			{
+				diff = x[i] - sphere[i];
+				d2 += diff * diff;
+			}
+			if (d2 < sphere[dim] * (1 - MESH_EPSILON) &&
+				(level->alpha[f] < 0 || upper->alpha[t] < level->alpha[f]))
+				level->alpha[f] = upper->alpha[t];
+		}
+	for (f = 0; f < level->count; f++)
+		if (level->alpha[f] < 0)
+			level->alpha[f] = sqrt(level->spheres[f * (dim + 1) + dim]);
+	free(level->spheres);
+	free(level->table);
+	level->spheres = NULL;
+	level->table = NULL;
+	return (1);
+}
+
+/* The faces of each dimension k = 0..d of the Delaunay triangulation
+   with simplices, an s-by-(d+1) matrix of 1-based indices of the n-by-d
+   matrix of points, as a list of d + 1 matrices of 1-based indices, one
+   face a row, and a list of their alpha values */
+SEXP C_alphaFaces(const SEXP points, const SEXP simplices)
+{
+	meshT mesh;
+	faceLevelT levels[MESH_DIMmax + 1], top;
+	R_xlen_t c, f;
+	int k, i, dim;
+	SEXP result, names, faces, alphas, rFaces;
+
+	meshCellsFromMatrices(points, simplices, True, &mesh);
+	dim = mesh.dim;
+	memset(levels, 0, sizeof(levels));
+
+	/* The simplices, at their circumradii */
+	memset(&top, 0, sizeof(top));
+	top.nv = mesh.nv;
+	top.count = top.capacity = mesh.ncells;
+	top.vertices = (int *)malloc((mesh.ncells ? mesh.ncells : 1) * mesh.nv * sizeof(int));
+	top.alpha = (double *)malloc((mesh.ncells ? mesh.ncells : 1) * sizeof(double));
+	top.spheres = (double *)malloc((dim + 1) * sizeof(double));
+	if (!top.vertices || !top.alpha || !top.spheres)
+	{
+		freeFaceLevel(&top);
+		error("Unable to allocate memory for the faces of the triangulation");
+	}
+	for (c = 0; c < mesh.ncells; c++)
+	{
+		memcpy(top.vertices + c * mesh.nv, mesh.cells + c * mesh.nv, mesh.nv * sizeof(int));
+		qsort(top.vertices + c * mesh.nv, mesh.nv, sizeof(int), compareInts);
+		faceSphere(&mesh, top.vertices + c * mesh.nv, mesh.nv, top.spheres);
+		top.alpha[c] = sqrt(top.spheres[dim]);
+	}
+	free(top.spheres);
+	top.spheres = NULL;
+	levels[dim] = top;
+
+	for (k = dim - 1; k >= 0; k--)
+		if (!facetLevel(&mesh, &levels[k + 1], &levels[k]))
+		{
+			for (i = 0; i <= dim; i++)
+				freeFaceLevel(&levels[i]);
+			error("Unable to allocate memory for the faces of the triangulation");
+		}
+
+	PROTECT(faces = allocVector(VECSXP, dim + 1));
+	PROTECT(alphas = allocVector(VECSXP, dim + 1));
+	for (k = 0; k <= dim; k++)
+	{
+		rFaces = allocMatrix(INTSXP, levels[k].count, k + 1);
+		SET_VECTOR_ELT(faces, k, rFaces);
+		for (f = 0; f < levels[k].count; f++)
+			for (i = 0; i <= k; i++)
+				INTEGER(rFaces)[f + levels[k].count * i] = levels[k].vertices[f * (k + 1) + i] + 1;
+		SET_VECTOR_ELT(alphas, k, allocVector(REALSXP, levels[k].count));
+		if (levels[k].count)
+			memcpy(REAL(VECTOR_ELT(alphas, k)), levels[k].alpha, levels[k].count * sizeof(double));
+	}
+	for (k = 0; k <= dim; k++)
+		freeFaceLevel(&levels[k]);
+
+	PROTECT(result = allocVector(VECSXP, 2));
+	PROTECT(names = allocVector(STRSXP, 2));
+	SET_VECTOR_ELT(result, 0, faces);
+	SET_STRING_ELT(names, 0, mkChar("faces"));
+	SET_VECTOR_ELT(result, 1, alphas);
+	SET_STRING_ELT(names, 1, mkChar("alpha_values"));
+	setAttrib(result, R_NamesSymbol, names);
+	UNPROTECT(4);
+	return (result);
+}
@@ -0,0 +1,289 @@
+/* Copyright (C) 2018
+
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+*/
+#include "RcompGeomete.h"
+#include <stdint.h>
+#include <string.h>
+
+/* Content-addressed cache of qhull results.
+
+   The results of C_convex(), C_delaunayn() and C_voronoiR() are kept,
+   keyed by a hash of the input matrix, the qhull options and the kind
+   of computation. Each entry holds the list returned to R, which in
+   turn holds the external pointer to the built qhull context, so a
+   repeated call with the same geometry returns without running qhull.
+   The qhull context is owned by R (see qhullFinalizer()); evicting an
+   entry only releases the cache's reference to it.
+
+   Entries are kept in least recently used order and evicted once the
+   total exceeds the option compGeometeR.cache_size (bytes). */
+
+#define CACHE_DEFAULTsize (128.0 * 1024 * 1024)
+
+typedef struct cacheEntryT cacheEntryT;
+struct cacheEntryT
+{
+	cacheEntryT *prev, *next; /* most recently used first */
+	uint64_t hash;
+	char kind[16];
+	char *options;
+	int n, dim;
+	double *points; /* copy of the input, to rule out hash collisions */
+	SEXP result;	/* preserved until evicted */
+	size_t bytes;
+};
+
+static struct
+{
+	cacheEntryT *head, *tail;
+	int entries;
+	size_t bytes;
+	double hits, misses, evictions;
+} cache;
+
+static double cacheLimit(void)
+{
+	SEXP size = GetOption1(install("compGeometeR.cache_size"));
+	if (isNull(size))
+		return (CACHE_DEFAULTsize);
+	double limit = asReal(size);
+	return ((ISNAN(limit) || limit < 0) ? 0 : limit);
+}
+
+static uint64_t mixHash(uint64_t h, uint64_t word)
+{
+	h ^= word;
+	h *= 0x100000001b3ULL;
+	return (h ^ (h >> 29));
+}
+
+static uint64_t hashInput(const char *kind, SEXP p, const char *options)
+{
+	uint64_t h = 0xcbf29ce484222325ULL, word;
+	R_xlen_t i, len = XLENGTH(p);
+	const double *x = REAL(p);
+	const char *c;
+
+	for (c = kind; *c; c++)
+		h = mixHash(h, (unsigned char)*c);
+	for (c = options; *c; c++)
+		h = mixHash(h, (unsigned char)*c);
+	h = mixHash(h, (uint64_t)nrows(p));
+	h = mixHash(h, (uint64_t)ncols(p));
+	for (i = 0; i < len; i++)
+	{
+		memcpy(&word, x + i, sizeof(word));
+		h = mixHash(h, word);
+	}
+	/* splitmix64 finaliser */
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	return (h ^ (h >> 31));
+}
+
+/* Approximate memory held by an R object, counting vector payloads */
+static size_t objectBytes(SEXP x)
+{
+	R_xlen_t i;
+	size_t bytes = 0;
+	/* Lazy components hold little until they are used, see Rlazy.c */
+	if (ALTREP(x))
+		return (lazyBytes(x));
+	switch (TYPEOF(x))
+	{
+	case LGLSXP:
+	case INTSXP:
+		bytes = XLENGTH(x) * sizeof(int);
+		break;
+	case REALSXP:
+		bytes = XLENGTH(x) * sizeof(double);
+		break;
+	case VECSXP:
+		bytes = XLENGTH(x) * sizeof(SEXP);
+		for (i = 0; i < XLENGTH(x); i++)
+			bytes += objectBytes(VECTOR_ELT(x, i));
+		break;
+	}
+	return (bytes);
+}
+
+/* Memory held by any qhull contexts attached to the result */
+static size_t qhullBytes(SEXP x)
+{
+	SEXP tags[] = {install("convex_hull"), install("delaunay_tri"), install("voronoi_diagram")};
+	size_t bytes = 0;
+	R_xlen_t i;
+	qhT *qh;
+	for (i = 0; i < 3; i++)
+	{
+		SEXP ptr = getAttrib(x, tags[i]);
+		if (TYPEOF(ptr) == EXTPTRSXP && (qh = R_ExternalPtrAddr(ptr)))
+			bytes += qh->qhmem.totbuffer + qh->qhmem.totlong;
+	}
+	if (TYPEOF(x) == VECSXP)
+		for (i = 0; i < XLENGTH(x); i++)
+			bytes += qhullBytes(VECTOR_ELT(x, i));
+	return (bytes);
+}
+
+static void unlinkEntry(cacheEntryT *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		cache.head = entry->next;
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		cache.tail = entry->prev;
+	entry->prev = entry->next = NULL;
+}
+
+static void pushEntry(cacheEntryT *entry)
+{
+	entry->next = cache.head;
+	entry->prev = NULL;
+	if (cache.head)
+		cache.head->prev = entry;
+	cache.head = entry;
+	if (!cache.tail)
+		cache.tail = entry;
+}
+
+static void freeEntry(cacheEntryT *entry)
+{
+	unlinkEntry(entry);
+	cache.entries--;
+	cache.bytes -= entry->bytes;
+	R_ReleaseObject(entry->result);
+	free(entry->options);
+	free(entry->points);
+	free(entry);
+}
+
+static void evictTo(double limit)
+{
+	while (cache.tail && cache.bytes > limit)
+	{
+		freeEntry(cache.tail);
+		cache.evictions++;
+	}
+}
+
+/* Return the cached result for this input, or R_NilValue */
+SEXP cacheLookup(const char *kind, SEXP p, SEXP options)
+{
+	cacheEntryT *entry;
+	const char *opts = CHAR(STRING_ELT(options, 0));
+	uint64_t hash;
+
+	/* Points held outside R memory (see Rpointfile.c) would be hashed
+	   and copied to double in full, and a file may since have changed */
+	if (cacheLimit() <= 0 || isPointFile(p))
+		return (R_NilValue);
+	hash = hashInput(kind, p, opts);
+	for (entry = cache.head; entry; entry = entry->next)
+	{
+		if (entry->hash == hash && !strcmp(entry->kind, kind) &&
+			entry->n == nrows(p) && entry->dim == ncols(p) &&
+			!strcmp(entry->options, opts) &&
+			!memcmp(entry->points, REAL(p), XLENGTH(p) * sizeof(double)))
+		{
+			cache.hits++;
+			unlinkEntry(entry);
+			pushEntry(entry);
+			return (entry->result);
+		}
+	}
+	cache.misses++;
+	return (R_NilValue);
+}
+
+/* Keep a successful result for later calls with the same input */
+void cacheStore(const char *kind, SEXP p, SEXP options, SEXP result)
+{
+	cacheEntryT *entry;
+	const char *opts = CHAR(STRING_ELT(options, 0));
+	double limit = cacheLimit();
+	size_t bytes;
+
+	if (limit <= 0 || isPointFile(p))
+		return;
+	bytes = sizeof(cacheEntryT) + XLENGTH(p) * sizeof(double) +
+			objectBytes(result) + qhullBytes(result);
+	if (bytes > limit)
+		return;
+
+	entry = (cacheEntryT *)calloc(1, sizeof(cacheEntryT));
+	if (!entry)
+		return;
+	entry->points = (double *)malloc(XLENGTH(p) * sizeof(double));
+	entry->options = (char *)malloc(strlen(opts) + 1);
+	if (!entry->points || !entry->options)
+	{
+		free(entry->points);
+		free(entry->options);
+		free(entry);
+		return;
+	}
+	memcpy(entry->points, REAL(p), XLENGTH(p) * sizeof(double));
+	strcpy(entry->options, opts);
+	snprintf(entry->kind, sizeof(entry->kind), "%s", kind);
+	entry->hash = hashInput(kind, p, opts);
+	entry->n = nrows(p);
+	entry->dim = ncols(p);
+	entry->bytes = bytes;
+	/* The same object is handed out on every hit, so R must copy it
+	   before any modification */
+	MARK_NOT_MUTABLE(result);
+	R_PreserveObject(result);
+	entry->result = result;
+
+	pushEntry(entry);
+	cache.entries++;
+	cache.bytes += bytes;
+	evictTo(limit);
+}
+
+SEXP C_cacheStats(void)
+{
+	SEXP stats, names;
+	const char *fields[] = {"hits", "misses", "evictions", "entries", "bytes", "max_bytes"};
+	double values[] = {cache.hits, cache.misses, cache.evictions, cache.entries,
+					   (double)cache.bytes, cacheLimit()};
+	int i;
+
+	PROTECT(stats = allocVector(VECSXP, 6));
+	PROTECT(names = allocVector(STRSXP, 6));
+	for (i = 0; i < 6; i++)
+	{
+		SET_VECTOR_ELT(stats, i, ScalarReal(values[i]));
+		SET_STRING_ELT(names, i, mkChar(fields[i]));
+	}
+	setAttrib(stats, R_NamesSymbol, names);
+	UNPROTECT(2);
+	return stats;
+}
+
+SEXP C_cacheClear(void)
+{
+	while (cache.head)
+		freeEntry(cache.head);
+	cache.hits = cache.misses = cache.evictions = 0;
+	return R_NilValue;
+}
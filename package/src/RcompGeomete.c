@@ -18,12 +18,12 @@
 #include <Rdefines.h>
 #include <Rinternals.h>
 #include "qhull_ra.h"
-
-FILE *tmpstdout;
+#include <string.h>
 
 void freeQhull(qhT *qh)
 {
 	int curlong, totlong;
+	FILE *errfile = qh->qhmem.ferr; /* message stream, see newMessageStream() */
 	qh_freeqhull(qh, !qh_ALL);				 /* free long memory */
 	qh_memfreeshort(qh, &curlong, &totlong); /* free short memory and memory allocator */
 	if (curlong || totlong)
@@ -31,9 +31,300 @@ void freeQhull(qhT *qh)
 		warning("convhulln: did not free %d bytes of long memory (%d pieces)",
 				totlong, curlong);
 	}
+	freeMessageStream(errfile);
 	qh_free(qh);
 }
 
+/* Check the point matrix and option string passed to the functions
+   that build a hull */
+void checkQhullInput(SEXP p, SEXP options)
+{
+	if (!isString(options) || length(options) != 1)
+		error("Second argument must be a single string.");
+	if (!isMatrix(p) || !isReal(p))
+		error("First argument should be a real matrix.");
+	if (LENGTH(STRING_ELT(options, 0)) > 200)
+		error("Option string too long");
+	if (ncols(p) <= 0 || nrows(p) <= 0)
+		error("Invalid input matrix.");
+	if (nrows(p) <= ncols(p))
+		error("Number of points is not greater than the number of dimensions.");
+}
+
+/* Copy the column-major matrix p to the row-major array qhull reads.
+   qhull keeps pointers into the array for as long as the hull is
+   attached to a result, so it is given ownership of the copy
+   (*ismalloc is True). The row-major doubles of a point file are not
+   copied at all: qhull reads the mapping in place, and the result
+   keeps the file mapped (*ismalloc is False). */
+double *copyPoints(SEXP p, boolT *ismalloc)
+{
+	R_xlen_t i, n = nrows(p);
+	int j, dim = ncols(p);
+	const double *rows = pointFileRows(p);
+	double *pt_array;
+
+	*ismalloc = (rows == NULL);
+	if (rows)
+		return ((double *)rows);
+	pt_array = (double *)malloc(n * dim * sizeof(double));
+	if (!pt_array)
+		error("Unable to allocate memory for %ld points", (long)n);
+	if (isPointFile(p))
+		pointFileCopyRows(p, pt_array);
+	else
+		for (i = 0; i < n; i++)
+			for (j = 0; j < dim; j++)
+				pt_array[dim * i + j] = REAL(p)[i + n * j];
+	return (pt_array);
+}
+
+/* Free pt_array from copyPoints() unless it is the mapping of p */
+void freePoints(SEXP p, double *pt_array)
+{
+	if ((const void *)pt_array != pointFileMapping(p))
+		free(pt_array);
+}
+
+/* Build the hull of n points of dimension dim with the qhull command
+   flags, writing qhull's messages to errfile (see newMessageStream()).
+   qhull frees pt_array with the hull if ismalloc is set. Returns
+   qhull's exit code. No R API is used, so this may run on a worker
+   thread (see Rjob.c); qhull then stops with an error once *cancel is
+   set. */
+int runQhull(qhT *qh, FILE *errfile, double *pt_array, int dim, int n, boolT ismalloc,
+			 const char *flags, volatile int *cancel)
+{
+	qh_zero(qh, errfile);
+	qh->cancel = cancel;
+	return (qh_new_qhull(qh, dim, n, pt_array, ismalloc, (char *)flags, NULL, errfile));
+}
+
+/* Number the lower Delaunay facets 1, 2, ... in facet->visitid and the
+   upper facets 0, as qh_eachvoronoi_all() does before it visits the
+   Voronoi ridges, and prepare facet->center for Voronoi vertices.
+   Done once per hull rather than once per facet, as the neighbour ids
+   and circumcentres only need the numbering. */
+void numberDelaunayFacets(qhT *qh)
+{
+	facetT *facet;
+	int id = 1;
+
+	qh_clearcenters(qh, qh_ASvoronoi);
+	maximize_(qh->visit_id, (unsigned)qh->num_facets);
+	FORALLfacets
+	{
+		facet->visitid = (facet->upperdelaunay == qh->UPPERdelaunay) ? id++ : 0;
+		facet->seen = False;
+		facet->seen2 = True;
+	}
+}
+
+/* Circumcentres and circumradii of lower Delaunay facets, see
+   delaunayCircumspheres() */
+typedef struct
+{
+	facetT **facets;
+	R_xlen_t nf;
+	int dim;
+	double *centres, *radii;
+	float *single; /* centres in single precision, in place of centres */
+	char *failed;
+} circumspheresT;
+
+static void storeCentre(const circumspheresT *task, R_xlen_t i, int j, double value)
+{
+	if (task->single)
+		task->single[i + task->nf * j] = (float)value;
+	else if (task->centres)
+		task->centres[i + task->nf * j] = value;
+}
+
+static void circumspheresChunk(void *ctx, R_xlen_t begin, R_xlen_t end)
+{
+	const circumspheresT *task = (const circumspheresT *)ctx;
+	const double *v[MESH_DIMmax + 1];
+	double centre[MESH_DIMmax], radius;
+	R_xlen_t i;
+	int j, k;
+
+	for (i = begin; i < end; i++)
+	{
+		facetT *facet = task->facets[i];
+		for (k = 0; k <= task->dim; k++)
+			v[k] = SETelemt_(facet->vertices, k, vertexT)->point;
+		if (!simplexCircumcentre(v, task->dim, centre, &radius))
+		{
+			task->failed[i] = 1;
+			continue;
+		}
+		for (j = 0; j < task->dim; j++)
+			storeCentre(task, i, j, centre[j]);
+		if (task->radii)
+			task->radii[i] = radius;
+	}
+}
+
+/* Fill centres (nf-by-dim, column-major) and radii, either of which may
+   be NULL, with the circumspheres of the simplicial lower Delaunay
+   facets facets[0..nf-1]. They are solved from the vertices on the
+   threads of the pool; a simplex too flat to solve is given the centre
+   qh_facetcenter() finds, on this thread. The radius is the distance
+   from the centre to the first vertex. With single, centres is an
+   array of floats: the centres are still solved in double precision
+   and only rounded when stored, and the radii stay double, as they
+   decide which simplices are in an alpha complex. */
+void delaunayCircumspheres(qhT *qh, facetT **facets, R_xlen_t nf, int dim, void *centres, boolT single,
+						   double *radii)
+{
+	circumspheresT task;
+	vertexT *vertex;
+	double r2, diff;
+	R_xlen_t i;
+	int j;
+
+	task.facets = facets;
+	task.nf = nf;
+	task.dim = dim;
+	task.centres = single ? NULL : (double *)centres;
+	task.single = single ? (float *)centres : NULL;
+	task.radii = radii;
+	task.failed = (char *)R_alloc(nf, sizeof(char));
+	if (dim <= MESH_DIMmax)
+	{
+		memset(task.failed, 0, nf);
+		parallelFor(nf, 512, circumspheresChunk, &task);
+	}
+	else
+		memset(task.failed, 1, nf);
+
+	for (i = 0; i < nf; i++)
+	{
+		facetT *facet = facets[i];
+		if (!task.failed[i])
+			continue;
+		if (!facet->center)
+			facet->center = qh_facetcenter(qh, facet->vertices);
+		vertex = SETfirstt_(facet->vertices, vertexT);
+		r2 = 0;
+		for (j = 0; j < dim; j++)
+		{
+			storeCentre(&task, i, j, facet->center[j]);
+			diff = vertex->point[j] - facet->center[j];
+			r2 += diff * diff;
+		}
+		if (radii)
+			radii[i] = sqrt(r2);
+	}
+}
+
+/* Create an in-memory stream for qhull's output and error messages.
+   The result is only ever passed to qhull as its errfile and read back
+   with messageStreamText(); it is not a real FILE. */
+FILE *newMessageStream(void)
+{
+	FILE *stream = openMessageStream();
+	if (!stream)
+		error("Unable to allocate qhull message buffer");
+	return (stream);
+}
+
+/* As newMessageStream(), but returning NULL if out of memory, for
+   qhull runs on the threads of the pool */
+FILE *openMessageStream(void)
+{
+	messageStreamT *stream = (messageStreamT *)calloc(1, sizeof(messageStreamT));
+	if (stream)
+		stream->magic = qh_MESSAGEmagic;
+	return ((FILE *)stream);
+}
+
+boolT isMessageStream(FILE *fp)
+{
+	if (!fp || fp == qh_FILEstderr)
+		return (False);
+	return (((messageStreamT *)fp)->magic == qh_MESSAGEmagic);
+}
+
+/* Append formatted text to the stream, dropping anything beyond
+   qh_MESSAGEmax bytes so that tracing options cannot exhaust memory */
+void messageStreamVprintf(FILE *fp, const char *fmt, va_list args)
+{
+	messageStreamT *stream = (messageStreamT *)fp;
+	va_list copy;
+	int needed;
+	size_t size;
+	char *text;
+
+	if (stream->truncated)
+		return;
+	va_copy(copy, args);
+	needed = vsnprintf(NULL, 0, fmt, copy);
+	va_end(copy);
+	if (needed <= 0)
+		return;
+	if (stream->len + needed >= qh_MESSAGEmax)
+	{
+		stream->truncated = True;
+		return;
+	}
+	if (stream->len + needed + 1 > stream->size)
+	{
+		size = stream->size ? stream->size : 256;
+		while (size < stream->len + needed + 1)
+			size *= 2;
+		text = (char *)realloc(stream->text, size);
+		if (!text)
+		{
+			stream->truncated = True;
+			return;
+		}
+		stream->text = text;
+		stream->size = size;
+	}
+	vsnprintf(stream->text + stream->len, needed + 1, fmt, args);
+	stream->len += needed;
+}
+
+void messageStreamPrintf(FILE *fp, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	messageStreamVprintf(fp, fmt, args);
+	va_end(args);
+}
+
+/* Return the text written to the stream as a character vector */
+SEXP messageStreamText(FILE *fp)
+{
+	messageStreamT *stream = (messageStreamT *)fp;
+	if (!isMessageStream(fp) || !stream->len)
+		return (allocVector(STRSXP, 0));
+	return (ScalarString(mkCharLen(stream->text, (int)stream->len)));
+}
+
+void freeMessageStream(FILE *fp)
+{
+	if (!isMessageStream(fp))
+		return;
+	messageStreamT *stream = (messageStreamT *)fp;
+	stream->magic = 0;
+	free(stream->text);
+	free(stream);
+}
+
+/* Record a qhull failure on the object returned to R. The R wrappers
+   turn these attributes into a "qhull_error" condition, see
+   qhull_check() */
+void setQhullError(SEXP retlist, int exitcode, FILE *errfile)
+{
+	SEXP messages;
+	setAttrib(retlist, install("qhull_exitcode"), ScalarInteger(exitcode));
+	PROTECT(messages = messageStreamText(errfile));
+	setAttrib(retlist, install("qhull_messages"), messages);
+	UNPROTECT(1);
+}
+
 /* Finalizer which R will call when garbage collecting. This is
    registered at the end of convhulln() */
 void qhullFinalizer(SEXP ptr)
@@ -1,26 +1,193 @@
-/* This file is included via Makevars in all C files */
-#include <R.h>
-#include <Rdefines.h>
-#include <Rinternals.h>
-
-extern FILE * tmpstdout;
-#undef stdout
-
-
-/* For stderr, qhull already defines a dummy stderr qh_FILEstderr in
-   libqhull_r.h */
-#undef stderr
-#define stderr qh_FILEstderr
-
-/* PI has been defined by the R header files, but the Qhull package
-   defines it again, so undefine it here. */
-#undef PI
-
-#include "qhull_ra.h"
-
-
-
-void print_summary(qhT *qh);
-void freeQhull(qhT *qh);
-void qhullFinalizer(SEXP ptr);
-boolT hasPrintOption(qhT *qh, qh_PRINT format);
+/* This file is included via Makevars in all C files */
+#ifndef RCOMPGEOMETE_H
+#define RCOMPGEOMETE_H
+
+#include <R.h>
+#include <Rdefines.h>
+#include <Rinternals.h>
+#include <stdarg.h>
+
+#undef stdout
+
+
+/* For stderr, qhull already defines a dummy stderr qh_FILEstderr in
+   libqhull_r.h */
+#undef stderr
+#define stderr qh_FILEstderr
+
+/* PI has been defined by the R header files, but the Qhull package
+   defines it again, so undefine it here. */
+#undef PI
+
+#include "qhull_ra.h"
+
+
+
+void print_summary(qhT *qh);
+void freeQhull(qhT *qh);
+void qhullFinalizer(SEXP ptr);
+boolT hasPrintOption(qhT *qh, qh_PRINT format);
+
+/* In-memory stream handed to qhull in place of a FILE. qh_fprintf()
+   (userprintf_r.c) appends to it, so qhull never touches the
+   filesystem and its messages can be returned to R on error. */
+#define qh_MESSAGEmagic 0x71684d53
+#define qh_MESSAGEmax 65536
+
+typedef struct
+{
+	unsigned int magic;
+	char *text;
+	size_t len, size;
+	boolT truncated;
+} messageStreamT;
+
+FILE *newMessageStream(void);
+FILE *openMessageStream(void);
+boolT isMessageStream(FILE *fp);
+void messageStreamVprintf(FILE *fp, const char *fmt, va_list args);
+void messageStreamPrintf(FILE *fp, const char *fmt, ...);
+SEXP messageStreamText(FILE *fp);
+void freeMessageStream(FILE *fp);
+void setQhullError(SEXP retlist, int exitcode, FILE *errfile);
+
+/* Cache of qhull results keyed by input, see Rcache.c */
+SEXP cacheLookup(const char *kind, SEXP p, SEXP options);
+void cacheStore(const char *kind, SEXP p, SEXP options, SEXP result);
+
+/* A mesh of simplices held in plain arrays, such as a triangulation
+   read from a file or extracted from qhull, see Rsimplex.c. Points and
+   cells are row-major; cells hold 0-based point ids. */
+#define MESH_DIMmax 16
+#define MESH_EPSILON 1e-10
+
+typedef struct
+{
+	int dim;			   /* dimension of the points */
+	int nv;				   /* vertices per cell, dim + 1 for simplices */
+	R_xlen_t npoints, ncells;
+	const double *points;  /* npoints x dim */
+	const int *cells;	   /* ncells x nv */
+	const int *neighbours; /* ncells x nv, 1-based cell opposite each vertex, 0 if none */
+	boolT convex;		   /* cells cover the convex hull of the points */
+} meshT;
+
+int solveLinear(double *a, double *b, int n);
+double determinant(double *a, int n);
+int simplexCircumcentre(const double *const *v, int dim, double *centre, double *radius);
+int simplexBarycentric(const double *const *v, int dim, const double *x, double *lambda);
+int simplexSides(const double *const *v, int dim, const double *x, int *side);
+int simplexHyperplane(const double *const *v, int dim, const double *inside, double *normal, double *offset);
+void meshNeighbours(const meshT *mesh, int *neighbours);
+int meshEdges(const meshT *mesh, R_xlen_t *offsets, int **adjacent);
+R_xlen_t meshLocate(const meshT *mesh, const double *x, R_xlen_t *start, double *lambda, int *side);
+void meshLocateAll(const meshT *mesh, const double *x, R_xlen_t n, const char *keep, int *found);
+void meshCellsFromMatrices(const SEXP points, const SEXP simplices, boolT convex, meshT *mesh);
+void meshFromMatrices(const SEXP points, const SEXP simplices, boolT convex, meshT *mesh);
+void hullContainsAll(const double *normals, const double *offsets, R_xlen_t nfacets, int dim,
+					 double tolerance, const double *x, R_xlen_t n, int *inside);
+
+/* Small dense linear programs, see Rlp.c */
+#define LP_EPSILON 1e-10
+#define LP_OPTIMAL 0
+#define LP_INFEASIBLE 1
+#define LP_UNBOUNDED 2
+#define LP_ERROR 3
+
+int lpSolve(const double *A, const double *b, const double *c, int m, int n,
+			double *x, double *y, double *value);
+
+/* Orientation predicates with exact signs, see Rpredicates.c */
+double orient2d(const double *a, const double *b, const double *c);
+double orient3d(const double *a, const double *b, const double *c, const double *d);
+int simplexOrientation(const double *const *v, int dim);
+
+/* Building hulls; the results are extracted by convexResult(),
+   delaunayResult() and voronoiResult() */
+#define QHULL_CONVEXcmd "qhull %s"
+#define QHULL_DELAUNAYcmd "qhull d Qbb T0 Fn %s"
+
+void checkQhullInput(SEXP p, SEXP options);
+double *copyPoints(SEXP p, boolT *ismalloc);
+void freePoints(SEXP p, double *pt_array);
+int runQhull(qhT *qh, FILE *errfile, double *pt_array, int dim, int n, boolT ismalloc,
+			 const char *flags, volatile int *cancel);
+SEXP convexResult(qhT *qh, int exitcode, double *pt_array, const SEXP p, const SEXP options);
+qhT *attachedHull(const SEXP convexhull);
+R_xlen_t hullHalfspaces(qhT *qh, double *normals, double *offsets);
+
+/* Intersections of hulls by their halfspaces, see Rintersection.c */
+typedef struct
+{
+	double *interior; /* centre of the largest ball inside */
+	double radius;
+	double *vertices; /* nvertices x dim, row-major */
+	int nvertices;
+	double volume, area;
+} intersectionT;
+
+int intersectHalfspaces(const double *halfspaces, int m, int dim, double tolerance,
+						FILE *errfile, intersectionT *result);
+void freeIntersection(intersectionT *result);
+double *hullListHalfspaces(const SEXP hulls, int *m, int *dim, double *tolerance);
+SEXP delaunayResult(qhT *qh, int exitcode, double *pt_array, const SEXP p, const SEXP options, int want);
+SEXP voronoiResult(qhT *qh, int exitcode, double *pt_array, const SEXP p, const SEXP options, int want);
+SEXP delaunayList(SEXP tri, SEXP neighbours, SEXP areas, SEXP point0, SEXP simplexNeighs,
+				  SEXP circumcentres, SEXP circumradii, SEXP hullFacets);
+SEXP latticeDelaunay(const SEXP p, const double *pt_array, int want);
+
+/* Components selected by the what argument of delaunay() and
+   alpha_complex(), passed to C_delaunayn() and C_voronoiR() as a
+   bitmask (see output_mask() in R) */
+#define WANT_SIMPLICES 1
+#define WANT_NEIGHBOURS 2
+#define WANT_AREAS 4
+#define WANT_CIRCUMCENTRES 8
+#define WANT_CIRCUMRADII 16
+#define WANT_HULLFACETS 32
+#define WANT_SINGLE 64 /* circumcentres in single precision, see precision_mask() */
+
+void numberDelaunayFacets(qhT *qh);
+void delaunayCircumspheres(qhT *qh, facetT **facets, R_xlen_t nf, int dim, void *centres, boolT single,
+						   double *radii);
+
+/* Read-only mapping of a whole file, see Rgeomfile.c */
+typedef struct
+{
+	void *base;
+	size_t size;
+#ifdef _WIN32
+	void *file, *mapping; /* HANDLEs */
+#endif
+} mappedFileT;
+
+int mapFile(mappedFileT *map, const char *path, size_t minsize);
+void unmapFile(mappedFileT *map);
+
+/* Point matrices mapped from binary files, see Rpointfile.c */
+boolT isPointFile(SEXP p);
+const void *pointFileMapping(SEXP p);
+const double *pointFileRows(SEXP p);
+void pointFileCopyRows(SEXP p, double *rows);
+
+/* Lazily evaluated result components, see Rlazy.c */
+SEXP lazySimplexPoints(SEXP p, SEXP tri);
+SEXP lazyFirstVertices(SEXP p, SEXP tri);
+SEXP lazySimplexVolumes(SEXP p, SEXP tri);
+SEXP newNeighbourBuffer(R_xlen_t ncells, int nv);
+int *neighbourBufferData(SEXP buffer);
+SEXP lazyNeighbours(SEXP buffer, R_xlen_t ncells, int nv, boolT positive);
+SEXP newSingleBuffer(R_xlen_t n);
+float *singleBufferData(SEXP buffer);
+SEXP lazySingle(SEXP buffer, int nrow, int ncol);
+size_t lazyBytes(SEXP x);
+
+/* The package's thread pool, see Rthreads.c. Loop bodies run on
+   worker threads and must not use the R API. */
+#define THREADS_GRAIN 1024 /* indices per chunk for cheap loop bodies */
+
+int threadCount(void);
+void parallelFor(R_xlen_t n, R_xlen_t grain, void (*body)(void *ctx, R_xlen_t begin, R_xlen_t end), void *ctx);
+void stopThreadPool(void);
+
+#endif /* RCOMPGEOMETE_H */
@@ -18,9 +18,39 @@
 //[[Rcpp::plugins(cpp11)]]
 
 #include "RcompGeomete.h"
-#include <unistd.h> /* For unlink() */
 
-SEXP C_convex(const SEXP p, const SEXP options, SEXP tmpdir)
+SEXP C_convex(const SEXP p, const SEXP options)
+{
+  SEXP retlist;
+  char flags[250]; /* option flags for qhull, see qh_opt.htm */
+  double *pt_array;
+  boolT ismalloc;
+  int exitcode;
+
+  checkQhullInput(p, options);
+  snprintf(flags, sizeof(flags), QHULL_CONVEXcmd, CHAR(STRING_ELT(options, 0)));
+
+  /* Return the earlier result if this geometry has been built before */
+  retlist = cacheLookup("convex", p, options);
+  if (retlist != R_NilValue)
+    return retlist;
+
+  pt_array = copyPoints(p, &ismalloc);
+  qhT *qh = (qhT *)malloc(sizeof(qhT));
+  if (!qh)
+  {
+    freePoints(p, pt_array);
+    error("Unable to allocate memory for qhull");
+  }
+  exitcode = runQhull(qh, newMessageStream(), pt_array, ncols(p), nrows(p), ismalloc, flags, NULL);
+  return convexResult(qh, exitcode, pt_array, p, options);
+}
+
+/* Extract the facets of the hull built by runQhull() into an R list.
+   Takes ownership of qh and pt_array; the hull is attached to the
+   result, or freed if qhull failed. Also used to collect background
+   jobs, see Rjob.c. */
+SEXP convexResult(qhT *qh, int exitcode, double *pt_array, const SEXP p, const SEXP options)
 {
   SEXP retlist, retnames, nor, point0, originalPoint; /* Return list and names */
   int retlen;
@@ -31,59 +61,12 @@ SEXP C_convex(const SEXP p, const SEXP options, SEXP tmpdir)
   SEXP neighbour, neighbours; /* List of neighbours */
   SEXP areas;                 /* Facet areas */
   int i, j, nk;
-  unsigned dim, n, simpliexDim, simplexRow;
-  int exitcode = 1;
-  boolT ismalloc;
-  char flags[250]; /* option flags for qhull, see qh_opt.htm */
-  double *pt_array;
+  unsigned dim = ncols(p), n = nrows(p), simpliexDim, simplexRow;
   /* Initialise return values */
   tri = neighbours = retlist = areas = R_NilValue;
 
-  FILE *errfile = NULL;
-
-  if (!isString(options) || length(options) != 1)
-  {
-    error("Second argument must be a single string.");
-  }
-  if (!isMatrix(p) || !isReal(p))
-  {
-    error("First argument should be a real matrix.");
-  }
-
-  /* Read options into command */
-  i = LENGTH(STRING_ELT(options, 0));
-  if (i > 200)
-    error("Option string too long");
-
-  snprintf(flags, sizeof(flags), "qhull %s", CHAR(STRING_ELT(options, 0)));
-
-  /* Check input*/
-  dim = ncols(p);
-  n = nrows(p);
-  if (dim <= 0 || n <= 0)
-  {
-    error("Invalid input matrix.");
-  }
-  if (n <= dim)
-  {
-    error("Number of points is not greater than the number of dimensions.");
-  }
-
-  i = 0, j = 0;
-  pt_array = (double *)R_alloc(n * dim, sizeof(double));
-  for (i = 0; i < n; i++)
-    for (j = 0; j < dim; j++)
-      pt_array[dim * i + j] = REAL(p)[i + n * j];
-  ismalloc = False; /* True if qhull should free points in qh_freeqhull() or reallocation */
-
-  const char *name;
-
-  name = R_tmpnam("Rf", CHAR(STRING_ELT(tmpdir, 0)));
-  qhT *qh = (qhT *)malloc(sizeof(qhT));
-  qh_zero(qh, errfile);
-  exitcode = qh_new_qhull(qh, dim, n, pt_array, ismalloc, flags, tmpstdout, errfile);
-  unlink(name);
-  free((char *)name);
+  /* qhull's messages, returned to R on error */
+  FILE *errfile = qh->qhmem.ferr;
 
   int *idx;
   SEXP retval;
@@ -145,10 +128,8 @@ SEXP C_convex(const SEXP p, const SEXP options, SEXP tmpdir)
   }
   else // error here
   {    /* exitcode != 1 */
-    /* There has been an error; Qhull will print the error
-message */
-    PROTECT(allocMatrix(INTSXP, n, nVertexMax));
-    PROTECT(retlist = allocVector(VECSXP, 0));
+    /* There has been an error; Qhull has written the error message
+       to errfile, which is returned to R below */
 
     /* If the error been because the points are colinear, coplanar
     &c., then avoid mentioning an error by setting exitcode=2*/
@@ -157,7 +138,6 @@ message */
     {
       exitcode = 2;
     }
-    UNPROTECT(2);
   }
 
   /* Register qhullFinalizer() for garbage collection and attach a
@@ -174,22 +154,154 @@ message */
 
   tag = PROTECT(allocVector(STRSXP, 1));
   SET_STRING_ELT(tag, 0, mkChar("convex_hull"));
-  ptr = PROTECT(R_MakeExternalPtr(qh, tag, R_NilValue));
+  /* The hull of a point file reads its points from the mapping */
+  ptr = PROTECT(R_MakeExternalPtr(qh, tag, isPointFile(p) ? p : R_NilValue));
 
   if (exitcode)
   {
-    // qhullFinalizer(ptr);
+    /* Hand qhull's messages back to R, see qhull_check() */
+    setQhullError(retlist, exitcode, errfile);
+    R_ClearExternalPtr(ptr);
+    /* qhull takes ownership of pt_array once it has read the points */
+    boolT owned = (qh->first_point == pt_array || qh->input_points == pt_array);
+    freeQhull(qh);
+    if (!owned)
+      freePoints(p, pt_array);
+    UNPROTECT(4);
   }
   else
   {
+    R_RegisterCFinalizerEx(ptr, qhullFinalizer, TRUE);
     setAttrib(retval, tag, ptr);
+    cacheStore("convex", p, options, retlist);
+    UNPROTECT(5);
   }
-  UNPROTECT(5);
 
-  if (exitcode)
+  return retlist;
+}
+
+/* The hull attached to the facet matrix of a result of C_convex() */
+qhT *attachedHull(const SEXP convexhull)
+{
+  SEXP ptr, tag;
+  qhT *qh;
+
+  PROTECT(tag = allocVector(STRSXP, 1));
+  SET_STRING_ELT(tag, 0, mkChar("convex_hull"));
+  ptr = getAttrib(convexhull, tag);
+  qh = (TYPEOF(ptr) == EXTPTRSXP) ? R_ExternalPtrAddr(ptr) : NULL;
+  UNPROTECT(1);
+  if (!qh)
+    error("The convex hull is no longer available.");
+  return qh;
+}
+
+/* Copy the facet hyperplanes of the hull, normal . x + offset <= 0
+   inside, into normals (row-major, qh->num_facets x dim) and offsets.
+   The tricoplanar facets that triangulate one facet share its
+   hyperplane, which is given once. Returns the number copied. */
+R_xlen_t hullHalfspaces(qhT *qh, double *normals, double *offsets)
+{
+  facetT *facet;
+  R_xlen_t f = 0;
+  int j, dim = qh->hull_dim;
+
+  FORALLfacets
+  {
+    if (!facet->normal || (facet->tricoplanar && !facet->keepcentrum))
+      continue;
+    for (j = 0; j < dim; j++)
+      normals[f * dim + j] = facet->normal[j];
+    offsets[f++] = facet->offset;
+  }
+  return f;
+}
+
+/* Add the cone from the interior point o over the simplex of base and
+   the vertices of set, its apex at o, to the volume-weighted sum of
+   centroids */
+static void addCone(qhT *qh, const pointT *o, const pointT *base, setT *set, double volume,
+                    double *sum)
+{
+  vertexT *vertex, **vertexp;
+  int j, dim = qh->hull_dim;
+
+  for (j = 0; j < dim; j++)
+    sum[j] += volume * (o[j] + (base ? base[j] : 0)) / (dim + 1);
+  FOREACHvertex_(set)
   {
-    error("Received error code %d from qhull.", exitcode);
+    for (j = 0; j < dim; j++)
+      sum[j] += volume * vertex->point[j] / (dim + 1);
   }
+}
 
+/* The volume, surface area and centroid of the hull attached to the
+   result of C_convex(), with its facet hyperplanes. qh_getarea() sums
+   the volumes of the cones from qh->interior_point over the facets; the
+   centroid is the mean of the centroids of the same cones weighted by
+   their volumes, found in the same pass. */
+SEXP C_hullMetrics(const SEXP convexhull)
+{
+  qhT *qh = attachedHull(convexhull);
+  SEXP retlist, retnames, volume, area, centroid, normals, offsets;
+  facetT *facet;
+  ridgeT *ridge, **ridgep;
+  pointT *centrum;
+  double dist, cone, *sum, *rows;
+  R_xlen_t f, nh;
+  int i, j, dim = qh->hull_dim;
+
+  qh_getarea(qh, qh->facet_list);
+  sum = (double *)R_alloc(dim, sizeof(double));
+  for (j = 0; j < dim; j++)
+    sum[j] = 0;
+  FORALLfacets
+  {
+    if (!facet->normal)
+      continue;
+    qh_distplane(qh, qh->interior_point, facet, &dist);
+    if (facet->simplicial)
+      addCone(qh, qh->interior_point, NULL, facet->vertices, -dist * facet->f.area / dim, sum);
+    else
+    {
+      /* qh_facetarea() splits the facet into simplices from its centrum
+         over its ridges */
+      centrum = qh_getcentrum(qh, facet);
+      FOREACHridge_(facet->ridges)
+      {
+        cone = qh_facetarea_simplex(qh, dim, centrum, ridge->vertices, NULL,
+                                    (boolT)(ridge->top == facet), facet->normal, &facet->offset);
+        addCone(qh, qh->interior_point, centrum, ridge->vertices, -dist * cone / dim, sum);
+      }
+      qh_memfree(qh, centrum, qh->normal_size);
+    }
+  }
+
+  PROTECT(volume = ScalarReal(qh->totvol));
+  PROTECT(area = ScalarReal(qh->totarea));
+  PROTECT(centroid = allocVector(REALSXP, dim));
+  for (j = 0; j < dim; j++)
+    REAL(centroid)[j] = (qh->totvol > 0) ? sum[j] / qh->totvol : NA_REAL;
+
+  rows = (double *)R_alloc((R_xlen_t)qh->num_facets * dim, sizeof(double));
+  PROTECT(offsets = allocVector(REALSXP, qh->num_facets));
+  nh = hullHalfspaces(qh, rows, REAL(offsets));
+  PROTECT(offsets = lengthgets(offsets, nh));
+  PROTECT(normals = allocMatrix(REALSXP, nh, dim));
+  for (f = 0; f < nh; f++)
+    for (j = 0; j < dim; j++)
+      REAL(normals)[f + nh * j] = rows[f * dim + j];
+
+  PROTECT(retlist = allocVector(VECSXP, 5));
+  PROTECT(retnames = allocVector(STRSXP, 5));
+  const char *names[] = {"volume", "area", "centroid", "normals", "offsets"};
+  SEXP values[] = {volume, area, centroid, normals, offsets};
+  for (i = 0; i < 5; i++)
+  {
+    SET_VECTOR_ELT(retlist, i, values[i]);
+    SET_STRING_ELT(retnames, i, mkChar(names[i]));
+  }
+  setAttrib(retlist, R_NamesSymbol, retnames);
+  UNPROTECT(8);
   return retlist;
 }
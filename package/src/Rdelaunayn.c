@@ -18,71 +18,82 @@
 //[[Rcpp::plugins(cpp11)]]
 
 #include "RcompGeomete.h"
-#include <unistd.h> /* For unlink() */
 
-SEXP C_delaunayn(const SEXP p, const SEXP options, SEXP tmpdir)
+SEXP C_delaunayn(const SEXP p, const SEXP options, const SEXP what)
 {
-  SEXP retlist, retnames, nor, point0, originalPoint; /* Return list and names */
-  int retlen = 4;
-
-  SEXP ptr, tag;
-  SEXP tri;                   /* The triangulation */
-  SEXP neighbour, neighbours; /* List of neighbours */
-  SEXP areas;                 /* Facet areas */
-  int i, j, nk;
-  unsigned dim, n, simpliexDim, simplexRow;
-  int exitcode = 1;
-  boolT ismalloc;
+  SEXP retlist;
   char flags[250]; /* option flags for qhull, see qh_opt.htm */
+  char kind[16];
   double *pt_array;
-  /* Initialise return values */
-  tri = neighbours = retlist = areas = R_NilValue;
-
-  FILE *errfile = NULL;
+  boolT ismalloc;
+  int exitcode;
 
-  if (!isString(options) || length(options) != 1)
+  checkQhullInput(p, options);
+  if (!isInteger(what) || length(what) != 1)
   {
-    error("Second argument must be a single string.");
-  }
-  if (!isMatrix(p) || !isReal(p))
-  {
-    error("First argument should be a real matrix.");
+    error("Third argument must be a single integer.");
   }
+  snprintf(flags, sizeof(flags), QHULL_DELAUNAYcmd, CHAR(STRING_ELT(options, 0)));
 
-  /* Read options into command */
-  i = LENGTH(STRING_ELT(options, 0));
-  if (i > 200)
-    error("Option string too long");
+  /* Return the earlier result if this geometry has been built before */
+  snprintf(kind, sizeof(kind), "delaunay%d", INTEGER(what)[0]);
+  retlist = cacheLookup(kind, p, options);
+  if (retlist != R_NilValue)
+    return retlist;
 
-  snprintf(flags, sizeof(flags), "qhull d Qbb T0 Fn %s", CHAR(STRING_ELT(options, 0)));
+  pt_array = copyPoints(p, &ismalloc);
 
-  /* Check input*/
-  dim = ncols(p);
-  n = nrows(p);
-  if (dim <= 0 || n <= 0)
+  /* Points on a complete lattice are triangulated without qhull */
+  retlist = latticeDelaunay(p, pt_array, INTEGER(what)[0]);
+  if (retlist != R_NilValue)
   {
-    error("Invalid input matrix.");
+    PROTECT(retlist);
+    freePoints(p, pt_array);
+    cacheStore(kind, p, options, retlist);
+    UNPROTECT(1);
+    return retlist;
   }
-  if (n <= dim)
+
+  qhT *qh = (qhT *)malloc(sizeof(qhT));
+  if (!qh)
   {
-    error("Number of points is not greater than the number of dimensions.");
+    freePoints(p, pt_array);
+    error("Unable to allocate memory for qhull");
   }
+  exitcode = runQhull(qh, newMessageStream(), pt_array, ncols(p), nrows(p), ismalloc, flags, NULL);
+  return delaunayResult(qh, exitcode, pt_array, p, options, INTEGER(what)[0]);
+}
 
-  i = 0, j = 0;
-  pt_array = (double *)R_alloc(n * dim, sizeof(double));
-  for (i = 0; i < n; i++)
-    for (j = 0; j < dim; j++)
-      pt_array[dim * i + j] = REAL(p)[i + n * j];
-  ismalloc = False; /* True if qhull should free points in qh_freeqhull() or reallocation */
+/* Extract the triangulation built by runQhull() into an R list with the
+   components selected by want. Takes ownership of qh and pt_array; the
+   hull is attached to the result, or freed if qhull failed. Also used
+   to collect background jobs, see Rjob.c. */
+SEXP delaunayResult(qhT *qh, int exitcode, double *pt_array, const SEXP p, const SEXP options, int want)
+{
+  SEXP retlist, nor, point0, originalPoint; /* Return list */
 
-  const char *name;
+  SEXP ptr, tag;
+  SEXP tri;                       /* The triangulation */
+  SEXP neighbours, simplexNeighs; /* Lists of neighbours */
+  SEXP buffer;                    /* Native store of the neighbour ids */
+  SEXP areas;                     /* Facet areas */
+  SEXP circumcentres, circumradii; /* Circumspheres of the simplices */
+  SEXP single;                     /* Native store of single precision circumcentres */
+  void *centres;
+  SEXP hullFacets;                 /* Facets of the convex hull */
+  int *neighbourIds;
+  int nprotect, nh;
+  char kind[16];
+  int nk;
+  unsigned dim = ncols(p), n = nrows(p), simpliexDim, simplexRow;
+  /* Initialise return values */
+  tri = neighbours = simplexNeighs = retlist = areas = point0 = R_NilValue;
+  circumcentres = circumradii = hullFacets = single = R_NilValue;
+  centres = NULL;
 
-  name = R_tmpnam("Rf", CHAR(STRING_ELT(tmpdir, 0)));
-  qhT *qh = (qhT *)malloc(sizeof(qhT));
-  qh_zero(qh, errfile);
-  exitcode = qh_new_qhull(qh, dim, n, pt_array, ismalloc, flags, tmpstdout, errfile);
-  unlink(name);
-  free((char *)name);
+  /* qhull's messages, returned to R on error */
+  FILE *errfile = qh->qhmem.ferr;
+  snprintf(kind, sizeof(kind), "delaunay%d", want);
 
   if (!exitcode)
   { /* 0 if no error from qhull */
@@ -121,19 +132,71 @@ SEXP C_delaunayn(const SEXP p, const SEXP options, SEXP tmpdir)
          below */
       if (!facet->simplicial)
       {
-        Rprintf("Qhull returned non-simplicial facets -- try delaunayn with different options");
+        messageStreamPrintf(errfile, "Qhull returned non-simplicial facets -- try delaunayn with different options\n");
         exitcode = 1;
         break;
       }
     }
 
-    /* Allocate the space in R */
+    /* Neighbour ids are the numbers given to the lower facets */
+    numberDelaunayFacets(qh);
+
+    /* Facets of the convex hull are the faces of lower facets that
+       border an upper facet */
+    nh = 0;
+    if (want & WANT_HULLFACETS)
+    {
+      FORALLfacets
+      {
+        if (!facet->upperdelaunay)
+        {
+          FOREACHneighbor_(facet)
+          {
+            if (!neighbor->visitid)
+              nh++;
+          }
+        }
+      }
+    }
+
+    /* Allocate the space in R for the requested components only.
+       Areas and simplex points are computed when first used, see
+       Rlazy.c */
+    nprotect = 0;
     PROTECT(tri = allocMatrix(INTSXP, nf, dim + 1));
-    PROTECT(neighbours = allocVector(VECSXP, nf));
-    PROTECT(areas = allocVector(REALSXP, nf));
-    PROTECT(point0 = allocMatrix(REALSXP, nf, dim + 1));
+    nprotect++;
+    if (want & WANT_NEIGHBOURS)
+    {
+      PROTECT(buffer = newNeighbourBuffer(nf, dim + 1));
+      nprotect++;
+      neighbourIds = neighbourBufferData(buffer);
+    }
+    if ((want & WANT_CIRCUMCENTRES) && (want & WANT_SINGLE))
+    {
+      PROTECT(single = newSingleBuffer((R_xlen_t)nf * dim));
+      nprotect++;
+      centres = singleBufferData(single);
+    }
+    else if (want & WANT_CIRCUMCENTRES)
+    {
+      PROTECT(circumcentres = allocMatrix(REALSXP, nf, dim));
+      nprotect++;
+      centres = REAL(circumcentres);
+    }
+    if (want & WANT_CIRCUMRADII)
+    {
+      PROTECT(circumradii = allocVector(REALSXP, nf));
+      nprotect++;
+    }
+    if (want & WANT_HULLFACETS)
+    {
+      PROTECT(hullFacets = allocMatrix(INTSXP, nh, dim));
+      nprotect++;
+      nh = 0;
+    }
 
     /* Iterate through facets to extract information */
+    facetT **lower = (facetT **)R_alloc(nf, sizeof(facetT *));
     int i = 0;
     FORALLfacets
     {
@@ -145,12 +208,6 @@ SEXP C_delaunayn(const SEXP p, const SEXP options, SEXP tmpdir)
         }
 
         /* Triangulation */
-        boolT inorder = True;
-
-        qh_RIDGE innerouter = qh_RIDGEall;
-        printvridgeT printvridge = NULL;
-        qh_eachvoronoi_all(qh, errfile, printvridge, qh->UPPERdelaunay, innerouter, inorder);
-
         int j = 0;
 
         if (qh->hull_dim == 3 && facet->toporient == qh_ORIENTclock)
@@ -220,31 +277,52 @@ SEXP C_delaunayn(const SEXP p, const SEXP options, SEXP tmpdir)
         }
 
         /* Neighbours */
-        PROTECT(neighbour = allocVector(INTSXP, qh_setsize(qh, facet->neighbors)));
-        j = 0;
-        FOREACHneighbor_(facet)
+        if (want & WANT_NEIGHBOURS)
         {
-          INTEGER(neighbour)
-          [j] = neighbor->visitid ? neighbor->visitid : 0 - neighbor->id;
-          j++;
+          j = 0;
+          FOREACHneighbor_(facet)
+          {
+            if (j > dim)
+              break;
+            neighbourIds[i * (dim + 1) + j] = neighbor->visitid ? neighbor->visitid : 0 - neighbor->id;
+            j++;
+          }
         }
-        SET_VECTOR_ELT(neighbours, i, neighbour);
-        UNPROTECT(1);
 
-        /* Area. Code modified from qh_getarea() in libquhull/geom2.c */
-        if ((facet->normal) && !(facet->upperdelaunay && qh->ATinfinity))
+        /* Circumspheres are computed from the vertices afterwards */
+        lower[i] = facet;
+
+        /* Hull facets: the face opposite vertex k borders neighbour k */
+        if (want & WANT_HULLFACETS)
         {
-          if (!facet->isarea)
+          int neighbor_i, neighbor_n, vertex_i, vertex_n;
+          FOREACHneighbor_i_(qh, facet)
           {
-            facet->f.area = qh_facetarea(qh, facet);
-            facet->isarea = True;
+            if (!neighbor->visitid)
+            {
+              int k = 0;
+              FOREACHvertex_i_(qh, facet->vertices)
+              {
+                if (vertex_i != neighbor_i)
+                  INTEGER(hullFacets)[nh + nrows(hullFacets) * k++] = qh_pointid(qh, vertex->point);
+              }
+              nh++;
+            }
           }
-          REAL(areas)
-          [i] = facet->f.area;
         }
         i++;
       }
     }
+    /* Circumcentres, the Voronoi vertices, and circumradii */
+    if (want & (WANT_CIRCUMCENTRES | WANT_CIRCUMRADII))
+      delaunayCircumspheres(qh, lower, nf, dim, centres, single != R_NilValue,
+                            (want & WANT_CIRCUMRADII) ? REAL(circumradii) : NULL);
+    if (single != R_NilValue)
+    {
+      PROTECT(circumcentres = lazySingle(single, nf, dim));
+      nprotect++;
+    }
+
     unsigned int firstTemp = 0, secondTemp = 0;
     simpliexDim = ncols(tri);
     simplexRow = nrows(tri);
@@ -259,25 +337,34 @@ SEXP C_delaunayn(const SEXP p, const SEXP options, SEXP tmpdir)
       [i + simplexRow] = firstTemp;
     }
 
-    // get the trigulation simplex point
-    int k = 0, value = 0;
-    int triR = nrows(tri);
-    int triCol = ncols(tri);
-    for (i = 0; i < triR; i++)
-      for (j = 0; j < triCol; j++)
-      {
-        value = INTEGER(tri)[i + triR * j];
-        REAL(point0)
-        [i + triR * j] = REAL(p)[value];
-      }
+    // the areas and trigulation simplex points read the final triangulation
+    if (want & WANT_NEIGHBOURS)
+    {
+      PROTECT(neighbours = lazyNeighbours(buffer, nf, dim + 1, False));
+      PROTECT(simplexNeighs = lazyNeighbours(buffer, nf, dim + 1, True));
+      nprotect += 2;
+    }
+    if (want & WANT_AREAS)
+    {
+      PROTECT(areas = lazySimplexVolumes(p, tri));
+      nprotect++;
+    }
+    if (want & WANT_SIMPLICES)
+    {
+      PROTECT(point0 = lazySimplexPoints(p, tri));
+      nprotect++;
+    }
   }
   else // error here
   {    /* exitcode != 1 */
-    /* There has been an error; Qhull will print the error
-       message */
+    /* There has been an error; Qhull has written the error message
+       to errfile, which is returned to R below */
     PROTECT(tri = allocMatrix(INTSXP, 0, dim + 1));
     PROTECT(neighbours = allocVector(VECSXP, 0));
+    PROTECT(simplexNeighs = allocVector(VECSXP, 0));
     PROTECT(areas = allocVector(REALSXP, 0));
+    PROTECT(point0 = allocMatrix(REALSXP, 0, dim + 1));
+    nprotect = 5;
 
     /* If the error been because the points are colinear, coplanar
        &c., then avoid mentioning an error by setting exitcode=2*/
@@ -288,18 +375,10 @@ SEXP C_delaunayn(const SEXP p, const SEXP options, SEXP tmpdir)
     }
   }
 
-  PROTECT(retlist = allocVector(VECSXP, retlen));
-  PROTECT(retnames = allocVector(VECSXP, retlen));
-  SET_VECTOR_ELT(retlist, 0, tri);
-  SET_VECTOR_ELT(retnames, 0, mkChar("tri"));
-  SET_VECTOR_ELT(retlist, 1, neighbours);
-  SET_VECTOR_ELT(retnames, 1, mkChar("neighbours"));
-  SET_VECTOR_ELT(retlist, 2, areas);
-  SET_VECTOR_ELT(retnames, 2, mkChar("areas"));
-  SET_VECTOR_ELT(retlist, 3, point0);
-  SET_VECTOR_ELT(retnames, 3, mkChar("simplex_points"));
-  setAttrib(retlist, R_NamesSymbol, retnames);
-  UNPROTECT(6);
+  retlist = delaunayList(tri, neighbours, areas, point0, simplexNeighs,
+                         circumcentres, circumradii, hullFacets);
+  UNPROTECT(nprotect);
+  PROTECT(retlist);
 
   /* Register qhullFinalizer() for garbage collection and attach a
      pointer to the hull as an attribute for future use. */
@@ -311,26 +390,55 @@ SEXP C_delaunayn(const SEXP p, const SEXP options, SEXP tmpdir)
   PROTECT(ptr = R_MakeExternalPtr(qh, tag, R_NilValue));
   if (exitcode)
   {
-    // qhullFinalizer(ptr);
+    /* Hand qhull's messages back to R, see qhull_check() */
+    if (exitcode != 2)
+      setQhullError(retlist, exitcode, errfile);
+    R_ClearExternalPtr(ptr);
+    /* qhull takes ownership of pt_array once it has read the points */
+    boolT owned = (qh->first_point == pt_array || qh->input_points == pt_array);
+    freeQhull(qh);
+    if (!owned)
+      freePoints(p, pt_array);
   }
   else
   {
-    // R_RegisterCFinalizerEx(ptr, qhullFinalizer, TRUE);
+    R_RegisterCFinalizerEx(ptr, qhullFinalizer, TRUE);
     setAttrib(retlist, tag, ptr);
+    cacheStore(kind, p, options, retlist);
   }
-  UNPROTECT(2);
+  UNPROTECT(3);
 
-  if (exitcode & (exitcode != 2))
-  {
-    if (exitcode == 1)
-    {
-      error("Qhull returned non-simplicial facets -- try delaunayn with different options. exitcode %d", exitcode);
-    }
-    else
-    {
-      error("Received error code %d from qhull.", exitcode);
-    }
-  }
+  return retlist;
+}
+
+/* The list of the components of a triangulation returned to R, whether
+   extracted from qhull or built directly (see Rlattice.c) */
+SEXP delaunayList(SEXP tri, SEXP neighbours, SEXP areas, SEXP point0, SEXP simplexNeighs,
+                  SEXP circumcentres, SEXP circumradii, SEXP hullFacets)
+{
+  SEXP retlist, retnames;
+  int retlen = 8;
+
+  PROTECT(retlist = allocVector(VECSXP, retlen));
+  PROTECT(retnames = allocVector(VECSXP, retlen));
+  SET_VECTOR_ELT(retlist, 0, tri);
+  SET_VECTOR_ELT(retnames, 0, mkChar("tri"));
+  SET_VECTOR_ELT(retlist, 1, neighbours);
+  SET_VECTOR_ELT(retnames, 1, mkChar("neighbours"));
+  SET_VECTOR_ELT(retlist, 2, areas);
+  SET_VECTOR_ELT(retnames, 2, mkChar("areas"));
+  SET_VECTOR_ELT(retlist, 3, point0);
+  SET_VECTOR_ELT(retnames, 3, mkChar("simplex_points"));
+  SET_VECTOR_ELT(retlist, 4, simplexNeighs);
+  SET_VECTOR_ELT(retnames, 4, mkChar("simplex_neighs"));
+  SET_VECTOR_ELT(retlist, 5, circumcentres);
+  SET_VECTOR_ELT(retnames, 5, mkChar("circumcentres"));
+  SET_VECTOR_ELT(retlist, 6, circumradii);
+  SET_VECTOR_ELT(retnames, 6, mkChar("circumradii"));
+  SET_VECTOR_ELT(retlist, 7, hullFacets);
+  SET_VECTOR_ELT(retnames, 7, mkChar("hull_facets"));
+  setAttrib(retlist, R_NamesSymbol, retnames);
+  UNPROTECT(2);
 
   return retlist;
 }
@@ -0,0 +1,267 @@
+/* Copyright (C) 2018
+
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+*/
+#include "RcompGeomete.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The vertices of the convex hull of a set of points, found without
+   building any facets, whose number grows too fast in 6 or more
+   dimensions. This follows Clarkson (1994), "More output-sensitive
+   geometric algorithms". A set E of points known to be vertices is kept,
+   and every other point p is tested by a linear program for whether it
+   is a convex combination of E. If it is, it is not a vertex. If not,
+   the program gives a direction w in which p lies beyond E, and the
+   point furthest in direction w is a vertex not yet in E. The tests of
+   a round run in parallel over the points, and the vertices they find
+   join E for the next round. */
+
+#define EXTREME_WITNESSmax 1024 /* directions followed per round */
+
+enum
+{
+	POINT_UNKNOWN,
+	POINT_VERTEX,
+	POINT_INSIDE
+};
+
+typedef struct
+{
+	const double *points; /* n x dim, row-major */
+	R_xlen_t n;
+	int dim;
+	double scale; /* largest extent, by which coordinates are divided */
+	char *status;
+	const R_xlen_t *vertices; /* E */
+	R_xlen_t nvertices;
+	const R_xlen_t *tested; /* points tested this round */
+	char *outcome;			/* the LP_ status of the test of each */
+	double *witness;		/* ntested x dim, the direction beyond E of each */
+	const R_xlen_t *candidates; /* points that may still be vertices */
+	R_xlen_t ncandidates;
+	R_xlen_t *furthest; /* the point furthest along each witness */
+} extremeT;
+
+/* Whether point a comes after point b along direction w, ties going to
+   the lexicographically larger point and then to the earlier one, so
+   that the furthest point is always a vertex */
+static int furtherAlong(const extremeT *task, const double *w, R_xlen_t a, R_xlen_t b)
+{
+	const double *pa = task->points + a * task->dim, *pb = task->points + b * task->dim;
+	double da = 0, db = 0;
+	int j;
+	for (j = 0; j < task->dim; j++)
+	{
+		da += w[j] * pa[j];
+		db += w[j] * pb[j];
+	}
+	if (da != db)
+		return (da > db);
+	for (j = 0; j < task->dim; j++)
+		if (pa[j] != pb[j])
+			return (pa[j] > pb[j]);
+	return (a < b);
+}
+
+/* Test the points tested[begin..end-1] against the convex hull of E: is
+   there lambda >= 0 with sum(lambda) = 1 and sum(lambda (e - p)) = 0? */
+static void extremeTestChunk(void *ctx, R_xlen_t begin, R_xlen_t end)
+{
+	const extremeT *task = (const extremeT *)ctx;
+	int m = task->dim + 1, h = (int)task->nvertices, i, j, status;
+	double *A, *b, *y, value;
+	R_xlen_t t;
+
+	A = (double *)malloc((size_t)m * h * sizeof(double));
+	b = (double *)calloc(m, sizeof(double));
+	y = (double *)malloc(m * sizeof(double));
+	for (t = begin; t < end; t++)
+	{
+		const double *p = task->points + task->tested[t] * task->dim;
+		double *w = task->witness + t * task->dim;
+		if (!A || !b || !y)
+		{
+			task->outcome[t] = LP_ERROR;
+			continue;
+		}
+		for (j = 0; j < h; j++)
+		{
+			const double *e = task->points + task->vertices[j] * task->dim;
+			for (i = 0; i < task->dim; i++)
+				A[(size_t)i * h + j] = (e[i] - p[i]) / task->scale;
+			A[(size_t)task->dim * h + j] = 1;
+		}
+		memset(b, 0, m * sizeof(double));
+		b[task->dim] = 1;
+		status = lpSolve(A, b, NULL, m, h, NULL, y, &value);
+		if (status == LP_INFEASIBLE)
+			memcpy(w, y, task->dim * sizeof(double));
+		task->outcome[t] = (char)status;
+	}
+	free(A);
+	free(b);
+	free(y);
+}
+
+/* The candidate furthest along each of the witnesses begin..end-1 */
+static void extremeFurthestChunk(void *ctx, R_xlen_t begin, R_xlen_t end)
+{
+	const extremeT *task = (const extremeT *)ctx;
+	R_xlen_t t, k, best;
+	for (t = begin; t < end; t++)
+	{
+		const double *w = task->witness + t * task->dim;
+		best = task->candidates[0];
+		for (k = 1; k < task->ncandidates; k++)
+			if (furtherAlong(task, w, task->candidates[k], best))
+				best = task->candidates[k];
+		task->furthest[t] = best;
+	}
+}
+
+/* The 1-based indices, in increasing order, of the points of p that
+   are vertices of their convex hull */
+SEXP C_extremePoints(SEXP p)
+{
+	extremeT task;
+	R_xlen_t i, k, t, added, ntested, nvertices = 0, *vertices, *tested, *candidates, *furthest;
+	double lo, hi, *axis;
+	boolT ismalloc, failed = False;
+	double *pt_array;
+	SEXP result;
+	int j;
+
+	if (!isMatrix(p) || !isReal(p))
+		error("points must be a real matrix");
+	task.n = nrows(p);
+	task.dim = ncols(p);
+	if (task.n == 0 || task.dim == 0)
+		return (allocVector(INTSXP, 0));
+	pt_array = copyPoints(p, &ismalloc);
+	task.points = pt_array;
+
+	task.scale = 0;
+	for (j = 0; j < task.dim; j++)
+	{
+		lo = R_PosInf;
+		hi = R_NegInf;
+		for (i = 0; i < task.n; i++)
+		{
+			lo = fmin(lo, pt_array[i * task.dim + j]);
+			hi = fmax(hi, pt_array[i * task.dim + j]);
+		}
+		task.scale = fmax(task.scale, hi - lo);
+	}
+	if (!(task.scale > 0))
+		task.scale = 1;
+
+	task.status = (char *)R_alloc(task.n, sizeof(char));
+	vertices = (R_xlen_t *)R_alloc(task.n, sizeof(R_xlen_t));
+	tested = (R_xlen_t *)R_alloc(task.n, sizeof(R_xlen_t));
+	candidates = (R_xlen_t *)R_alloc(task.n, sizeof(R_xlen_t));
+	furthest = (R_xlen_t *)R_alloc(task.n, sizeof(R_xlen_t));
+	task.witness = (double *)R_alloc(task.n, task.dim * sizeof(double));
+	task.outcome = (char *)R_alloc(task.n, sizeof(char));
+	memset(task.status, POINT_UNKNOWN, task.n);
+	for (i = 0; i < task.n; i++)
+		candidates[i] = i;
+	task.candidates = candidates;
+	task.ncandidates = task.n;
+	task.vertices = vertices;
+	task.tested = tested;
+	task.furthest = furthest;
+
+	/* The furthest points along each axis, both ways, are vertices */
+	axis = (double *)R_alloc(task.dim, sizeof(double));
+	for (j = 0; j < 2 * task.dim; j++)
+	{
+		memset(axis, 0, task.dim * sizeof(double));
+		axis[j / 2] = (j % 2) ? -1 : 1;
+		memcpy(task.witness, axis, task.dim * sizeof(double));
+		extremeFurthestChunk(&task, 0, 1);
+		if (task.status[furthest[0]] != POINT_VERTEX)
+		{
+			task.status[furthest[0]] = POINT_VERTEX;
+			vertices[nvertices++] = furthest[0];
+		}
+	}
+
+	for (;;)
+	{
+		/* Test the candidates that are not known vertices */
+		ntested = 0;
+		for (k = 0; k < task.ncandidates; k++)
+			if (task.status[candidates[k]] == POINT_UNKNOWN)
+				tested[ntested++] = candidates[k];
+		if (ntested == 0)
+			break;
+		task.nvertices = nvertices;
+		parallelFor(ntested, 16, extremeTestChunk, &task);
+
+		/* Points inside the hull of E cannot be vertices, nor can they be
+		   the furthest along any direction that a point beyond E gives */
+		k = 0;
+		for (t = 0; t < ntested; t++)
+		{
+			if (task.outcome[t] == LP_ERROR)
+				failed = True;
+			else if (task.outcome[t] != LP_INFEASIBLE)
+				task.status[tested[t]] = POINT_INSIDE;
+			else if (k < EXTREME_WITNESSmax)
+			{
+				memmove(task.witness + k * task.dim, task.witness + t * task.dim,
+						task.dim * sizeof(double));
+				tested[k++] = tested[t];
+			}
+		}
+		if (failed)
+			break;
+		t = 0;
+		for (i = 0; i < task.ncandidates; i++)
+			if (task.status[candidates[i]] != POINT_INSIDE)
+				candidates[t++] = candidates[i];
+		task.ncandidates = t;
+		if (k == 0)
+			break;
+
+		/* Each direction leads to a new vertex, unless the point it came
+		   from lies beyond E by no more than rounding error */
+		parallelFor(k, 1, extremeFurthestChunk, &task);
+		added = 0;
+		for (t = 0; t < k; t++)
+			if (task.status[furthest[t]] != POINT_VERTEX)
+			{
+				task.status[furthest[t]] = POINT_VERTEX;
+				vertices[nvertices++] = furthest[t];
+				added++;
+			}
+		if (!added)
+			for (t = 0; t < k; t++)
+				task.status[tested[t]] = POINT_INSIDE;
+	}
+	freePoints(p, pt_array);
+	if (failed)
+		error("Unable to allocate memory for the linear programs");
+
+	PROTECT(result = allocVector(INTSXP, nvertices));
+	k = 0;
+	for (i = 0; i < task.n; i++)
+		if (task.status[i] == POINT_VERTEX)
+			INTEGER(result)[k++] = (int)(i + 1);
+	UNPROTECT(1);
+	return (result);
+}
@@ -16,95 +16,116 @@
 ** Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
 */
 #include "RcompGeomete.h"
-#include "qhull_ra.h"
-#include <unistd.h>
-#include <stdio.h>
-#include <string.h>
 
-/* test if a given point is contain in the convex hull , currently not used*/
-
-SEXP C_findSimplex(const SEXP convexhull, const SEXP testPoints)
+/* Fill mesh from the n-by-d matrix of points and the s-by-(d+1) matrix
+   of 1-based point indices of its simplices, as returned by delaunay()
+   and alpha_complex(), but not with the neighbours of the simplices.
+   convex tells whether the simplices cover the convex hull of the
+   points. The arrays are allocated with R_alloc(). */
+void meshCellsFromMatrices(const SEXP points, const SEXP simplices, boolT convex, meshT *mesh)
 {
-	// Retrieve qh object
-	SEXP ptr, tag;
-	qhT *qh;
-	PROTECT(tag = allocVector(STRSXP, 1));
-	facetT *facet;
-	SET_STRING_ELT(tag, 0, mkChar("convexhull"));
-
-	PROTECT(ptr = getAttrib(convexhull, tag));
-
-	qh = R_ExternalPtrAddr(ptr);
-
-	UNPROTECT(2);
-
-	SEXP insideQhull;
-	insideQhull = R_NilValue;
-	vertexT *vertex, **vertexp; /* set by FORALLfacets */
-	unsigned int dim, n;
-	dim = ncols(testPoints);
-	n = nrows(testPoints);
-
-	/* use qh_findbestfacet to check if a point set is inside hull */
-	PROTECT(insideQhull = allocVector(INTSXP, n));
-
-	boolT isoutside;
-	realT bestdist, dist;
-
-	int i, j;
-	for (i = 0; i < n; i++)
+	double *pts;
+	int *cells;
+	R_xlen_t i, n, c;
+	int j, k, id;
+
+	if (!isMatrix(points) || !isReal(points))
+		error("input_points must be a real matrix.");
+	if (!isMatrix(simplices))
+		error("simplices must be a matrix.");
+	mesh->dim = ncols(points);
+	mesh->nv = mesh->dim + 1;
+	mesh->npoints = n = nrows(points);
+	mesh->ncells = nrows(simplices);
+	mesh->convex = convex;
+	if (mesh->dim > MESH_DIMmax)
+		error("at most %d dimensions are supported", MESH_DIMmax);
+	if (ncols(simplices) != mesh->nv)
+		error("simplices must have one more column than the points");
+
+	/* The walk reads the points of a point file in place */
+	if (!(mesh->points = pointFileRows(points)))
 	{
-		double *point;
-		point = (double *)R_alloc(dim, sizeof(double));
-		for (j = 0; j < dim; j++)
+		pts = (double *)R_alloc(n * mesh->dim, sizeof(double));
+		if (isPointFile(points))
+			pointFileCopyRows(points, pts);
+		else
+			for (i = 0; i < n; i++)
+				for (j = 0; j < mesh->dim; j++)
+					pts[i * mesh->dim + j] = REAL(points)[i + n * j];
+		mesh->points = pts;
+	}
+	cells = (int *)R_alloc(mesh->ncells * mesh->nv, sizeof(int));
+	for (c = 0; c < mesh->ncells; c++)
+		for (k = 0; k < mesh->nv; k++)
 		{
-			point[i + n * j] = REAL(testPoints)[i + n * j];
+			id = isReal(simplices) ? (int)REAL(simplices)[c + mesh->ncells * k]
+								   : INTEGER(simplices)[c + mesh->ncells * k];
+			if (id < 1 || id > n)
+				error("simplices refer to points that do not exist");
+			cells[c * mesh->nv + k] = id - 1;
 		}
-		facet->coplanarset;
-		facet = qh_findbestfacet(qh, point, qh_ALL, &bestdist, &isoutside);
-		qh_distplane(qh, point, facet, &dist);
+	mesh->cells = cells;
+	mesh->neighbours = NULL;
+}
 
-		Rprintf("double is %5.2f \n", dist);
-		Rprintf("min_vertex %5.2f \n", qh->min_vertex);
-		Rprintf("DISTround %5.2f \n", qh->DISTround);
-		// Simplices in the triangulation == facets on the convex hull.
-		// if(!isoutside ==TRUE) //point is inside convex hull, so now check which simplex this point lies inside
-		// {
-		FOREACHvertex_(facet->vertices)
-		{
+/* Fill mesh as meshCellsFromMatrices() does, and with the neighbours of
+   the simplices */
+void meshFromMatrices(const SEXP points, const SEXP simplices, boolT convex, meshT *mesh)
+{
+	int *neighbours;
 
-			if (dist < qh->min_vertex - 2 * qh->DISTround)
-			{
-				/* point is clearly inside of facet, get the facet id */
-				INTEGER(insideQhull)
-				[i] = qh_pointid(qh, vertex->point);
-			}
-			else
-			{
-				INTEGER(insideQhull)
-				[i] = 0;
-			}
-		}
-		// }
-		//			 int triR=nrows(triPoint);
-		//			 int  triCol =ncols(triPoint);
-		//			 //loop over the trigulation point to determin if the points lies inside or not
-		//			 for(i=0; i < triR; i++)
-		//				for(j=0; j < triCol; j++)
-		//				{
-		//					//calulate the area of this triangle
-		//
-		//					value =REAL(triPoint)[i+triR*j];
-		//					REAL(point0)[i+triR*j] = REAL(p)[value];
-		//				}
+	meshCellsFromMatrices(points, simplices, convex, mesh);
+	if (mesh->ncells > 0)
+	{
+		neighbours = (int *)R_alloc(mesh->ncells * mesh->nv, sizeof(int));
+		meshNeighbours(mesh, neighbours);
+		mesh->neighbours = neighbours;
+	}
+}
 
-		// }else
-		//		 {
-		//			 INTEGER(insideQhull)[i] = -1; //point is outside convexhull, assign -1
-		//		 }
+/* Index of the simplex of a triangulation or alpha complex that contains
+   each test point, or 0. points is the n-by-d matrix of input points
+   and simplices the s-by-(d+1) matrix of 1-based point indices, as
+   returned by delaunay() and alpha_complex(). Unless convex is TRUE the
+   mesh need not cover the convex hull of its points, so points the walk
+   cannot place are searched for exhaustively; see meshLocateAll(). If
+   keep is not NULL, a logical vector over the simplices, only the kept
+   simplices are found, numbered among themselves, so that an alpha
+   complex is searched through the whole triangulation. */
+SEXP C_findSimplex(const SEXP points, const SEXP simplices, const SEXP testPoints,
+				   const SEXP convex, const SEXP keep)
+{
+	meshT mesh;
+	R_xlen_t c, i, *number = NULL;
+	char *keepCells = NULL;
+	int *found;
+	SEXP result;
+
+	if (!isMatrix(testPoints) || !isReal(testPoints))
+		error("simplices and test_points must be matrices.");
+	meshFromMatrices(points, simplices, asLogical(convex) == TRUE, &mesh);
+	if (ncols(testPoints) != mesh.dim)
+		error("test_points must have the same dimensions as simplices");
+	if (!isNull(keep))
+	{
+		if (!isLogical(keep) || XLENGTH(keep) != mesh.ncells)
+			error("keep must be a logical vector over the simplices");
+		keepCells = (char *)R_alloc(mesh.ncells + 1, sizeof(char));
+		number = (R_xlen_t *)R_alloc(mesh.ncells + 1, sizeof(R_xlen_t));
+		for (c = 0, i = 0; c < mesh.ncells; c++)
+		{
+			keepCells[c] = (LOGICAL(keep)[c] == TRUE);
+			number[c] = keepCells[c] ? ++i : 0;
+		}
 	}
 
+	PROTECT(result = allocVector(INTSXP, nrows(testPoints)));
+	found = INTEGER(result);
+	meshLocateAll(&mesh, REAL(testPoints), nrows(testPoints), keepCells, found);
+	for (i = 0; number && i < nrows(testPoints); i++)
+		if (found[i])
+			found[i] = (int)number[found[i] - 1];
 	UNPROTECT(1);
-
-	return insideQhull;
+	return result;
 }
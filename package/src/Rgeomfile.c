@@ -0,0 +1,542 @@
+/* Copyright (C) 2018
+
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+*/
+#include "RcompGeomete.h"
+#include <stdint.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* Binary file format for triangulations and hulls.
+
+   A 128 byte header is followed by five sections, each starting on an
+   8 byte boundary at the offset recorded in the header. All values are
+   in native byte order, which the header records so that a file from
+   a machine of the other order is rejected rather than misread.
+
+     points      npoints x dim doubles, row-major
+     cells       ncells x nv 32-bit ints, 0-based point ids
+     neighbours  ncells x nv 32-bit ints, the 1-based cell across the
+                 face opposite each vertex, or 0
+     centres     ncells x dim doubles: circumcentres of simplices, or
+                 the outward unit normals of hull facets
+     radii       ncells doubles: circumradii of simplices, or the
+                 offsets of hull facets (normal . x + offset <= 0 inside)
+
+   Files are read by memory mapping, so opening one costs no more than
+   reading its header and checking its point ids, and queries touch
+   only the pages they need. */
+
+#define GEOM_MAGIC "CGEOMBIN"
+#define GEOM_VERSION 1
+#define GEOM_BYTEORDER 0x01020304
+#define GEOM_TRIANGULATION 1
+#define GEOM_HULL 2
+#define GEOM_CONVEX 1 /* flags: cells cover the convex hull of the points */
+
+typedef struct
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteorder;
+	uint32_t kind;
+	uint32_t dim;
+	uint32_t nv;
+	uint32_t flags;
+	uint64_t npoints;
+	uint64_t ncells;
+	uint64_t offset[5];
+	uint64_t reserved[5];
+} geomHeaderT;
+
+typedef struct
+{
+	mappedFileT map;
+	const geomHeaderT *header;
+	meshT mesh;
+	const double *centres;
+	const double *radii;
+} mappedGeomT;
+
+static uint64_t align8(uint64_t offset)
+{
+	return ((offset + 7) & ~(uint64_t)7);
+}
+
+typedef struct
+{
+	FILE *out;
+	const char *path;
+	uint64_t at; /* bytes written so far */
+} geomWriterT;
+
+/* Close and remove a partly written file, so that no truncated file is
+   left to be loaded later */
+static void failWrite(geomWriterT *writer)
+{
+	fclose(writer->out);
+	remove(writer->path);
+	error("Unable to write geometry file");
+}
+
+static void writeOrFail(geomWriterT *writer, const void *data, size_t size, size_t n)
+{
+	if (n && fwrite(data, size, n, writer->out) != n)
+		failWrite(writer);
+	writer->at += (uint64_t)size * n;
+}
+
+static void padTo(geomWriterT *writer, uint64_t offset)
+{
+	static const char zeros[8] = {0};
+	if (writer->at < offset)
+		writeOrFail(writer, zeros, 1, offset - writer->at);
+}
+
+/* Write points, cells and optional circumcentres (all as held by R,
+   column-major with 1-based cells) to file. kind is "triangulation" or
+   "hull"; convex is TRUE when the cells form a full Delaunay
+   triangulation. Circumcentres, circumradii, hyperplanes and
+   neighbours not supplied are computed while the file is written. */
+SEXP C_saveGeometry(const SEXP points, const SEXP cells, const SEXP centres,
+					const SEXP kind, const SEXP convex, const SEXP file)
+{
+	geomHeaderT header;
+	meshT mesh;
+	geomWriterT writer;
+	R_xlen_t i, c, n, nc;
+	int j, k, dim, nv, *cellArray, *neighbours;
+	double *pointArray, *row;
+	boolT hull;
+
+	if (!isMatrix(points) || !isReal(points))
+		error("points should be a real matrix.");
+	if (!isMatrix(cells) || !isInteger(cells))
+		error("cells should be an integer matrix.");
+	hull = !strcmp(CHAR(STRING_ELT(kind, 0)), "hull");
+	n = nrows(points);
+	dim = ncols(points);
+	nc = nrows(cells);
+	nv = ncols(cells);
+	if (dim < 1 || dim > MESH_DIMmax)
+		error("Only 1 to %d dimensions are supported.", MESH_DIMmax);
+	if (nv != (hull ? dim : dim + 1))
+		error("cells should have %d columns.", hull ? dim : dim + 1);
+	if (!isNull(centres) && (nrows(centres) != nc || ncols(centres) != dim))
+		error("circumcentres should be a %ld by %d matrix.", (long)nc, dim);
+
+	/* Row-major copies used both for writing and for computing
+	   neighbours, centres and hyperplanes */
+	pointArray = (double *)R_alloc(n * dim, sizeof(double));
+	for (i = 0; i < n; i++)
+		for (j = 0; j < dim; j++)
+			pointArray[i * dim + j] = REAL(points)[i + n * j];
+	cellArray = (int *)R_alloc(nc * nv, sizeof(int));
+	for (c = 0; c < nc; c++)
+		for (k = 0; k < nv; k++)
+		{
+			int id = INTEGER(cells)[c + nc * k];
+			if (id == NA_INTEGER || id < 1 || id > n)
+				error("Simplex %ld refers to a point that does not exist.", (long)c + 1);
+			cellArray[c * nv + k] = id - 1;
+		}
+	mesh.dim = dim;
+	mesh.nv = nv;
+	mesh.npoints = n;
+	mesh.ncells = nc;
+	mesh.points = pointArray;
+	mesh.cells = cellArray;
+	mesh.neighbours = NULL;
+	mesh.convex = asLogical(convex) == TRUE;
+	neighbours = (int *)R_alloc(nc * nv, sizeof(int));
+	meshNeighbours(&mesh, neighbours);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, GEOM_MAGIC, 8);
+	header.version = GEOM_VERSION;
+	header.byteorder = GEOM_BYTEORDER;
+	header.kind = hull ? GEOM_HULL : GEOM_TRIANGULATION;
+	header.dim = dim;
+	header.nv = nv;
+	header.flags = mesh.convex ? GEOM_CONVEX : 0;
+	header.npoints = n;
+	header.ncells = nc;
+	header.offset[0] = align8(sizeof(geomHeaderT));
+	header.offset[1] = align8(header.offset[0] + (uint64_t)n * dim * sizeof(double));
+	header.offset[2] = align8(header.offset[1] + (uint64_t)nc * nv * sizeof(int32_t));
+	header.offset[3] = align8(header.offset[2] + (uint64_t)nc * nv * sizeof(int32_t));
+	header.offset[4] = align8(header.offset[3] + (uint64_t)nc * dim * sizeof(double));
+
+	/* Allocate before the file is opened, as R_alloc may not return */
+	double *radii = (double *)R_alloc(nc > 0 ? nc : 1, sizeof(double));
+	double inside[MESH_DIMmax] = {0};
+	row = (double *)R_alloc(dim, sizeof(double));
+
+	writer.at = 0;
+	writer.path = R_ExpandFileName(CHAR(STRING_ELT(file, 0)));
+	writer.out = fopen(writer.path, "wb");
+	if (!writer.out)
+		error("Unable to open '%s' for writing.", CHAR(STRING_ELT(file, 0)));
+	writeOrFail(&writer, &header, sizeof(header), 1);
+	padTo(&writer, header.offset[0]);
+	writeOrFail(&writer, pointArray, sizeof(double), n * dim);
+	padTo(&writer, header.offset[1]);
+	writeOrFail(&writer, cellArray, sizeof(int32_t), nc * nv);
+	padTo(&writer, header.offset[2]);
+	writeOrFail(&writer, neighbours, sizeof(int32_t), nc * nv);
+	padTo(&writer, header.offset[3]);
+
+	/* Centres and radii are computed cell by cell as they are written */
+	if (hull)
+	{
+		/* Any point inside the hull orients the facets; use the
+		   centroid of the hull vertices */
+		R_xlen_t used = 0;
+		for (c = 0; c < nc; c++)
+			for (k = 0; k < nv; k++, used++)
+				for (j = 0; j < dim; j++)
+					inside[j] += pointArray[cellArray[c * nv + k] * dim + j];
+		for (j = 0; used && j < dim; j++)
+			inside[j] /= used;
+	}
+	for (c = 0; c < nc; c++)
+	{
+		const double *v[MESH_DIMmax + 1];
+		for (k = 0; k < nv; k++)
+			v[k] = pointArray + (R_xlen_t)cellArray[c * nv + k] * dim;
+		if (hull)
+		{
+			if (!simplexHyperplane(v, dim, inside, row, radii + c))
+			{
+				for (j = 0; j < dim; j++)
+					row[j] = 0;
+				radii[c] = 0;
+			}
+		}
+		else if (!isNull(centres))
+		{
+			radii[c] = 0;
+			for (j = 0; j < dim; j++)
+			{
+				row[j] = REAL(centres)[c + nc * j];
+				radii[c] += (row[j] - v[0][j]) * (row[j] - v[0][j]);
+			}
+			radii[c] = sqrt(radii[c]);
+		}
+		else if (!simplexCircumcentre(v, dim, row, radii + c))
+		{
+			for (j = 0; j < dim; j++)
+				row[j] = R_PosInf;
+			radii[c] = R_PosInf;
+		}
+		writeOrFail(&writer, row, sizeof(double), dim);
+	}
+	padTo(&writer, header.offset[4]);
+	writeOrFail(&writer, radii, sizeof(double), nc);
+	if (fflush(writer.out))
+		failWrite(&writer);
+	if (fclose(writer.out))
+	{
+		remove(writer.path);
+		error("Unable to write geometry file");
+	}
+
+	return R_NilValue;
+}
+
+/* Unmap a file mapped by mapFile() */
+void unmapFile(mappedFileT *map)
+{
+#ifdef _WIN32
+	if (map->base)
+		UnmapViewOfFile(map->base);
+	if (map->mapping)
+		CloseHandle(map->mapping);
+	if (map->file && map->file != INVALID_HANDLE_VALUE)
+		CloseHandle(map->file);
+#else
+	if (map->base)
+		munmap(map->base, map->size);
+#endif
+	map->base = NULL;
+}
+
+/* Map the whole file read-only, returning 0 on failure or if it is
+   shorter than minsize bytes; unmapFile() must be called either way */
+int mapFile(mappedFileT *map, const char *path, size_t minsize)
+{
+#ifdef _WIN32
+	LARGE_INTEGER size;
+	map->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+							OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (map->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(map->file, &size))
+		return (0);
+	map->size = (size_t)size.QuadPart;
+	if (map->size < minsize || map->size == 0)
+		return (0);
+	map->mapping = CreateFileMappingA(map->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!map->mapping)
+		return (0);
+	map->base = MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0);
+	return (map->base != NULL);
+#else
+	struct stat info;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return (0);
+	if (fstat(fd, &info) || (size_t)info.st_size < minsize || info.st_size == 0)
+	{
+		close(fd);
+		return (0);
+	}
+	map->size = (size_t)info.st_size;
+	map->base = mmap(NULL, map->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map->base == MAP_FAILED)
+	{
+		map->base = NULL;
+		return (0);
+	}
+	return (1);
+#endif
+}
+
+static void unmapGeometry(mappedGeomT *geom)
+{
+	unmapFile(&geom->map);
+	free(geom);
+}
+
+static void geometryFinalizer(SEXP ptr)
+{
+	mappedGeomT *geom = R_ExternalPtrAddr(ptr);
+	if (!geom)
+		return;
+	unmapGeometry(geom);
+	R_ClearExternalPtr(ptr);
+}
+
+SEXP C_loadGeometry(const SEXP file)
+{
+	const char *path = R_ExpandFileName(CHAR(STRING_ELT(file, 0)));
+	const geomHeaderT *header;
+	mappedGeomT *geom;
+	uint64_t sizes[5];
+	SEXP ptr, result, names;
+	int s;
+
+	geom = (mappedGeomT *)calloc(1, sizeof(mappedGeomT));
+	if (!geom)
+		error("Unable to allocate memory");
+	if (!mapFile(&geom->map, path, sizeof(geomHeaderT)))
+	{
+		unmapGeometry(geom);
+		error("Unable to map '%s'.", CHAR(STRING_ELT(file, 0)));
+	}
+	header = (const geomHeaderT *)geom->map.base;
+	if (memcmp(header->magic, GEOM_MAGIC, 8) || header->version != GEOM_VERSION ||
+		header->byteorder != GEOM_BYTEORDER || header->dim < 1 || header->dim > MESH_DIMmax ||
+		(header->kind != GEOM_TRIANGULATION && header->kind != GEOM_HULL) ||
+		header->nv != (header->kind == GEOM_HULL ? header->dim : header->dim + 1))
+	{
+		unmapGeometry(geom);
+		error("'%s' is not a geometry file written by this version of compGeometeR.",
+			  CHAR(STRING_ELT(file, 0)));
+	}
+	/* Each count is bounded by the file size before it is multiplied, so
+	   that a corrupt header cannot wrap the section sizes around */
+	if (header->npoints > geom->map.size / (header->dim * sizeof(double)) ||
+		header->ncells > geom->map.size / (header->nv * sizeof(int32_t)) ||
+		header->ncells > geom->map.size / (header->dim * sizeof(double)))
+	{
+		unmapGeometry(geom);
+		error("'%s' is truncated or corrupt.", CHAR(STRING_ELT(file, 0)));
+	}
+	sizes[0] = header->npoints * header->dim * sizeof(double);
+	sizes[1] = sizes[2] = header->ncells * header->nv * sizeof(int32_t);
+	sizes[3] = header->ncells * header->dim * sizeof(double);
+	sizes[4] = header->ncells * sizeof(double);
+	for (s = 0; s < 5; s++)
+		if (header->offset[s] % 8 || header->offset[s] > geom->map.size ||
+			sizes[s] > geom->map.size - header->offset[s])
+		{
+			unmapGeometry(geom);
+			error("'%s' is truncated or corrupt.", CHAR(STRING_ELT(file, 0)));
+		}
+
+	geom->header = header;
+	/* Point ids are used as array offsets, so check them once here */
+	const int32_t *cells = (const int32_t *)((const char *)geom->map.base + header->offset[1]);
+	for (uint64_t id = 0; id < header->ncells * header->nv; id++)
+		if (cells[id] < 0 || (uint64_t)cells[id] >= header->npoints)
+		{
+			unmapGeometry(geom);
+			error("'%s' is truncated or corrupt.", CHAR(STRING_ELT(file, 0)));
+		}
+	geom->mesh.dim = header->dim;
+	geom->mesh.nv = header->nv;
+	geom->mesh.npoints = header->npoints;
+	geom->mesh.ncells = header->ncells;
+	geom->mesh.points = (const double *)((const char *)geom->map.base + header->offset[0]);
+	geom->mesh.cells = (const int *)((const char *)geom->map.base + header->offset[1]);
+	geom->mesh.neighbours = (const int *)((const char *)geom->map.base + header->offset[2]);
+	geom->mesh.convex = (header->flags & GEOM_CONVEX) != 0;
+	geom->centres = (const double *)((const char *)geom->map.base + header->offset[3]);
+	geom->radii = (const double *)((const char *)geom->map.base + header->offset[4]);
+
+	PROTECT(ptr = R_MakeExternalPtr(geom, install("mapped_geometry"), file));
+	R_RegisterCFinalizerEx(ptr, geometryFinalizer, TRUE);
+
+	PROTECT(result = allocVector(VECSXP, 5));
+	PROTECT(names = allocVector(STRSXP, 5));
+	SET_VECTOR_ELT(result, 0, ptr);
+	SET_STRING_ELT(names, 0, mkChar("pointer"));
+	SET_VECTOR_ELT(result, 1, mkString(header->kind == GEOM_HULL ? "hull" : "triangulation"));
+	SET_STRING_ELT(names, 1, mkChar("kind"));
+	SET_VECTOR_ELT(result, 2, ScalarInteger(header->dim));
+	SET_STRING_ELT(names, 2, mkChar("dim"));
+	SET_VECTOR_ELT(result, 3, ScalarReal((double)header->npoints));
+	SET_STRING_ELT(names, 3, mkChar("n_points"));
+	SET_VECTOR_ELT(result, 4, ScalarReal((double)header->ncells));
+	SET_STRING_ELT(names, 4, mkChar("n_cells"));
+	setAttrib(result, R_NamesSymbol, names);
+	UNPROTECT(3);
+	return result;
+}
+
+static mappedGeomT *mappedGeometry(SEXP ptr)
+{
+	mappedGeomT *geom;
+	if (TYPEOF(ptr) != EXTPTRSXP || !(geom = R_ExternalPtrAddr(ptr)))
+		error("The geometry file is no longer mapped; reload it with load_geometry().");
+	return geom;
+}
+
+/* Index of the simplex containing each test point, or 0. If alpha is
+   not NULL only the simplices of the alpha complex are found, numbered
+   as by C_mappedAlphaComplex(), so that a raster is labelled from the
+   stored triangulation without copying it. */
+SEXP C_mappedFindSimplex(const SEXP ptr, const SEXP testPoints, const SEXP alpha)
+{
+	mappedGeomT *geom = mappedGeometry(ptr);
+	const meshT *mesh = &geom->mesh;
+	double alphaValue;
+	R_xlen_t c, i, *number = NULL;
+	int dim = mesh->dim, *found;
+	char *keep = NULL;
+	SEXP result;
+
+	if (geom->header->kind != GEOM_TRIANGULATION)
+		error("The geometry file does not hold a triangulation.");
+	if (ncols(testPoints) != dim)
+		error("test_points must have the same dimensions as the triangulation");
+	if (!isNull(alpha))
+	{
+		alphaValue = asReal(alpha);
+		keep = (char *)R_alloc(mesh->ncells + 1, sizeof(char));
+		number = (R_xlen_t *)R_alloc(mesh->ncells + 1, sizeof(R_xlen_t));
+		for (c = 0, i = 0; c < mesh->ncells; c++)
+		{
+			keep[c] = (geom->radii[c] <= alphaValue);
+			number[c] = keep[c] ? ++i : 0;
+		}
+	}
+	PROTECT(result = allocVector(INTSXP, nrows(testPoints)));
+	found = INTEGER(result);
+	meshLocateAll(mesh, REAL(testPoints), nrows(testPoints), keep, found);
+	for (i = 0; number && i < nrows(testPoints); i++)
+		if (found[i])
+			found[i] = (int)number[found[i] - 1];
+	UNPROTECT(1);
+	return result;
+}
+
+/* The simplices with circumradius no greater than alpha, in the form
+   returned by alpha_complex() */
+SEXP C_mappedAlphaComplex(const SEXP ptr, const SEXP alpha)
+{
+	mappedGeomT *geom = mappedGeometry(ptr);
+	const meshT *mesh = &geom->mesh;
+	double alphaValue = asReal(alpha);
+	R_xlen_t c, i, n = mesh->npoints, ns = 0, s;
+	int j, k, dim = mesh->dim, nv = mesh->nv;
+	SEXP result, names, points, simplices, centres, radii;
+
+	if (geom->header->kind != GEOM_TRIANGULATION)
+		error("The geometry file does not hold a triangulation.");
+	for (c = 0; c < mesh->ncells; c++)
+		if (geom->radii[c] <= alphaValue)
+			ns++;
+
+	PROTECT(points = allocMatrix(REALSXP, n, dim));
+	for (i = 0; i < n; i++)
+		for (j = 0; j < dim; j++)
+			REAL(points)[i + n * j] = mesh->points[i * dim + j];
+	PROTECT(simplices = allocMatrix(INTSXP, ns, nv));
+	PROTECT(centres = allocMatrix(REALSXP, ns, dim));
+	PROTECT(radii = allocVector(REALSXP, ns));
+	for (c = 0, s = 0; c < mesh->ncells; c++)
+	{
+		if (!(geom->radii[c] <= alphaValue))
+			continue;
+		for (k = 0; k < nv; k++)
+			INTEGER(simplices)[s + ns * k] = mesh->cells[c * nv + k] + 1;
+		for (j = 0; j < dim; j++)
+			REAL(centres)[s + ns * j] = geom->centres[c * dim + j];
+		REAL(radii)[s] = geom->radii[c];
+		s++;
+	}
+
+	PROTECT(result = allocVector(VECSXP, 4));
+	PROTECT(names = allocVector(STRSXP, 4));
+	SET_VECTOR_ELT(result, 0, points);
+	SET_STRING_ELT(names, 0, mkChar("input_points"));
+	SET_VECTOR_ELT(result, 1, simplices);
+	SET_STRING_ELT(names, 1, mkChar("simplices"));
+	SET_VECTOR_ELT(result, 2, centres);
+	SET_STRING_ELT(names, 2, mkChar("circumcentres"));
+	SET_VECTOR_ELT(result, 3, radii);
+	SET_STRING_ELT(names, 3, mkChar("circumradii"));
+	setAttrib(result, R_NamesSymbol, names);
+	setAttrib(result, install("covers_hull"), ScalarLogical(mesh->convex && ns == mesh->ncells));
+	UNPROTECT(6);
+	return result;
+}
+
+/* Whether each test point lies inside the hull, from the stored facet
+   hyperplanes */
+SEXP C_mappedInHull(const SEXP ptr, const SEXP testPoints)
+{
+	mappedGeomT *geom = mappedGeometry(ptr);
+	const meshT *mesh = &geom->mesh;
+	SEXP inside;
+
+	if (geom->header->kind != GEOM_HULL)
+		error("The geometry file does not hold a convex hull.");
+	if (ncols(testPoints) != mesh->dim)
+		error("test_points must have the same dimensions as hull");
+	PROTECT(inside = allocVector(LGLSXP, nrows(testPoints)));
+	hullContainsAll(geom->centres, geom->radii, mesh->ncells, mesh->dim, MESH_EPSILON,
+					REAL(testPoints), nrows(testPoints), LOGICAL(inside));
+	UNPROTECT(1);
+	return inside;
+}
@@ -0,0 +1,551 @@
+/* Copyright (C) 2018
+
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+*/
+#include "RcompGeomete.h"
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Graphs on a triangulation: the points joined by the edges of its
+   simplices, in the compressed sparse row form of meshEdges(), and the
+   simplices joined by their shared faces or points. */
+
+typedef struct
+{
+	const meshT *mesh;
+	const R_xlen_t *offsets;
+	const int *adjacent;
+	double *lengths;
+} edgeLengthT;
+
+static void edgeLengthChunk(void *ctx, R_xlen_t begin, R_xlen_t end)
+{
+	const edgeLengthT *task = (const edgeLengthT *)ctx;
+	const double *p, *q;
+	double d2, diff;
+	R_xlen_t i, e;
+	int j, dim = task->mesh->dim;
+
+	for (i = begin; i < end; i++)
+	{
+		p = task->mesh->points + i * dim;
+		for (e = task->offsets[i]; e < task->offsets[i + 1]; e++)
+		{
+			q = task->mesh->points + (R_xlen_t)task->adjacent[e] * dim;
+			d2 = 0;
+			for (j = 0; j < dim; j++)
+			{
+				diff = p[j] - q[j];
+				d2 += diff * diff;
+			}
+			task->lengths[e] = sqrt(d2);
+		}
+	}
+}
+
+/* The edges of the simplices, an s-by-(d+1) matrix of 1-based indices
+   of the n-by-d matrix of points, as the 0-based offsets of the edges of
+   each point, the 1-based points they join it to, in increasing order,
+   and their lengths if lengths is TRUE. Each edge is listed at both its
+   ends. */
+SEXP C_delaunayEdges(const SEXP points, const SEXP simplices, const SEXP lengths)
+{
+	meshT mesh;
+	R_xlen_t *offsets, i;
+	int *adjacent;
+	edgeLengthT task;
+	SEXP result, names, rOffsets, rAdjacent, rLengths = R_NilValue;
+
+	meshCellsFromMatrices(points, simplices, False, &mesh);
+	offsets = (R_xlen_t *)R_alloc(mesh.npoints + 1, sizeof(R_xlen_t));
+	if (!meshEdges(&mesh, offsets, &adjacent))
+		error("Unable to allocate memory for the edges of the triangulation");
+	if (offsets[mesh.npoints] > INT_MAX)
+	{
+		free(adjacent);
+		error("The triangulation has too many edges to return");
+	}
+
+	PROTECT(rOffsets = allocVector(INTSXP, mesh.npoints + 1));
+	PROTECT(rAdjacent = allocVector(INTSXP, offsets[mesh.npoints]));
+	for (i = 0; i <= mesh.npoints; i++)
+		INTEGER(rOffsets)[i] = (int)offsets[i];
+	for (i = 0; i < offsets[mesh.npoints]; i++)
+		INTEGER(rAdjacent)[i] = adjacent[i] + 1;
+	if (asLogical(lengths) == TRUE)
+	{
+		rLengths = allocVector(REALSXP, offsets[mesh.npoints]);
+		task.mesh = &mesh;
+		task.offsets = offsets;
+		task.adjacent = adjacent;
+		task.lengths = REAL(rLengths);
+		parallelFor(mesh.npoints, 256, edgeLengthChunk, &task);
+	}
+	PROTECT(rLengths);
+	free(adjacent);
+
+	PROTECT(result = allocVector(VECSXP, 3));
+	PROTECT(names = allocVector(STRSXP, 3));
+	SET_VECTOR_ELT(result, 0, rOffsets);
+	SET_STRING_ELT(names, 0, mkChar("offsets"));
+	SET_VECTOR_ELT(result, 1, rAdjacent);
+	SET_STRING_ELT(names, 1, mkChar("neighbours"));
+	SET_VECTOR_ELT(result, 2, rLengths);
+	SET_STRING_ELT(names, 2, mkChar("lengths"));
+	setAttrib(result, R_NamesSymbol, names);
+	UNPROTECT(5);
+	return (result);
+}
+
+typedef struct
+{
+	const meshT *mesh;
+	const R_xlen_t *offsets;
+	const int *adjacent;
+	unsigned char *keep;
+} edgeFilterT;
+
+typedef struct
+{
+	double length;
+	int from, to;
+} edgeT;
+
+static double edgeLength(const meshT *mesh, int a, int b)
+{
+	const double *p = mesh->points + (R_xlen_t)a * mesh->dim, *q = mesh->points + (R_xlen_t)b * mesh->dim;
+	double d2 = 0, diff;
+	int j;
+	for (j = 0; j < mesh->dim; j++)
+	{
+		diff = p[j] - q[j];
+		d2 += diff * diff;
+	}
+	return (sqrt(d2));
+}
+
+/* Keep the edges (i, j), i < j, of the relative neighbourhood graph:
+   drop an edge if a common neighbour r of its points is nearer to both
+   than they are to each other, as it is then the longest edge of the
+   triangle i, j, r and in no minimum spanning tree */
+static void edgeFilterChunk(void *ctx, R_xlen_t begin, R_xlen_t end)
+{
+	const edgeFilterT *task = (const edgeFilterT *)ctx;
+	const R_xlen_t *offsets = task->offsets;
+	const int *adjacent = task->adjacent;
+	R_xlen_t i, e, a, b;
+	double length;
+	int j;
+
+	for (i = begin; i < end; i++)
+		for (e = offsets[i]; e < offsets[i + 1]; e++)
+		{
+			j = adjacent[e];
+			task->keep[e] = (j > i);
+			if (j < i)
+				continue;
+			length = edgeLength(task->mesh, (int)i, j);
+			a = offsets[i];
+			b = offsets[j];
+			while (a < offsets[i + 1] && b < offsets[j + 1] && task->keep[e])
+			{
+				if (adjacent[a] < adjacent[b])
+					a++;
+				else if (adjacent[a] > adjacent[b])
+					b++;
+				else
+				{
+					if (edgeLength(task->mesh, (int)i, adjacent[a]) < length &&
+						edgeLength(task->mesh, j, adjacent[a]) < length)
+						task->keep[e] = 0;
+					a++;
+					b++;
+				}
+			}
+		}
+}
+
+/* Shortest edges first, and edges of equal length in order of their
+   points, so that the tree does not depend on the order of the edges */
+static int compareEdges(const void *a, const void *b)
+{
+	const edgeT *x = (const edgeT *)a, *y = (const edgeT *)b;
+	if (x->length != y->length)
+		return ((x->length > y->length) - (x->length < y->length));
+	if (x->from != y->from)
+		return ((x->from > y->from) - (x->from < y->from));
+	return ((x->to > y->to) - (x->to < y->to));
+}
+
+/* The root of the set of point i, halving the path to it */
+static int findSet(int *parent, int i)
+{
+	while (parent[i] != i)
+	{
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return (i);
+}
+
+/* Join the sets with roots ra and rb, the smaller below the larger,
+   recording it in merge as the number-th merge of clusters (see
+   C_minimumSpanningTree()): points, which are negative, before merges,
+   and each in increasing order */
+static void mergeSets(int *parent, int *size, int *cluster, int ra, int rb, int *merge, int number)
+{
+	int a = cluster[ra], b = cluster[rb], swap;
+
+	if ((a < 0 && b < 0) ? a < b : a > b)
+	{
+		swap = a;
+		a = b;
+		b = swap;
+	}
+	merge[0] = a;
+	merge[1] = b;
+	if (size[ra] < size[rb])
+	{
+		swap = ra;
+		ra = rb;
+		rb = swap;
+	}
+	parent[rb] = ra;
+	size[ra] += size[rb];
+	cluster[ra] = number;
+}
+
+/* The Euclidean minimum spanning tree of the points of the simplices, an
+   s-by-(d+1) matrix of 1-based indices of the n-by-d matrix of points,
+   by Kruskal's algorithm over the edges of the simplices: the shortest
+   edges are taken first, and union-find skips those that would close a
+   cycle. first gives the 1-based index of the first copy of each point
+   (see C_duplicatePoints()), and copies, which qhull leaves out of the
+   simplices, are joined to it by edges of length 0. The tree is also
+   returned as the merges of single-linkage clustering, in the form of
+   hclust(): merges[k] joins clusters that are points if negative and
+   earlier merges if positive, at heights[k], and order lists the
+   points as a dendrogram draws them. Points that the edges do not join,
+   as in an alpha complex, are merged last at an infinite height. */
+SEXP C_minimumSpanningTree(const SEXP points, const SEXP simplices, const SEXP first)
+{
+	meshT mesh;
+	R_xlen_t *offsets, i, e, nedges = 0;
+	int *adjacent, *parent, *size, *cluster, *stack, *merges, *tree, *order;
+	int n, a, ra, rb, nmerges = 0, ntree = 0, top, placed = 0;
+	unsigned char *keep;
+	edgeT *edges;
+	edgeFilterT task;
+	double *heights, *lengths;
+	SEXP result, names, rTree, rLengths, rMerges, rHeights, rOrder;
+
+	meshCellsFromMatrices(points, simplices, False, &mesh);
+	if (mesh.npoints >= INT_MAX)
+		error("too many points");
+	n = (int)mesh.npoints;
+	if (!isInteger(first) || XLENGTH(first) != n)
+		error("first must give the first copy of every point");
+	offsets = (R_xlen_t *)R_alloc(n + 1, sizeof(R_xlen_t));
+	parent = (int *)R_alloc(n ? n : 1, sizeof(int));
+	size = (int *)R_alloc(n ? n : 1, sizeof(int));
+	cluster = (int *)R_alloc(n ? n : 1, sizeof(int));
+	tree = (int *)R_alloc(n ? 2 * n : 1, sizeof(int));
+	lengths = (double *)R_alloc(n ? n : 1, sizeof(double));
+	merges = (int *)R_alloc(n ? 2 * n : 1, sizeof(int));
+	heights = (double *)R_alloc(n ? n : 1, sizeof(double));
+	if (!meshEdges(&mesh, offsets, &adjacent))
+		error("Unable to allocate memory for the edges of the triangulation");
+	keep = (unsigned char *)malloc(offsets[n] ? offsets[n] : 1);
+	if (!keep)
+	{
+		free(adjacent);
+		error("Unable to allocate memory for the edges of the triangulation");
+	}
+	task.mesh = &mesh;
+	task.offsets = offsets;
+	task.adjacent = adjacent;
+	task.keep = keep;
+	parallelFor(n, 256, edgeFilterChunk, &task);
+
+	/* The edges that may be in the tree, with the copies of points */
+	for (e = 0; e < offsets[n]; e++)
+		nedges += keep[e];
+	for (i = 0; i < n; i++)
+		nedges += (INTEGER(first)[i] != i + 1);
+	edges = (edgeT *)malloc((nedges ? nedges : 1) * sizeof(edgeT));
+	if (!edges)
+	{
+		free(adjacent);
+		free(keep);
+		error("Unable to allocate memory for the edges of the triangulation");
+	}
+	nedges = 0;
+	for (i = 0; i < n; i++)
+	{
+		for (e = offsets[i]; e < offsets[i + 1]; e++)
+			if (keep[e])
+			{
+				edges[nedges].from = (int)i;
+				edges[nedges].to = adjacent[e];
+				edges[nedges++].length = edgeLength(&mesh, (int)i, adjacent[e]);
+			}
+		a = INTEGER(first)[i] - 1;
+		if (a != i && a >= 0 && a < n)
+		{
+			edges[nedges].from = a;
+			edges[nedges].to = (int)i;
+			edges[nedges++].length = 0;
+		}
+	}
+	free(adjacent);
+	free(keep);
+	qsort(edges, nedges, sizeof(edgeT), compareEdges);
+
+	for (a = 0; a < n; a++)
+	{
+		parent[a] = a;
+		size[a] = 1;
+		cluster[a] = -(a + 1);
+	}
+	for (e = 0; e < nedges && nmerges < n - 1; e++)
+	{
+		ra = findSet(parent, edges[e].from);
+		rb = findSet(parent, edges[e].to);
+		if (ra == rb)
+			continue;
+		tree[2 * ntree] = edges[e].from + 1;
+		tree[2 * ntree + 1] = edges[e].to + 1;
+		lengths[ntree++] = edges[e].length;
+		mergeSets(parent, size, cluster, ra, rb, merges + 2 * nmerges, nmerges + 1);
+		heights[nmerges++] = edges[e].length;
+	}
+	/* Then join what is left, in order of the first points of the sets,
+	   at an infinite height */
+	for (a = 0, ra = -1; a < n && nmerges < n - 1; a++)
+		if (parent[a] == a)
+		{
+			if (ra >= 0)
+			{
+				rb = a;
+				ra = findSet(parent, ra);
+				mergeSets(parent, size, cluster, ra, rb, merges + 2 * nmerges, nmerges + 1);
+				heights[nmerges++] = R_PosInf;
+			}
+			ra = a;
+		}
+	free(edges);
+
+	/* The points from the last merge down, first branch first */
+	PROTECT(rOrder = allocVector(INTSXP, n));
+	order = INTEGER(rOrder);
+	if (n == 1)
+		order[0] = 1;
+	stack = cluster;
+	top = 0;
+	if (nmerges > 0)
+		stack[top++] = nmerges;
+	while (top > 0)
+	{
+		a = stack[--top];
+		if (a < 0)
+			order[placed++] = -a;
+		else
+		{
+			stack[top++] = merges[2 * (a - 1) + 1];
+			stack[top++] = merges[2 * (a - 1)];
+		}
+	}
+
+	PROTECT(rTree = allocMatrix(INTSXP, ntree, 2));
+	PROTECT(rLengths = allocVector(REALSXP, ntree));
+	for (a = 0; a < ntree; a++)
+	{
+		INTEGER(rTree)[a] = tree[2 * a];
+		INTEGER(rTree)[a + ntree] = tree[2 * a + 1];
+		REAL(rLengths)[a] = lengths[a];
+	}
+	PROTECT(rMerges = allocMatrix(INTSXP, nmerges, 2));
+	PROTECT(rHeights = allocVector(REALSXP, nmerges));
+	for (a = 0; a < nmerges; a++)
+	{
+		INTEGER(rMerges)[a] = merges[2 * a];
+		INTEGER(rMerges)[a + nmerges] = merges[2 * a + 1];
+		REAL(rHeights)[a] = heights[a];
+	}
+
+	PROTECT(result = allocVector(VECSXP, 5));
+	PROTECT(names = allocVector(STRSXP, 5));
+	SET_VECTOR_ELT(result, 0, rTree);
+	SET_STRING_ELT(names, 0, mkChar("edges"));
+	SET_VECTOR_ELT(result, 1, rLengths);
+	SET_STRING_ELT(names, 1, mkChar("lengths"));
+	SET_VECTOR_ELT(result, 2, rMerges);
+	SET_STRING_ELT(names, 2, mkChar("merge"));
+	SET_VECTOR_ELT(result, 3, rHeights);
+	SET_STRING_ELT(names, 3, mkChar("height"));
+	SET_VECTOR_ELT(result, 4, rOrder);
+	SET_STRING_ELT(names, 4, mkChar("order"));
+	setAttrib(result, R_NamesSymbol, names);
+	UNPROTECT(7);
+	return (result);
+}
+
+/* The volume of cell c of the mesh */
+static double cellVolume(const meshT *mesh, R_xlen_t c)
+{
+	double a[MESH_DIMmax * MESH_DIMmax], volume;
+	const double *v0 = mesh->points + (R_xlen_t)mesh->cells[c * mesh->nv] * mesh->dim, *v;
+	int i, j;
+
+	for (i = 1; i <= mesh->dim; i++)
+	{
+		v = mesh->points + (R_xlen_t)mesh->cells[c * mesh->nv + i] * mesh->dim;
+		for (j = 0; j < mesh->dim; j++)
+			a[(i - 1) * mesh->dim + j] = v[j] - v0[j];
+	}
+	volume = fabs(determinant(a, mesh->dim));
+	for (i = 2; i <= mesh->dim; i++)
+		volume /= i;
+	return (volume);
+}
+
+/* The connected components of the simplices of an alpha complex, an
+   s-by-(d+1) matrix of 1-based indices of the n-by-d matrix of points,
+   by union-find: simplices are connected if they share a face or, if
+   byPoints is TRUE, any point. Components are numbered from 1 in order
+   of their first simplex. Each point is given the lowest numbered
+   component of the simplices it is a point of, or 0 if it is in none,
+   and each component its number of simplices and volume. If labels is
+   not NULL, it holds the 1-based simplex, or 0, of each cell of a
+   raster, as from find_simplex(), and is returned as the component of
+   each cell, or 0. */
+SEXP C_alphaComponents(const SEXP points, const SEXP simplices, const SEXP byPoints, const SEXP labels)
+{
+	meshT mesh;
+	R_xlen_t c, i;
+	int *parent, *size, *number, *simplexComponent, *pointComponent, *sizes, *raster;
+	int k, nb, ra, rb, swap, ncomponents = 0, connectPoints = (asLogical(byPoints) == TRUE);
+	double *volumes;
+	SEXP result, names, rSimplices, rPoints, rSizes, rVolumes, rRaster = R_NilValue;
+
+	if (connectPoints)
+		meshCellsFromMatrices(points, simplices, False, &mesh);
+	else
+		meshFromMatrices(points, simplices, False, &mesh);
+	if (mesh.ncells >= INT_MAX || mesh.npoints >= INT_MAX)
+		error("The alpha complex is too large");
+	if (!isNull(labels) && !isInteger(labels))
+		error("labels must be an integer array");
+
+	/* Union-find over the simplices, or over the points */
+	i = connectPoints ? mesh.npoints : mesh.ncells;
+	parent = (int *)R_alloc(i ? i : 1, sizeof(int));
+	size = (int *)R_alloc(i ? i : 1, sizeof(int));
+	number = (int *)R_alloc(i ? i : 1, sizeof(int));
+	while (i-- > 0)
+	{
+		parent[i] = (int)i;
+		size[i] = 1;
+		number[i] = 0;
+	}
+	for (c = 0; c < mesh.ncells; c++)
+		for (k = 0; k < mesh.nv; k++)
+		{
+			if (connectPoints)
+			{
+				if (k == 0)
+					continue;
+				ra = findSet(parent, mesh.cells[c * mesh.nv]);
+				rb = findSet(parent, mesh.cells[c * mesh.nv + k]);
+			}
+			else
+			{
+				nb = mesh.neighbours[c * mesh.nv + k];
+				if (nb <= c)
+					continue;
+				ra = findSet(parent, (int)c);
+				rb = findSet(parent, nb - 1);
+			}
+			if (ra == rb)
+				continue;
+			if (size[ra] < size[rb])
+			{
+				swap = ra;
+				ra = rb;
+				rb = swap;
+			}
+			parent[rb] = ra;
+			size[ra] += size[rb];
+		}
+
+	PROTECT(rSimplices = allocVector(INTSXP, mesh.ncells));
+	PROTECT(rPoints = allocVector(INTSXP, mesh.npoints));
+	simplexComponent = INTEGER(rSimplices);
+	pointComponent = INTEGER(rPoints);
+	for (c = 0; c < mesh.ncells; c++)
+	{
+		ra = findSet(parent, connectPoints ? mesh.cells[c * mesh.nv] : (int)c);
+		if (!number[ra])
+			number[ra] = ++ncomponents;
+		simplexComponent[c] = number[ra];
+	}
+	memset(pointComponent, 0, mesh.npoints * sizeof(int));
+	for (c = 0; c < mesh.ncells; c++)
+		for (k = 0; k < mesh.nv; k++)
+		{
+			i = mesh.cells[c * mesh.nv + k];
+			if (!pointComponent[i] || simplexComponent[c] < pointComponent[i])
+				pointComponent[i] = simplexComponent[c];
+		}
+
+	PROTECT(rSizes = allocVector(INTSXP, ncomponents));
+	PROTECT(rVolumes = allocVector(REALSXP, ncomponents));
+	sizes = INTEGER(rSizes);
+	volumes = REAL(rVolumes);
+	memset(sizes, 0, ncomponents * sizeof(int));
+	memset(volumes, 0, ncomponents * sizeof(double));
+	for (c = 0; c < mesh.ncells; c++)
+	{
+		sizes[simplexComponent[c] - 1]++;
+		volumes[simplexComponent[c] - 1] += cellVolume(&mesh, c);
+	}
+
+	if (!isNull(labels))
+	{
+		rRaster = duplicate(labels);
+		raster = INTEGER(rRaster);
+		for (i = 0; i < XLENGTH(labels); i++)
+			raster[i] = (raster[i] > 0 && raster[i] <= mesh.ncells) ? simplexComponent[raster[i] - 1] : 0;
+	}
+	PROTECT(rRaster);
+
+	PROTECT(result = allocVector(VECSXP, 5));
+	PROTECT(names = allocVector(STRSXP, 5));
+	SET_VECTOR_ELT(result, 0, rSimplices);
+	SET_STRING_ELT(names, 0, mkChar("simplex_components"));
+	SET_VECTOR_ELT(result, 1, rPoints);
+	SET_STRING_ELT(names, 1, mkChar("point_components"));
+	SET_VECTOR_ELT(result, 2, rSizes);
+	SET_STRING_ELT(names, 2, mkChar("sizes"));
+	SET_VECTOR_ELT(result, 3, rVolumes);
+	SET_STRING_ELT(names, 3, mkChar("volumes"));
+	SET_VECTOR_ELT(result, 4, rRaster);
+	SET_STRING_ELT(names, 4, mkChar("raster"));
+	setAttrib(result, R_NamesSymbol, names);
+	UNPROTECT(7);
+	return (result);
+}
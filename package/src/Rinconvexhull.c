@@ -36,35 +36,36 @@ SEXP C_inconvexhull(const SEXP convexhull, const SEXP testPoints)
 
 	  UNPROTECT(2);
 
+	  if (!qh)
+		error("The convex hull is no longer available.");
+	  if (ncols(testPoints) != qh->hull_dim)
+		error("test_points must have the same dimensions as hull");
 
 	  SEXP insideQhull;
-	  insideQhull = R_NilValue;
-
-	  unsigned int dim, n;
-	  dim = ncols(testPoints);
-	  n   = nrows(testPoints);
-
-	  /* use qh_findbestfacet to check if a point set is hull */
-	  PROTECT(insideQhull = allocVector(LGLSXP, n));
-
-	  double *point;
-
-	  point = (double *) R_alloc(dim, sizeof(double));
-	  boolT isoutside;
-	  realT bestdist;
-
-	  int i, j;
-	  for(i=0; i < n; i++) {
-		for(j=0; j < dim; j++)
-		  point[j] = REAL(testPoints)[i+n*j];
-
-		qh_findbestfacet(qh, point, !qh_ALL, &bestdist, &isoutside);
-
-		LOGICAL(insideQhull)[i] = !isoutside;
-
+	  facetT *facet;
+	  double *normals, *offsets;
+	  R_xlen_t f = 0;
+	  int j, dim = qh->hull_dim;
+
+	  /* The facet hyperplanes are copied out of qhull so that the points
+	     can be tested on the threads of the pool. A point is outside
+	     when it lies at least qh.MINoutside beyond some facet, which is
+	     the test qh_findbestfacet() makes. */
+	  normals = (double *)R_alloc(qh->num_facets * dim, sizeof(double));
+	  offsets = (double *)R_alloc(qh->num_facets, sizeof(double));
+	  FORALLfacets
+	  {
+		if (!facet->normal)
+		  continue;
+		for (j = 0; j < dim; j++)
+		  normals[f * dim + j] = facet->normal[j];
+		offsets[f++] = facet->offset;
 	  }
+
+	  PROTECT(insideQhull = allocVector(LGLSXP, nrows(testPoints)));
+	  hullContainsAll(normals, offsets, f, dim, qh->MINoutside,
+					  REAL(testPoints), nrows(testPoints), LOGICAL(insideQhull));
 	  UNPROTECT(1);
 
 	  return insideQhull;
 }
-
@@ -0,0 +1,564 @@
+/* Copyright (C) 2018
+
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+*/
+#include "RcompGeomete.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Interpolation of values observed at the points of a Delaunay
+   triangulation, at test points or over an implicit grid.
+
+   Linear interpolation weights the values at the vertices of the
+   simplex containing a query by its barycentric coordinates. Natural
+   neighbour interpolation (Sibson 1981) weights the value at each point
+   by the volume its Voronoi cell would lose to the query if the query
+   were inserted. The cells in conflict with the query, those whose
+   circumsphere contains it, are found from the simplex containing it
+   through the neighbours, and the volumes are summed over them as in
+   Watson (1992): for a cell T with circumcentre c and each vertex v_k,
+   the simplex from c to the circumcentres g_j of T with x in place of
+   v_j, j != k, is the part of the volume stolen from v_k that lies
+   about c. That sum breaks down where the points are cospherical, as on
+   a lattice, and the volumes are then found exactly, though slowly, as
+   intersections of halfspaces.
+
+   Consecutive queries, along a row of a grid say, are usually close,
+   so the walk that locates each query starts from the simplex of the
+   previous one. */
+
+#define INTERPOLATE_LINEAR 0
+#define INTERPOLATE_NATURAL 1
+#define INTERPOLATE_NUDGE 1e-4 /* relative move off the boundary of the hull */
+#define INTERPOLATE_FLAT 1e-6  /* barycentric coordinate deemed on a face */
+
+typedef struct
+{
+	const meshT *mesh;
+	const double *values;
+	int method;
+	const double *x; /* n x dim, column-major as in R, or NULL for a grid */
+	const double *const *axes; /* the coordinates of the grid along each axis */
+	const R_xlen_t *counts;
+	R_xlen_t n;
+	double *centres, *radii; /* circumspheres of the cells, for natural */
+	double *result;
+	char *outside; /* whether the result of each query is NA */
+} interpolateT;
+
+/* Buffers for the conflict cells of a query and the weights of its
+   natural neighbours, grown as needed */
+typedef struct
+{
+	R_xlen_t *cells;
+	int ncells, sizeCells;
+	int *points;
+	double *weights;
+	int npoints, sizePoints;
+	double *halfspaces; /* for exactWeights() */
+	int sizeHalfspaces;
+	FILE *errfile;
+	boolT failed;
+} conflictT;
+
+static void queryPoint(const interpolateT *task, R_xlen_t i, double *x)
+{
+	R_xlen_t rest = i;
+	int j;
+	for (j = 0; j < task->mesh->dim; j++)
+		if (task->x)
+			x[j] = task->x[i + task->n * j];
+		else
+		{
+			x[j] = task->axes[j][rest % task->counts[j]];
+			rest /= task->counts[j];
+		}
+}
+
+static int addConflict(conflictT *conflict, R_xlen_t c)
+{
+	R_xlen_t *grown;
+	int k;
+	for (k = 0; k < conflict->ncells; k++)
+		if (conflict->cells[k] == c)
+			return (0);
+	if (conflict->ncells == conflict->sizeCells)
+	{
+		conflict->sizeCells = conflict->sizeCells ? 2 * conflict->sizeCells : 64;
+		grown = (R_xlen_t *)realloc(conflict->cells, conflict->sizeCells * sizeof(R_xlen_t));
+		if (!grown)
+		{
+			conflict->failed = True;
+			return (0);
+		}
+		conflict->cells = grown;
+	}
+	conflict->cells[conflict->ncells++] = c;
+	return (1);
+}
+
+static void addWeight(conflictT *conflict, int p, double w)
+{
+	int k, *points;
+	double *weights;
+	for (k = 0; k < conflict->npoints; k++)
+		if (conflict->points[k] == p)
+		{
+			conflict->weights[k] += w;
+			return;
+		}
+	if (conflict->npoints == conflict->sizePoints)
+	{
+		conflict->sizePoints = conflict->sizePoints ? 2 * conflict->sizePoints : 64;
+		points = (int *)realloc(conflict->points, conflict->sizePoints * sizeof(int));
+		if (points)
+			conflict->points = points;
+		weights = points ? (double *)realloc(conflict->weights, conflict->sizePoints * sizeof(double)) : NULL;
+		if (!weights)
+		{
+			conflict->failed = True;
+			return;
+		}
+		conflict->weights = weights;
+	}
+	conflict->points[conflict->npoints] = p;
+	conflict->weights[conflict->npoints++] = w;
+}
+
+/* The values at the vertices of cell c weighted by lambda */
+static double linearValue(const interpolateT *task, R_xlen_t c, const double *lambda)
+{
+	double sum = 0;
+	int k;
+	for (k = 0; k < task->mesh->nv; k++)
+		sum += lambda[k] * task->values[task->mesh->cells[c * task->mesh->nv + k]];
+	return (sum);
+}
+
+/* Whether x lies inside the circumsphere of cell c, or c is flat */
+static int inConflict(const interpolateT *task, R_xlen_t c, const double *x)
+{
+	double d2 = 0, diff;
+	int j, dim = task->mesh->dim;
+	if (task->radii[c] == 0)
+		return (1);
+	for (j = 0; j < dim; j++)
+	{
+		diff = x[j] - task->centres[c * dim + j];
+		d2 += diff * diff;
+	}
+	return (d2 < task->radii[c] * task->radii[c] * (1 + MESH_EPSILON));
+}
+
+/* Gather the cells in conflict with x, which lies in cell c, by a
+   search through the neighbours. Flat cells, which a triangulation of
+   cospherical points such as a lattice may have, are passed through.
+   Returns the number of flat cells met. */
+static int conflictCells(const interpolateT *task, R_xlen_t c, const double *x, conflictT *conflict)
+{
+	const meshT *mesh = task->mesh;
+	R_xlen_t t, cell;
+	int k, next, flat = 0;
+
+	conflict->ncells = conflict->npoints = 0;
+	addConflict(conflict, c);
+	for (t = 0; t < conflict->ncells && !conflict->failed; t++)
+	{
+		cell = conflict->cells[t];
+		flat += (task->radii[cell] == 0);
+		for (k = 0; k < mesh->nv; k++)
+		{
+			next = mesh->neighbours[cell * mesh->nv + k];
+			if (next > 0 && inConflict(task, next - 1, x))
+				addConflict(conflict, next - 1);
+		}
+	}
+	return (flat);
+}
+
+/* The sign of the volume of the simplex v[0..dim], in any dimension */
+static int orientation(const double *const *v, int dim)
+{
+	double a[MESH_DIMmax * MESH_DIMmax], det;
+	int i, j;
+	for (i = 0; i < dim; i++)
+		for (j = 0; j < dim; j++)
+			a[i * dim + j] = v[i + 1][j] - v[0][j];
+	det = determinant(a, dim);
+	return ((det > 0) - (det < 0));
+}
+
+/* The Sibson weights of x into conflict, summed over the cells in
+   conflict as in Watson (1992). Returns 0 if x lies too near the
+   hyperplane of a face of one of them, where a circumcentre with x in
+   place of a vertex is far off or infinite. */
+static int watsonWeights(const interpolateT *task, const double *x, conflictT *conflict)
+{
+	const meshT *mesh = task->mesh;
+	const double *v[MESH_DIMmax + 1], *w[MESH_DIMmax + 1];
+	double g[(MESH_DIMmax + 1) * MESH_DIMmax], a[MESH_DIMmax * MESH_DIMmax], lambda[MESH_DIMmax + 1];
+	double radius, volume;
+	int dim = mesh->dim, nv = mesh->nv, j, k, m, row, sign;
+	R_xlen_t t, cell;
+
+	for (t = 0; t < conflict->ncells && !conflict->failed; t++)
+	{
+		cell = conflict->cells[t];
+		for (k = 0; k < nv; k++)
+			v[k] = mesh->points + (R_xlen_t)mesh->cells[cell * nv + k] * dim;
+		sign = orientation(v, dim);
+		if (!simplexBarycentric(v, dim, x, lambda))
+			return (0);
+		for (k = 0; k < nv; k++)
+		{
+			if (fabs(lambda[k]) < INTERPOLATE_FLAT)
+				return (0);
+			memcpy(w, v, nv * sizeof(*w));
+			w[k] = x;
+			if (!simplexCircumcentre(w, dim, g + k * dim, &radius))
+				return (0);
+		}
+		for (k = 0; k < nv; k++)
+		{
+			row = 0;
+			for (m = 0; m < nv; m++)
+			{
+				if (m == k)
+					continue;
+				for (j = 0; j < dim; j++)
+					a[row * dim + j] = g[m * dim + j] - task->centres[cell * dim + j];
+				row++;
+			}
+			volume = determinant(a, dim);
+			addWeight(conflict, mesh->cells[cell * nv + k], (((k + dim) % 2) ? -sign : sign) * volume);
+		}
+	}
+	return (1);
+}
+
+/* The Sibson weights of x into conflict, each the volume of the
+   intersection of the Voronoi cells of its point before and of x after
+   x is inserted, computed as an intersection of halfspaces: the
+   bisectors of x and of the point with every point of the cells in
+   conflict. This is exact however degenerate the cells are, but much
+   slower than watsonWeights(). Returns 0 if the Voronoi cell of x is
+   unbounded, where x lies on the boundary of the convex hull, or if
+   qhull fails. */
+static int exactWeights(const interpolateT *task, const double *x, conflictT *conflict)
+{
+	const meshT *mesh = task->mesh;
+	intersectionT result;
+	double *h, p[MESH_DIMmax], q[MESH_DIMmax], norm, scale = 0, *grown;
+	int dim = mesh->dim, nv = mesh->nv, j, k, a, b, m, exitcode, bounded;
+	size_t row = (dim + 1) * sizeof(double);
+	R_xlen_t t;
+
+	for (t = 0; t < conflict->ncells; t++)
+		for (k = 0; k < nv; k++)
+			addWeight(conflict, mesh->cells[conflict->cells[t] * nv + k], 0);
+	if (conflict->failed)
+		return (0);
+	m = 2 * conflict->npoints - 1;
+	if (m > conflict->sizeHalfspaces)
+	{
+		grown = (double *)realloc(conflict->halfspaces, m * row);
+		if (!grown)
+			return (0);
+		conflict->halfspaces = grown;
+		conflict->sizeHalfspaces = m;
+	}
+	if (!conflict->errfile && !(conflict->errfile = openMessageStream()))
+		return (0);
+
+	/* Coordinates are taken about x */
+	for (a = 0; a < conflict->npoints; a++)
+	{
+		norm = 0;
+		for (j = 0; j < dim; j++)
+		{
+			q[j] = mesh->points[(R_xlen_t)conflict->points[a] * dim + j] - x[j];
+			norm += q[j] * q[j];
+		}
+		norm = sqrt(norm);
+		scale = fmax(scale, norm);
+		h = conflict->halfspaces + (size_t)a * (dim + 1);
+		for (j = 0; j < dim; j++)
+			h[j] = q[j] / norm;
+		h[dim] = -norm / 2;
+	}
+	for (a = 0; a < conflict->npoints; a++)
+	{
+		for (j = 0; j < dim; j++)
+			p[j] = mesh->points[(R_xlen_t)conflict->points[a] * dim + j] - x[j];
+		h = conflict->halfspaces + (size_t)conflict->npoints * (dim + 1);
+		for (b = 0; b < conflict->npoints; b++)
+		{
+			if (b == a)
+				continue;
+			norm = 0;
+			for (j = 0; j < dim; j++)
+			{
+				q[j] = mesh->points[(R_xlen_t)conflict->points[b] * dim + j] - x[j];
+				h[j] = q[j] - p[j];
+				norm += h[j] * h[j];
+			}
+			norm = sqrt(norm);
+			h[dim] = 0;
+			for (j = 0; j < dim; j++)
+			{
+				h[j] /= norm;
+				h[dim] -= h[j] * (p[j] + q[j]) / 2;
+			}
+			h += dim + 1;
+		}
+		exitcode = intersectHalfspaces(conflict->halfspaces, m, dim, MESH_EPSILON * scale,
+									   conflict->errfile, &result);
+		conflict->weights[a] = result.volume;
+		bounded = (result.radius < INFINITY);
+		freeIntersection(&result);
+		if (exitcode || !bounded)
+			return (0);
+	}
+	return (1);
+}
+
+/* Whether the weights in conflict reproduce x, as the Sibson
+   coordinates of a point do (they have linear precision), and sum to
+   more than 0. This catches weights spoilt by rounding where x is near
+   a degenerate configuration or the boundary of the convex hull. */
+static int weightsValid(const interpolateT *task, const double *x, const conflictT *conflict)
+{
+	const double *p;
+	double total = 0, centre[MESH_DIMmax], scale = 0, error = 0;
+	int j, k, dim = task->mesh->dim;
+
+	if (conflict->failed)
+		return (0);
+	memset(centre, 0, dim * sizeof(double));
+	for (k = 0; k < conflict->npoints; k++)
+	{
+		p = task->mesh->points + (R_xlen_t)conflict->points[k] * dim;
+		total += conflict->weights[k];
+		for (j = 0; j < dim; j++)
+		{
+			centre[j] += conflict->weights[k] * (p[j] - x[j]);
+			scale = fmax(scale, fabs(p[j] - x[j]));
+		}
+	}
+	if (!(total > 0))
+		return (0);
+	for (j = 0; j < dim; j++)
+		error = fmax(error, fabs(centre[j]) / total);
+	return (error <= INTERPOLATE_FLAT * scale);
+}
+
+/* The natural neighbour interpolant at x, which lies in cell c.
+   Returns 0 if it cannot be found there. */
+static int naturalValue(const interpolateT *task, R_xlen_t c, const double *x, conflictT *conflict,
+						double *value)
+{
+	double sum = 0, total = 0;
+	int k, flat;
+
+	flat = conflictCells(task, c, x, conflict);
+	if (flat || !watsonWeights(task, x, conflict) || !weightsValid(task, x, conflict))
+	{
+		conflict->npoints = 0;
+		if (!exactWeights(task, x, conflict) || !weightsValid(task, x, conflict))
+			return (0);
+	}
+	for (k = 0; k < conflict->npoints; k++)
+	{
+		sum += conflict->weights[k] * task->values[conflict->points[k]];
+		total += conflict->weights[k];
+	}
+	*value = sum / total;
+	return (1);
+}
+
+static void interpolateChunk(void *ctx, R_xlen_t begin, R_xlen_t end)
+{
+	const interpolateT *task = (const interpolateT *)ctx;
+	const meshT *mesh = task->mesh;
+	double x[MESH_DIMmax], nudged[MESH_DIMmax], lambda[MESH_DIMmax + 1], sum, near, far;
+	int side[MESH_DIMmax + 1], j, k, m, dim = mesh->dim, nv = mesh->nv;
+	R_xlen_t i, c, start = 0;
+	conflictT conflict;
+	boolT missing;
+
+	memset(&conflict, 0, sizeof(conflict));
+	for (i = begin; i < end; i++)
+	{
+		queryPoint(task, i, x);
+		missing = False;
+		for (j = 0; j < dim; j++)
+			missing |= ISNAN(x[j]);
+		c = missing ? 0 : meshLocate(mesh, x, &start, lambda, side);
+		task->outside[i] = !c;
+		if (!c)
+			continue;
+		c--;
+
+		if (task->method == INTERPOLATE_LINEAR)
+		{
+			task->result[i] = linearValue(task, c, lambda);
+			continue;
+		}
+
+		/* At a point of the triangulation the interpolant is its value */
+		for (k = 0; k < nv; k++)
+			if (!memcmp(x, mesh->points + (R_xlen_t)mesh->cells[c * nv + k] * dim, dim * sizeof(double)))
+				break;
+		if (k < nv)
+		{
+			task->result[i] = task->values[mesh->cells[c * nv + k]];
+			continue;
+		}
+		if (naturalValue(task, c, x, &conflict, &task->result[i]))
+			continue;
+
+		/* On the boundary of the convex hull the Voronoi cell of x is
+		   unbounded. The interpolant is continuous there, so it is
+		   extrapolated from two queries moved a little towards the
+		   centroid of the cell, or failing that, where even those are
+		   too near a degenerate configuration, taken to be linear. */
+		for (k = 1; k <= 2; k++)
+		{
+			for (j = 0; j < dim; j++)
+			{
+				sum = 0;
+				for (m = 0; m < nv; m++)
+					sum += mesh->points[(R_xlen_t)mesh->cells[c * nv + m] * dim + j];
+				nudged[j] = x[j] + k * INTERPOLATE_NUDGE * (sum / nv - x[j]);
+			}
+			if (!naturalValue(task, c, nudged, &conflict, (k == 1) ? &near : &far))
+				break;
+		}
+		if (k > 2)
+			task->result[i] = 2 * near - far;
+		else
+			task->result[i] = linearValue(task, c, lambda);
+	}
+	free(conflict.cells);
+	free(conflict.points);
+	free(conflict.weights);
+	free(conflict.halfspaces);
+	if (conflict.errfile)
+		freeMessageStream(conflict.errfile);
+}
+
+/* The circumspheres of the cells begin..end-1, with a radius of 0 for
+   flat cells */
+static void circumsphereChunk(void *ctx, R_xlen_t begin, R_xlen_t end)
+{
+	const interpolateT *task = (const interpolateT *)ctx;
+	const meshT *mesh = task->mesh;
+	const double *v[MESH_DIMmax + 1];
+	double a[MESH_DIMmax * MESH_DIMmax], size, length;
+	R_xlen_t c;
+	int dim = mesh->dim, j, k;
+
+	for (c = begin; c < end; c++)
+	{
+		size = 0;
+		for (k = 0; k < mesh->nv; k++)
+		{
+			v[k] = mesh->points + (R_xlen_t)mesh->cells[c * mesh->nv + k] * dim;
+			if (k == 0)
+				continue;
+			length = 0;
+			for (j = 0; j < dim; j++)
+			{
+				a[(k - 1) * dim + j] = v[k][j] - v[0][j];
+				length += a[(k - 1) * dim + j] * a[(k - 1) * dim + j];
+			}
+			size = fmax(size, sqrt(length));
+		}
+		if (fabs(determinant(a, dim)) <= MESH_EPSILON * pow(size, dim) ||
+			!simplexCircumcentre(v, dim, task->centres + c * dim, task->radii + c))
+			task->radii[c] = 0;
+	}
+}
+
+/* Interpolate the values at the points of the Delaunay triangulation
+   with the given simplices (see meshFromMatrices()) at query, either a
+   matrix of test points or a list of the coordinates of a grid along
+   each axis, which is visited first axis fastest as by array(). method
+   is 0 for linear and 1 for natural neighbour interpolation. Queries
+   outside the triangulation are NA. */
+SEXP C_interpolate(const SEXP points, const SEXP simplices, const SEXP values, const SEXP query,
+				   const SEXP method)
+{
+	interpolateT task;
+	meshT mesh;
+	SEXP result;
+	double **axes;
+	R_xlen_t i, *counts;
+	int j;
+
+	meshFromMatrices(points, simplices, True, &mesh);
+	if (!isReal(values) || XLENGTH(values) != mesh.npoints)
+		error("values must give a number for every point");
+	task.mesh = &mesh;
+	task.values = REAL(values);
+	task.method = asInteger(method);
+	task.x = NULL;
+	task.axes = NULL;
+	task.counts = NULL;
+	if (TYPEOF(query) == VECSXP)
+	{
+		if (XLENGTH(query) != mesh.dim)
+			error("the grid must have the same dimensions as the points");
+		axes = (double **)R_alloc(mesh.dim, sizeof(double *));
+		counts = (R_xlen_t *)R_alloc(mesh.dim, sizeof(R_xlen_t));
+		task.n = 1;
+		for (j = 0; j < mesh.dim; j++)
+		{
+			if (!isReal(VECTOR_ELT(query, j)))
+				error("the grid coordinates must be real vectors");
+			axes[j] = REAL(VECTOR_ELT(query, j));
+			counts[j] = XLENGTH(VECTOR_ELT(query, j));
+			task.n *= counts[j];
+		}
+		task.axes = (const double *const *)axes;
+		task.counts = counts;
+	}
+	else
+	{
+		if (!isMatrix(query) || !isReal(query) || ncols(query) != mesh.dim)
+			error("test_points must have the same dimensions as the points");
+		task.x = REAL(query);
+		task.n = nrows(query);
+	}
+
+	task.centres = task.radii = NULL;
+	if (task.method == INTERPOLATE_NATURAL)
+	{
+		task.centres = (double *)R_alloc(mesh.ncells, mesh.dim * sizeof(double));
+		task.radii = (double *)R_alloc(mesh.ncells, sizeof(double));
+		parallelFor(mesh.ncells, THREADS_GRAIN, circumsphereChunk, &task);
+	}
+
+	PROTECT(result = allocVector(REALSXP, task.n));
+	task.result = REAL(result);
+	task.outside = (char *)R_alloc(task.n, sizeof(char));
+	parallelFor(task.n, 256, interpolateChunk, &task);
+	for (i = 0; i < task.n; i++)
+		if (task.outside[i])
+			task.result[i] = NA_REAL;
+	UNPROTECT(1);
+	return (result);
+}
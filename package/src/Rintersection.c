@@ -0,0 +1,511 @@
+/* Copyright (C) 2018
+
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+*/
+#include "RcompGeomete.h"
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The intersection of convex hulls, computed exactly as the
+   intersection of the halfspaces of all their facets. Qhull intersects
+   halfspaces ('H') by the convex hull of their duals about a point
+   strictly inside every one, which is found here by a linear program:
+   the centre of the largest ball inside the intersection. The vertices
+   of the intersection are read from the dual facets, and its volume
+   from the hull of the vertices. No R API is used, so intersections may
+   be computed on the threads of the pool. */
+
+#define QHULL_HALFSPACEcmd "qhull H0"
+#define QHULL_VOLUMEcmd "qhull Qt"
+
+static void releaseQhull(qhT *qh)
+{
+	int curlong, totlong;
+	qh_freeqhull(qh, !qh_ALL);
+	qh_memfreeshort(qh, &curlong, &totlong);
+	free(qh);
+}
+
+/* The centre and radius of the largest ball inside the halfspaces
+   (row-major, m x (dim + 1), normal . x + offset <= 0 with unit
+   normals). The ball is the solution of max t s.t. N x + t <= -offset,
+   whose dual, min -offset . y s.t. N' y = 0, sum(y) = 1 and y >= 0,
+   has only dim + 1 rows; x and t are its duals. Returns LP_OPTIMAL,
+   LP_INFEASIBLE if the intersection is unbounded, or LP_ERROR. */
+static int halfspaceCentre(const double *halfspaces, int m, int dim, double *centre,
+						   double *radius)
+{
+	double *A, *b, *c, *y, value;
+	int i, j, status;
+
+	A = (double *)malloc((size_t)(dim + 1) * m * sizeof(double));
+	b = (double *)calloc(dim + 1, sizeof(double));
+	c = (double *)malloc(m * sizeof(double));
+	y = (double *)malloc((dim + 1) * sizeof(double));
+	if (!A || !b || !c || !y)
+		status = LP_ERROR;
+	else
+	{
+		for (i = 0; i < m; i++)
+		{
+			const double *h = halfspaces + (size_t)i * (dim + 1);
+			for (j = 0; j < dim; j++)
+				A[(size_t)j * m + i] = h[j];
+			A[(size_t)dim * m + i] = 1;
+			c[i] = -h[dim];
+		}
+		b[dim] = 1;
+		status = lpSolve(A, b, c, dim + 1, m, NULL, y, &value);
+		if (status == LP_OPTIMAL)
+		{
+			memcpy(centre, y, dim * sizeof(double));
+			*radius = y[dim];
+		}
+	}
+	free(A);
+	free(b);
+	free(c);
+	free(y);
+	return (status);
+}
+
+/* Intersect the m halfspaces (row-major, m x (dim + 1), normal . x +
+   offset <= 0 with unit normals) of bounded polytopes. An intersection
+   whose largest inscribed ball has a radius of at most tolerance is
+   empty. Fills *result, whose vertices (row-major) are malloc()ed, and
+   returns 0 or qhull's exit code, writing qhull's messages to errfile. */
+int intersectHalfspaces(const double *halfspaces, int m, int dim, double tolerance,
+						FILE *errfile, intersectionT *result)
+{
+	qhT *qh;
+	facetT *facet;
+	double *dual, *vertex, radius;
+	int i, j, exitcode, status;
+
+	memset(result, 0, sizeof(*result));
+	result->interior = (double *)calloc(dim, sizeof(double));
+	if (!result->interior)
+		return (qh_ERRmem);
+	status = halfspaceCentre(halfspaces, m, dim, result->interior, &radius);
+	if (status == LP_ERROR)
+		return (qh_ERRmem);
+	result->radius = (status == LP_OPTIMAL) ? radius : INFINITY;
+	if (status != LP_OPTIMAL || !(radius > tolerance))
+		return (0);
+
+	/* Qhull intersects about the origin, so the centre is moved there */
+	dual = (double *)malloc((size_t)m * (dim + 1) * sizeof(double));
+	qh = (qhT *)calloc(1, sizeof(qhT));
+	if (!dual || !qh)
+	{
+		free(dual);
+		free(qh);
+		return (qh_ERRmem);
+	}
+	for (i = 0; i < m; i++)
+	{
+		const double *h = halfspaces + (size_t)i * (dim + 1);
+		double *row = dual + (size_t)i * (dim + 1);
+		row[dim] = h[dim];
+		for (j = 0; j < dim; j++)
+		{
+			row[j] = h[j];
+			row[dim] += h[j] * result->interior[j];
+		}
+	}
+	exitcode = runQhull(qh, errfile, dual, dim + 1, m, True, QHULL_HALFSPACEcmd, NULL);
+	if (!exitcode)
+	{
+		/* Each facet of the dual hull is a vertex of the intersection */
+		result->vertices = (double *)malloc((size_t)qh->num_facets * dim * sizeof(double));
+		if (!result->vertices)
+			exitcode = qh_ERRmem;
+		else
+			FORALLfacets
+			{
+				if (facet->offset > -qh->MINdenom)
+					continue;
+				vertex = result->vertices + (size_t)result->nvertices++ * dim;
+				for (j = 0; j < dim; j++)
+					vertex[j] = facet->normal[j] / -facet->offset + result->interior[j];
+			}
+	}
+	releaseQhull(qh);
+	if (exitcode || result->nvertices <= dim)
+		return (exitcode);
+
+	/* The volume and area of the intersection are those of the hull of
+	   its vertices. qhull reads the vertices in place. */
+	qh = (qhT *)calloc(1, sizeof(qhT));
+	if (!qh)
+		return (qh_ERRmem);
+	exitcode = runQhull(qh, errfile, result->vertices, dim, result->nvertices, False,
+						QHULL_VOLUMEcmd, NULL);
+	if (!exitcode)
+	{
+		qh_getarea(qh, qh->facet_list);
+		result->volume = qh->totvol;
+		result->area = qh->totarea;
+	}
+	releaseQhull(qh);
+	return (exitcode);
+}
+
+void freeIntersection(intersectionT *result)
+{
+	free(result->interior);
+	free(result->vertices);
+	memset(result, 0, sizeof(*result));
+}
+
+/* The halfspaces of the hulls attached to the facet matrices in the
+   list hulls (see attachedHull()), row-major with dim + 1 columns.
+   *tolerance is set to the largest of the hulls' qh->MINoutside. */
+double *hullListHalfspaces(const SEXP hulls, int *m, int *dim, double *tolerance)
+{
+	qhT *qh;
+	double *halfspaces, *normals, *offsets;
+	R_xlen_t k, f, nh, total = 0;
+	int j;
+
+	*dim = 0;
+	*tolerance = 0;
+	for (k = 0; k < XLENGTH(hulls); k++)
+	{
+		qh = attachedHull(VECTOR_ELT(hulls, k));
+		if (k > 0 && qh->hull_dim != *dim)
+			error("The hulls must have the same dimensions");
+		*dim = qh->hull_dim;
+		total += qh->num_facets;
+		*tolerance = fmax(*tolerance, qh->MINoutside);
+	}
+	if (total > INT_MAX)
+		error("Too many facets to intersect");
+	halfspaces = (double *)R_alloc(total, (*dim + 1) * sizeof(double));
+	*m = 0;
+	for (k = 0; k < XLENGTH(hulls); k++)
+	{
+		qh = attachedHull(VECTOR_ELT(hulls, k));
+		normals = (double *)R_alloc(qh->num_facets, *dim * sizeof(double));
+		offsets = (double *)R_alloc(qh->num_facets, sizeof(double));
+		nh = hullHalfspaces(qh, normals, offsets);
+		for (f = 0; f < nh; f++, (*m)++)
+		{
+			for (j = 0; j < *dim; j++)
+				halfspaces[(R_xlen_t)*m * (*dim + 1) + j] = normals[f * *dim + j];
+			halfspaces[(R_xlen_t)*m * (*dim + 1) + *dim] = offsets[f];
+		}
+	}
+	return (halfspaces);
+}
+
+/* The intersection of the hulls attached to the facet matrices in the
+   list hulls: its vertices, the centre and radius of the largest ball
+   inside it, and its volume and area */
+SEXP C_hullIntersection(const SEXP hulls)
+{
+	SEXP retlist, retnames, vertices, interior;
+	intersectionT result;
+	double *halfspaces, tolerance;
+	int i, j, m, dim, exitcode;
+	FILE *errfile;
+
+	if (TYPEOF(hulls) != VECSXP || XLENGTH(hulls) == 0)
+		error("hulls must be a list of convex hulls");
+	halfspaces = hullListHalfspaces(hulls, &m, &dim, &tolerance);
+
+	errfile = newMessageStream();
+	exitcode = intersectHalfspaces(halfspaces, m, dim, tolerance, errfile, &result);
+
+	PROTECT(vertices = allocMatrix(REALSXP, result.nvertices, dim));
+	for (i = 0; i < result.nvertices; i++)
+		for (j = 0; j < dim; j++)
+			REAL(vertices)[i + result.nvertices * j] = result.vertices[(size_t)i * dim + j];
+	PROTECT(interior = allocVector(REALSXP, dim));
+	for (j = 0; j < dim; j++)
+		REAL(interior)[j] = result.interior ? result.interior[j] : NA_REAL;
+
+	PROTECT(retlist = allocVector(VECSXP, 5));
+	PROTECT(retnames = allocVector(STRSXP, 5));
+	SET_VECTOR_ELT(retlist, 0, vertices);
+	SET_VECTOR_ELT(retlist, 1, interior);
+	SET_VECTOR_ELT(retlist, 2, ScalarReal(result.radius));
+	SET_VECTOR_ELT(retlist, 3, ScalarReal(result.volume));
+	SET_VECTOR_ELT(retlist, 4, ScalarReal(result.area));
+	SET_STRING_ELT(retnames, 0, mkChar("vertices"));
+	SET_STRING_ELT(retnames, 1, mkChar("interior"));
+	SET_STRING_ELT(retnames, 2, mkChar("radius"));
+	SET_STRING_ELT(retnames, 3, mkChar("volume"));
+	SET_STRING_ELT(retnames, 4, mkChar("area"));
+	setAttrib(retlist, R_NamesSymbol, retnames);
+	if (exitcode)
+		setQhullError(retlist, exitcode, errfile);
+	freeMessageStream(errfile);
+	freeIntersection(&result);
+	UNPROTECT(4);
+	return (retlist);
+}
+
+/* Overlaps between all pairs of many hulls. Pairs whose bounding boxes
+   are apart are never considered: a sweep along the first axis finds
+   the pairs whose boxes overlap. A pair is then apart if every vertex
+   of one hull lies outside one facet of the other, and only the pairs
+   left are intersected, in parallel. */
+
+enum
+{
+	OVERLAP_APART,
+	OVERLAP_FOUND,
+	OVERLAP_FAILED
+};
+
+typedef struct
+{
+	int dim;
+	double **halfspaces; /* of each hull, as for intersectHalfspaces() */
+	int *nhalfspaces;
+	double **vertices; /* of each hull, row-major */
+	int *nvertices;
+	double *tolerance; /* qh->MINoutside of each hull */
+	const int *first, *second; /* the pairs */
+	double *volume;
+	char *outcome;
+} overlapsT;
+
+typedef struct
+{
+	double lo;
+	int hull;
+} sweepT;
+
+static int compareSweep(const void *a, const void *b)
+{
+	double x = ((const sweepT *)a)->lo, y = ((const sweepT *)b)->lo;
+	return ((x > y) - (x < y));
+}
+
+/* Whether a facet of hull a has every vertex of hull b outside it */
+static int facetSeparates(const overlapsT *task, int a, int b, double tolerance)
+{
+	const double *h, *v;
+	double dist;
+	int f, i, j, dim = task->dim;
+
+	for (f = 0; f < task->nhalfspaces[a]; f++)
+	{
+		h = task->halfspaces[a] + (size_t)f * (dim + 1);
+		for (i = 0; i < task->nvertices[b]; i++)
+		{
+			v = task->vertices[b] + (size_t)i * dim;
+			dist = h[dim];
+			for (j = 0; j < dim; j++)
+				dist += h[j] * v[j];
+			if (dist < tolerance)
+				break;
+		}
+		if (i == task->nvertices[b])
+			return (1);
+	}
+	return (0);
+}
+
+static void overlapChunk(void *ctx, R_xlen_t begin, R_xlen_t end)
+{
+	const overlapsT *task = (const overlapsT *)ctx;
+	intersectionT result;
+	double *halfspaces, tolerance;
+	int a, b, m, dim = task->dim, exitcode;
+	size_t row = (dim + 1) * sizeof(double);
+	FILE *errfile;
+	R_xlen_t k;
+
+	for (k = begin; k < end; k++)
+	{
+		a = task->first[k];
+		b = task->second[k];
+		tolerance = fmax(task->tolerance[a], task->tolerance[b]);
+		task->volume[k] = 0;
+		task->outcome[k] = OVERLAP_APART;
+		if (facetSeparates(task, a, b, tolerance) || facetSeparates(task, b, a, tolerance))
+			continue;
+		m = task->nhalfspaces[a] + task->nhalfspaces[b];
+		halfspaces = (double *)malloc(m * row);
+		errfile = openMessageStream();
+		if (!halfspaces || !errfile)
+			exitcode = qh_ERRmem;
+		else
+		{
+			memcpy(halfspaces, task->halfspaces[a], task->nhalfspaces[a] * row);
+			memcpy(halfspaces + (size_t)task->nhalfspaces[a] * (dim + 1), task->halfspaces[b],
+				   task->nhalfspaces[b] * row);
+			exitcode = intersectHalfspaces(halfspaces, m, dim, tolerance, errfile, &result);
+			if (!exitcode)
+				task->volume[k] = result.volume;
+			freeIntersection(&result);
+		}
+		if (exitcode)
+			task->outcome[k] = OVERLAP_FAILED;
+		else if (task->volume[k] > 0)
+			task->outcome[k] = OVERLAP_FOUND;
+		free(halfspaces);
+		freeMessageStream(errfile);
+	}
+}
+
+/* The volumes of the intersections of the pairs of hulls, attached to
+   the facet matrices in the list hulls, that overlap. Returns the
+   1-based indices i < j of each overlapping pair and its volume, NA if
+   qhull failed. */
+SEXP C_hullOverlaps(const SEXP hulls)
+{
+	SEXP retlist, retnames, first, second, volume;
+	overlapsT task;
+	sweepT *sweep;
+	qhT *qh;
+	vertexT *vertex;
+	double *lo, *hi;
+	int *pairFirst = NULL, *pairSecond = NULL, *grown, a, b, i, j, n, nv, dim = 0;
+	R_xlen_t k, s, t, npairs = 0, size = 0, nfound;
+
+	if (TYPEOF(hulls) != VECSXP)
+		error("hulls must be a list of convex hulls");
+	n = (int)XLENGTH(hulls);
+	for (a = 0; a < n; a++)
+	{
+		qh = attachedHull(VECTOR_ELT(hulls, a));
+		if (a > 0 && qh->hull_dim != dim)
+			error("The hulls must have the same dimensions");
+		dim = qh->hull_dim;
+	}
+
+	/* Copy what the threads need out of qhull: the halfspaces and
+	   vertices of each hull, and its bounding box */
+	task.dim = dim;
+	task.halfspaces = (double **)R_alloc(n, sizeof(double *));
+	task.nhalfspaces = (int *)R_alloc(n, sizeof(int));
+	task.vertices = (double **)R_alloc(n, sizeof(double *));
+	task.nvertices = (int *)R_alloc(n, sizeof(int));
+	task.tolerance = (double *)R_alloc(n, sizeof(double));
+	lo = (double *)R_alloc(n, dim * sizeof(double));
+	hi = (double *)R_alloc(n, dim * sizeof(double));
+	sweep = (sweepT *)R_alloc(n, sizeof(sweepT));
+	for (a = 0; a < n; a++)
+	{
+		double *normals, *offsets;
+		R_xlen_t f, nh;
+
+		qh = attachedHull(VECTOR_ELT(hulls, a));
+		normals = (double *)R_alloc(qh->num_facets, dim * sizeof(double));
+		offsets = (double *)R_alloc(qh->num_facets, sizeof(double));
+		nh = hullHalfspaces(qh, normals, offsets);
+		task.halfspaces[a] = (double *)R_alloc(nh, (dim + 1) * sizeof(double));
+		for (f = 0; f < nh; f++)
+		{
+			memcpy(task.halfspaces[a] + f * (dim + 1), normals + f * dim, dim * sizeof(double));
+			task.halfspaces[a][f * (dim + 1) + dim] = offsets[f];
+		}
+		task.nhalfspaces[a] = (int)nh;
+		task.tolerance[a] = qh->MINoutside;
+
+		task.vertices[a] = (double *)R_alloc(qh->num_vertices, dim * sizeof(double));
+		for (j = 0; j < dim; j++)
+		{
+			lo[a * dim + j] = R_PosInf;
+			hi[a * dim + j] = R_NegInf;
+		}
+		nv = 0;
+		FORALLvertices
+		{
+			for (j = 0; j < dim; j++)
+			{
+				task.vertices[a][nv * dim + j] = vertex->point[j];
+				lo[a * dim + j] = fmin(lo[a * dim + j], vertex->point[j]);
+				hi[a * dim + j] = fmax(hi[a * dim + j], vertex->point[j]);
+			}
+			nv++;
+		}
+		task.nvertices[a] = nv;
+		sweep[a].lo = lo[a * dim];
+		sweep[a].hull = a;
+	}
+
+	/* Sweep along the first axis for the pairs of overlapping boxes */
+	qsort(sweep, n, sizeof(sweepT), compareSweep);
+	for (s = 0; s < n; s++)
+		for (t = s + 1; t < n && sweep[t].lo <= hi[sweep[s].hull * dim]; t++)
+		{
+			a = sweep[s].hull;
+			b = sweep[t].hull;
+			for (j = 1; j < dim; j++)
+				if (lo[a * dim + j] > hi[b * dim + j] || lo[b * dim + j] > hi[a * dim + j])
+					break;
+			if (j < dim)
+				continue;
+			if (npairs == size)
+			{
+				size = size ? 2 * size : 1024;
+				grown = (int *)realloc(pairFirst, size * sizeof(int));
+				if (grown)
+					pairFirst = grown;
+				grown = grown ? (int *)realloc(pairSecond, size * sizeof(int)) : NULL;
+				if (!grown)
+				{
+					free(pairFirst);
+					free(pairSecond);
+					error("Unable to allocate memory for the pairs of hulls");
+				}
+				pairSecond = grown;
+			}
+			pairFirst[npairs] = (a < b) ? a : b;
+			pairSecond[npairs++] = (a < b) ? b : a;
+		}
+
+	task.first = pairFirst;
+	task.second = pairSecond;
+	task.volume = (double *)R_alloc(npairs, sizeof(double));
+	task.outcome = (char *)R_alloc(npairs, sizeof(char));
+	parallelFor(npairs, 1, overlapChunk, &task);
+
+	nfound = 0;
+	for (k = 0; k < npairs; k++)
+		nfound += (task.outcome[k] != OVERLAP_APART);
+	PROTECT(first = allocVector(INTSXP, nfound));
+	PROTECT(second = allocVector(INTSXP, nfound));
+	PROTECT(volume = allocVector(REALSXP, nfound));
+	i = 0;
+	for (k = 0; k < npairs; k++)
+		if (task.outcome[k] != OVERLAP_APART)
+		{
+			INTEGER(first)[i] = pairFirst[k] + 1;
+			INTEGER(second)[i] = pairSecond[k] + 1;
+			REAL(volume)[i++] = (task.outcome[k] == OVERLAP_FOUND) ? task.volume[k] : NA_REAL;
+		}
+	free(pairFirst);
+	free(pairSecond);
+
+	PROTECT(retlist = allocVector(VECSXP, 3));
+	PROTECT(retnames = allocVector(STRSXP, 3));
+	SET_VECTOR_ELT(retlist, 0, first);
+	SET_VECTOR_ELT(retlist, 1, second);
+	SET_VECTOR_ELT(retlist, 2, volume);
+	SET_STRING_ELT(retnames, 0, mkChar("i"));
+	SET_STRING_ELT(retnames, 1, mkChar("j"));
+	SET_STRING_ELT(retnames, 2, mkChar("volume"));
+	setAttrib(retlist, R_NamesSymbol, retnames);
+	UNPROTECT(5);
+	return (retlist);
+}
@@ -0,0 +1,314 @@
+/* Copyright (C) 2018
+
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+*/
+#include "RcompGeomete.h"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+/* Background geometry jobs.
+
+   C_jobStart() copies the points and builds the hull on a native worker
+   thread with runQhull(), which works on native arrays only and never
+   touches R. The R result is extracted on the main thread when the job
+   is collected with C_jobValue(), by the same convexResult(),
+   delaunayResult() and voronoiResult() used by the synchronous entry
+   points, so a job gives exactly the result of the equivalent call.
+
+   Each job has its own qhull context and message stream, so any number
+   of jobs can run at once. A job is cancelled by setting job->cancel,
+   which qh_buildhull() checks before adding each point. */
+
+#define JOB_RUNNING 0
+#define JOB_FINISHED 1	/* qhull has returned, result not yet extracted */
+#define JOB_COLLECTED 2 /* result extracted, or taken from the cache */
+
+#define JOB_CONVEX 0
+#define JOB_DELAUNAY 1
+#define JOB_VORONOI 2
+
+typedef struct
+{
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t finished;
+	boolT joinable; /* the thread has not been joined yet */
+	int state;
+	volatile int cancel;
+	int kind, want;
+	int dim, n;
+	boolT ismalloc; /* pt_array is a copy, not the mapping of a point file */
+	char flags[250];
+	double *pt_array;
+	qhT *qh;
+	int exitcode;
+} jobT;
+
+/* The external pointer to a job protects list(points, options, value) */
+#define JOB_POINTS 0
+#define JOB_OPTIONS 1
+#define JOB_VALUE 2
+
+static void *jobRun(void *arg)
+{
+	jobT *job = (jobT *)arg;
+	int exitcode = runQhull(job->qh, job->qh->qhmem.ferr, job->pt_array, job->dim, job->n,
+							job->ismalloc, job->flags, &job->cancel);
+	pthread_mutex_lock(&job->lock);
+	job->exitcode = exitcode;
+	job->state = JOB_FINISHED;
+	pthread_cond_broadcast(&job->finished);
+	pthread_mutex_unlock(&job->lock);
+	return (NULL);
+}
+
+static void jobJoin(jobT *job)
+{
+	if (job->joinable)
+	{
+		pthread_join(job->thread, NULL);
+		job->joinable = False;
+	}
+}
+
+/* Free a hull that was never extracted into a result */
+static void jobFreeHull(jobT *job)
+{
+	if (job->qh)
+	{
+		boolT owned = (job->qh->first_point == job->pt_array || job->qh->input_points == job->pt_array);
+		freeQhull(job->qh);
+		if (!owned && job->ismalloc)
+			free(job->pt_array);
+	}
+	else if (job->ismalloc)
+		free(job->pt_array);
+	job->qh = NULL;
+	job->pt_array = NULL;
+}
+
+static void jobFinalizer(SEXP ptr)
+{
+	jobT *job = (jobT *)R_ExternalPtrAddr(ptr);
+	if (!job)
+		return;
+	/* A job that is dropped while running is stopped, not waited for */
+	job->cancel = 1;
+	jobJoin(job);
+	jobFreeHull(job);
+	pthread_mutex_destroy(&job->lock);
+	pthread_cond_destroy(&job->finished);
+	free(job);
+	R_ClearExternalPtr(ptr);
+}
+
+static jobT *jobPointer(SEXP ptr)
+{
+	jobT *job;
+	if (TYPEOF(ptr) != EXTPTRSXP || !(job = (jobT *)R_ExternalPtrAddr(ptr)))
+		error("Not a geometry job.");
+	return (job);
+}
+
+/* Wait until the job has finished or seconds have passed, returning
+   whether it has finished. The wait is done in short slices so that
+   the user can interrupt it. */
+static boolT jobWait(jobT *job, double seconds)
+{
+	struct timeval now;
+	struct timespec until;
+	double left = seconds, slice;
+	int state;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&job->lock);
+		if (job->state == JOB_RUNNING && left > 0)
+		{
+			slice = left < 0.1 ? left : 0.1;
+			gettimeofday(&now, NULL);
+			until.tv_sec = now.tv_sec + (time_t)slice;
+			until.tv_nsec = now.tv_usec * 1000 + (long)((slice - (time_t)slice) * 1e9);
+			if (until.tv_nsec >= 1000000000L)
+			{
+				until.tv_sec++;
+				until.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&job->finished, &job->lock, &until);
+			left -= slice;
+		}
+		state = job->state;
+		pthread_mutex_unlock(&job->lock);
+		if (state != JOB_RUNNING || left <= 0)
+			return (state != JOB_RUNNING);
+		R_CheckUserInterrupt();
+	}
+}
+
+/* Start building the hull of p in the background. kind is one of
+   "convex", "delaunay" and "voronoi"; options and what are as for
+   C_convex(), C_delaunayn() and C_voronoiR(). */
+SEXP C_jobStart(const SEXP kind, const SEXP p, const SEXP options, const SEXP what)
+{
+	SEXP ptr, prot, cached;
+	const char *name;
+	char cacheKind[16];
+	FILE *errfile;
+	jobT *job;
+
+	if (!isString(kind) || length(kind) != 1)
+		error("First argument must be a single string.");
+	checkQhullInput(p, options);
+	if (!isInteger(what) || length(what) != 1)
+		error("Fourth argument must be a single integer.");
+
+	job = (jobT *)calloc(1, sizeof(jobT));
+	if (!job)
+		error("Unable to allocate memory for a geometry job");
+	name = CHAR(STRING_ELT(kind, 0));
+	job->want = INTEGER(what)[0];
+	if (!strcmp(name, "convex"))
+	{
+		job->kind = JOB_CONVEX;
+		snprintf(cacheKind, sizeof(cacheKind), "convex");
+		snprintf(job->flags, sizeof(job->flags), QHULL_CONVEXcmd, CHAR(STRING_ELT(options, 0)));
+	}
+	else if (!strcmp(name, "delaunay") || !strcmp(name, "voronoi"))
+	{
+		job->kind = (name[0] == 'd') ? JOB_DELAUNAY : JOB_VORONOI;
+		snprintf(cacheKind, sizeof(cacheKind), "%s%d", name, job->want);
+		snprintf(job->flags, sizeof(job->flags), QHULL_DELAUNAYcmd, CHAR(STRING_ELT(options, 0)));
+	}
+	else
+	{
+		free(job);
+		error("Unknown kind of geometry job '%s'.", name);
+	}
+	pthread_mutex_init(&job->lock, NULL);
+	pthread_cond_init(&job->finished, NULL);
+
+	PROTECT(prot = allocVector(VECSXP, 3));
+	SET_VECTOR_ELT(prot, JOB_POINTS, p);
+	SET_VECTOR_ELT(prot, JOB_OPTIONS, options);
+	PROTECT(ptr = R_MakeExternalPtr(job, install("geometry_job"), prot));
+	R_RegisterCFinalizerEx(ptr, jobFinalizer, TRUE);
+
+	/* A geometry built before needs no job */
+	cached = cacheLookup(cacheKind, p, options);
+	if (cached != R_NilValue)
+	{
+		SET_VECTOR_ELT(prot, JOB_VALUE, cached);
+		job->state = JOB_COLLECTED;
+		UNPROTECT(2);
+		return (ptr);
+	}
+
+	job->dim = ncols(p);
+	job->n = nrows(p);
+	job->pt_array = copyPoints(p, &job->ismalloc);
+	errfile = newMessageStream();
+	job->qh = (qhT *)calloc(1, sizeof(qhT));
+	if (!job->qh)
+	{
+		freeMessageStream(errfile);
+		error("Unable to allocate memory for qhull");
+	}
+	job->qh->qhmem.ferr = errfile;
+	job->state = JOB_RUNNING;
+	if (pthread_create(&job->thread, NULL, jobRun, job) == 0)
+		job->joinable = True;
+	else
+		jobRun(job); /* no thread available, so build the hull now */
+
+	UNPROTECT(2);
+	return (ptr);
+}
+
+/* "running", "finished" or "cancelled" (stopped before completion) */
+SEXP C_jobStatus(const SEXP ptr)
+{
+	jobT *job = jobPointer(ptr);
+	int state;
+	pthread_mutex_lock(&job->lock);
+	state = job->state;
+	pthread_mutex_unlock(&job->lock);
+	if (state == JOB_RUNNING)
+		return (mkString("running"));
+	return (mkString(job->cancel && job->exitcode ? "cancelled" : "finished"));
+}
+
+/* Wait at most timeout seconds for the job, returning whether it has
+   finished */
+SEXP C_jobWait(const SEXP ptr, const SEXP timeout)
+{
+	jobT *job = jobPointer(ptr);
+	double seconds = asReal(timeout);
+	if (ISNAN(seconds))
+		seconds = R_PosInf;
+	return (ScalarLogical(jobWait(job, seconds)));
+}
+
+/* Ask the job to stop, returning whether it was still running */
+SEXP C_jobCancel(const SEXP ptr)
+{
+	jobT *job = jobPointer(ptr);
+	boolT running;
+	pthread_mutex_lock(&job->lock);
+	running = (job->state == JOB_RUNNING);
+	if (running)
+		job->cancel = 1;
+	pthread_mutex_unlock(&job->lock);
+	return (ScalarLogical(running));
+}
+
+/* Wait for the job and return its result, extracting it from the hull
+   on the first call */
+SEXP C_jobValue(const SEXP ptr)
+{
+	jobT *job = jobPointer(ptr);
+	SEXP prot = R_ExternalPtrProtected(ptr), value, p, options;
+	qhT *qh;
+	double *pt_array;
+
+	if (job->state == JOB_COLLECTED)
+		return (VECTOR_ELT(prot, JOB_VALUE));
+	jobWait(job, R_PosInf);
+	jobJoin(job);
+
+	/* The result takes ownership of the hull */
+	p = VECTOR_ELT(prot, JOB_POINTS);
+	options = VECTOR_ELT(prot, JOB_OPTIONS);
+	qh = job->qh;
+	pt_array = job->pt_array;
+	job->qh = NULL;
+	job->pt_array = NULL;
+	job->state = JOB_COLLECTED;
+	switch (job->kind)
+	{
+	case JOB_CONVEX:
+		value = convexResult(qh, job->exitcode, pt_array, p, options);
+		break;
+	case JOB_DELAUNAY:
+		value = delaunayResult(qh, job->exitcode, pt_array, p, options, job->want);
+		break;
+	default:
+		value = voronoiResult(qh, job->exitcode, pt_array, p, options, job->want);
+		break;
+	}
+	SET_VECTOR_ELT(prot, JOB_VALUE, value);
+	return (value);
+}
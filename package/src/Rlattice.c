@@ -0,0 +1,303 @@
+/* Copyright (C) 2018
+
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+*/
+#include "RcompGeomete.h"
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Delaunay triangulations of points on a complete rectangular lattice
+   in 2-D or 3-D, such as the centres of the cells of a raster, built
+   without qhull. Every cell of such a lattice is co-circular, which is
+   the worst case for qhull: it merges the cells into non-simplicial
+   facets and then triangulates them again. Here each cell is split
+   directly into the simplices of its Kuhn triangulation, which are the
+   same in every cell so that they meet face to face. They are all
+   Delaunay, as the circumsphere of each is that of its cell and no
+   other point of the lattice lies inside it. */
+
+/* Coordinates within this fraction of the spacing of a lattice
+   coordinate lie on it */
+#define LATTICE_EPSILON 1e-9
+#define LATTICE_DIMmax 3
+
+typedef struct
+{
+	int dim;
+	R_xlen_t n;
+	const double *points;		   /* n x dim, row-major */
+	R_xlen_t count[LATTICE_DIMmax]; /* lattice coordinates along each axis */
+	double lo[LATTICE_DIMmax], step[LATTICE_DIMmax];
+	R_xlen_t *at;				   /* point at each lattice position, first axis fastest */
+	int *cells;					   /* ncells x (dim + 1), row-major */
+	double *centres, *radii;	   /* circumspheres, either may be NULL */
+	float *single;				   /* centres in single precision, in place of centres */
+	R_xlen_t ncells;
+} latticeT;
+
+/* The vertex orders of the Kuhn simplices of a cell: each walks from its
+   lowest corner to the highest, stepping along the axes in one of the
+   possible orders */
+static const int kuhn2[2][2] = {{0, 1}, {1, 0}};
+static const int kuhn3[6][3] = {{0, 1, 2}, {0, 2, 1}, {1, 0, 2}, {1, 2, 0}, {2, 0, 1}, {2, 1, 0}};
+
+/* Find the evenly spaced coordinates along axis j from the distinct
+   coordinates of the points. Returns 0 if there are fewer than two. */
+static int latticeAxis(latticeT *lattice, int j)
+{
+	double *x, range;
+	R_xlen_t i, count = 1;
+
+	x = (double *)malloc(lattice->n * sizeof(double));
+	if (!x)
+		error("Unable to allocate memory for %ld points", (long)lattice->n);
+	for (i = 0; i < lattice->n; i++)
+		x[i] = lattice->points[i * lattice->dim + j];
+	R_rsort(x, (int)lattice->n);
+	range = x[lattice->n - 1] - x[0];
+	for (i = 1; i < lattice->n; i++)
+		if (x[i] - x[i - 1] > LATTICE_EPSILON * range)
+			count++;
+	lattice->lo[j] = x[0];
+	free(x);
+	if (count < 2 || !(range > 0))
+		return (0);
+	lattice->count[j] = count;
+	lattice->step[j] = range / (count - 1);
+	return (1);
+}
+
+/* Fill lattice->at with the point at each lattice position. Returns 0
+   unless every point lies on a position of its own and every position
+   holds a point. */
+static int latticePositions(latticeT *lattice)
+{
+	R_xlen_t i, size = 1, index, stride;
+	double k, x;
+	int j;
+
+	for (j = 0; j < lattice->dim; j++)
+	{
+		size *= lattice->count[j];
+		if (size > lattice->n)
+			return (0);
+	}
+	if (size != lattice->n)
+		return (0);
+	for (index = 0; index < size; index++)
+		lattice->at[index] = -1;
+	for (i = 0; i < lattice->n; i++)
+	{
+		index = 0;
+		stride = 1;
+		for (j = 0; j < lattice->dim; j++)
+		{
+			x = (lattice->points[i * lattice->dim + j] - lattice->lo[j]) / lattice->step[j];
+			k = nearbyint(x);
+			if (fabs(x - k) > LATTICE_EPSILON || k < 0 || k >= lattice->count[j])
+				return (0);
+			index += (R_xlen_t)k * stride;
+			stride *= lattice->count[j];
+		}
+		if (lattice->at[index] >= 0)
+			return (0);
+		lattice->at[index] = i;
+	}
+	return (1);
+}
+
+/* Split the lattice cells begin..end-1, numbered first axis fastest,
+   into simplices and solve their circumspheres */
+static void latticeChunk(void *ctx, R_xlen_t begin, R_xlen_t end)
+{
+	const latticeT *lattice = (const latticeT *)ctx;
+	int dim = lattice->dim, nv = dim + 1, nsplit = (dim == 2) ? 2 : 6;
+	R_xlen_t c, s, rest, index, stride, pos[LATTICE_DIMmax], corner[LATTICE_DIMmax];
+	const double *v[LATTICE_DIMmax + 1];
+	double centre[LATTICE_DIMmax], radius;
+	int j, k, m, *cell;
+
+	for (c = begin; c < end; c++)
+	{
+		rest = c;
+		for (j = 0; j < dim; j++)
+		{
+			pos[j] = rest % (lattice->count[j] - 1);
+			rest /= lattice->count[j] - 1;
+		}
+		for (k = 0; k < nsplit; k++)
+		{
+			s = c * nsplit + k;
+			cell = lattice->cells + s * nv;
+			memcpy(corner, pos, dim * sizeof(R_xlen_t));
+			for (m = 0; m <= dim; m++)
+			{
+				if (m > 0)
+					corner[(dim == 2) ? kuhn2[k][m - 1] : kuhn3[k][m - 1]]++;
+				index = 0;
+				stride = 1;
+				for (j = 0; j < dim; j++)
+				{
+					index += corner[j] * stride;
+					stride *= lattice->count[j];
+				}
+				cell[m] = (int)lattice->at[index];
+				v[m] = lattice->points + (R_xlen_t)cell[m] * dim;
+			}
+			if (!lattice->centres && !lattice->single && !lattice->radii)
+				continue;
+			simplexCircumcentre(v, dim, centre, &radius);
+			for (j = 0; j < dim; j++)
+				if (lattice->single)
+					lattice->single[s + lattice->ncells * j] = (float)centre[j];
+				else if (lattice->centres)
+					lattice->centres[s + lattice->ncells * j] = centre[j];
+			if (lattice->radii)
+				lattice->radii[s] = radius;
+		}
+	}
+}
+
+/* The triangulation of the points p (pt_array holds them row-major, see
+   copyPoints()) with the components selected by want, if they form a
+   complete rectangular lattice in 2-D or 3-D, or R_NilValue if they do
+   not and qhull must be used. The result has the form of
+   delaunayResult()'s. */
+SEXP latticeDelaunay(const SEXP p, const double *pt_array, int want)
+{
+	latticeT lattice;
+	SEXP tri, neighbours, simplexNeighs, buffer, areas, point0;
+	SEXP circumcentres, circumradii, single, hullFacets, retlist;
+	R_xlen_t c, cells = 1, nh;
+	meshT mesh;
+	int *ids = NULL, j, k, m, nv, nsplit, nprotect = 0;
+
+	memset(&lattice, 0, sizeof(lattice));
+	lattice.dim = ncols(p);
+	lattice.n = nrows(p);
+	lattice.points = pt_array;
+	if (lattice.dim < 2 || lattice.dim > LATTICE_DIMmax || lattice.n > INT_MAX)
+		return (R_NilValue);
+	for (j = 0; j < lattice.dim; j++)
+		if (!latticeAxis(&lattice, j) || lattice.n % lattice.count[j])
+			return (R_NilValue);
+	lattice.at = (R_xlen_t *)R_alloc(lattice.n, sizeof(R_xlen_t));
+	if (!latticePositions(&lattice))
+		return (R_NilValue);
+
+	nv = lattice.dim + 1;
+	nsplit = (lattice.dim == 2) ? 2 : 6;
+	for (j = 0; j < lattice.dim; j++)
+		cells *= lattice.count[j] - 1;
+	lattice.ncells = cells * nsplit;
+	if (lattice.ncells * nv > INT_MAX)
+		return (R_NilValue);
+
+	/* Allocate the space in R for the requested components only, as
+	   delaunayResult() does */
+	tri = neighbours = simplexNeighs = areas = point0 = R_NilValue;
+	circumcentres = circumradii = single = hullFacets = R_NilValue;
+	lattice.cells = (int *)R_alloc(lattice.ncells * nv, sizeof(int));
+	if ((want & WANT_CIRCUMCENTRES) && (want & WANT_SINGLE))
+	{
+		PROTECT(single = newSingleBuffer(lattice.ncells * lattice.dim));
+		nprotect++;
+		lattice.single = singleBufferData(single);
+	}
+	else if (want & WANT_CIRCUMCENTRES)
+	{
+		PROTECT(circumcentres = allocMatrix(REALSXP, lattice.ncells, lattice.dim));
+		nprotect++;
+		lattice.centres = REAL(circumcentres);
+	}
+	if (want & WANT_CIRCUMRADII)
+	{
+		PROTECT(circumradii = allocVector(REALSXP, lattice.ncells));
+		nprotect++;
+		lattice.radii = REAL(circumradii);
+	}
+	parallelFor(cells, THREADS_GRAIN / nsplit, latticeChunk, &lattice);
+
+	PROTECT(tri = allocMatrix(INTSXP, lattice.ncells, nv));
+	nprotect++;
+	for (c = 0; c < lattice.ncells; c++)
+		for (k = 0; k < nv; k++)
+			INTEGER(tri)[c + lattice.ncells * k] = lattice.cells[c * nv + k];
+
+	/* Neighbours across the faces, and the faces with none, which make
+	   up the hull */
+	if (want & (WANT_NEIGHBOURS | WANT_HULLFACETS))
+	{
+		PROTECT(buffer = newNeighbourBuffer(lattice.ncells, nv));
+		nprotect++;
+		ids = neighbourBufferData(buffer);
+		mesh.dim = lattice.dim;
+		mesh.nv = nv;
+		mesh.npoints = lattice.n;
+		mesh.ncells = lattice.ncells;
+		mesh.points = pt_array;
+		mesh.cells = lattice.cells;
+		mesh.neighbours = NULL;
+		mesh.convex = True;
+		meshNeighbours(&mesh, ids);
+	}
+	if (want & WANT_NEIGHBOURS)
+	{
+		PROTECT(neighbours = lazyNeighbours(buffer, lattice.ncells, nv, False));
+		PROTECT(simplexNeighs = lazyNeighbours(buffer, lattice.ncells, nv, True));
+		nprotect += 2;
+	}
+	if (want & WANT_HULLFACETS)
+	{
+		nh = 0;
+		for (c = 0; c < lattice.ncells * nv; c++)
+			nh += (ids[c] == 0);
+		PROTECT(hullFacets = allocMatrix(INTSXP, nh, lattice.dim));
+		nprotect++;
+		nh = 0;
+		for (c = 0; c < lattice.ncells; c++)
+			for (k = 0; k < nv; k++)
+				if (ids[c * nv + k] == 0)
+				{
+					j = 0;
+					for (m = 0; m < nv; m++)
+						if (m != k)
+							INTEGER(hullFacets)[nh + nrows(hullFacets) * j++] = lattice.cells[c * nv + m];
+					nh++;
+				}
+	}
+	if (single != R_NilValue)
+	{
+		PROTECT(circumcentres = lazySingle(single, lattice.ncells, lattice.dim));
+		nprotect++;
+	}
+	if (want & WANT_AREAS)
+	{
+		PROTECT(areas = lazySimplexVolumes(p, tri));
+		nprotect++;
+	}
+	if (want & WANT_SIMPLICES)
+	{
+		PROTECT(point0 = lazySimplexPoints(p, tri));
+		nprotect++;
+	}
+
+	retlist = delaunayList(tri, neighbours, areas, point0, simplexNeighs,
+						   circumcentres, circumradii, hullFacets);
+	UNPROTECT(nprotect);
+	return (retlist);
+}
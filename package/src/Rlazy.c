@@ -0,0 +1,448 @@
+/* Copyright (C) 2018
+
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+*/
+#include "RcompGeomete.h"
+#include <Rversion.h>
+#include <R_ext/Rdynload.h>
+#include <R_ext/Altrep.h>
+
+/* Lazily evaluated result components.
+
+   Some components returned by C_delaunayn() and C_voronoiR() are as
+   large as the triangulation itself but rarely used. They are returned
+   as ALTREP vectors that hold only what is needed to produce them: the
+   input points and the triangulation, a native buffer of neighbour
+   ids, or a native buffer of coordinates kept in single precision. Elements are computed when they are read, and the full vector
+   is allocated in R memory only when something asks for its data
+   pointer, for example C code or an in-place modification.
+
+   data1 of each vector is list(info, source, ...) where info holds the
+   kind of the vector and its rows and columns; data2 is the
+   materialised vector, or R_NilValue until then. */
+
+#define LAZY_VERTEXcoords 1 /* first coordinate of every simplex vertex */
+#define LAZY_FIRSTvertex 2	/* coordinates of the first vertex of each simplex */
+#define LAZY_VOLUME 3		/* volume of each simplex */
+#define LAZY_NEIGHBOURS 4	/* neighbour ids of each simplex, as qhull gives them */
+#define LAZY_POSITIVE 5		/* neighbouring simplices of each simplex */
+#define LAZY_SINGLE 6		/* coordinates stored as floats */
+
+static R_altrep_class_t lazyRealClass;
+#if R_VERSION >= R_Version(4, 3, 0)
+#define LAZY_LISTS
+static R_altrep_class_t lazyListClass;
+#endif
+
+static int lazyKind(SEXP x)
+{
+	return INTEGER(VECTOR_ELT(R_altrep_data1(x), 0))[0];
+}
+
+static R_xlen_t lazyLength(SEXP x)
+{
+	int *info = INTEGER(VECTOR_ELT(R_altrep_data1(x), 0));
+	return ((R_xlen_t)info[1] * info[2]);
+}
+
+static Rboolean lazyInspect(SEXP x, int pre, int deep, int pvec,
+							void (*inspect_subtree)(SEXP, int, int, int))
+{
+	Rprintf(" compGeometeR lazy vector (kind %d, %s)\n", lazyKind(x),
+			R_altrep_data2(x) == R_NilValue ? "not materialised" : "materialised");
+	return TRUE;
+}
+
+/* ------------------------------------------------------------------ */
+/* Real vectors computed from the input points and the triangulation  */
+
+/* What a lazy real vector is computed from, read on the main thread so
+   that the values can be computed on the threads of the pool */
+typedef struct
+{
+	int kind, nrow, dim;
+	const double *points;
+	const int *cells;
+	const float *single;
+	R_xlen_t n, nf;
+	double *values; /* filled by lazyRealChunk() */
+} lazyRealT;
+
+static void lazyRealSource(SEXP x, lazyRealT *src)
+{
+	SEXP data = R_altrep_data1(x);
+	int *info = INTEGER(VECTOR_ELT(data, 0));
+	SEXP p = VECTOR_ELT(data, 1), tri = VECTOR_ELT(data, 2);
+
+	src->kind = info[0];
+	src->nrow = info[1];
+	src->values = NULL;
+	if (src->kind == LAZY_SINGLE)
+	{
+		src->single = (const float *)R_ExternalPtrAddr(p);
+		return;
+	}
+	src->points = REAL(p);
+	src->cells = INTEGER(tri);
+	src->n = nrows(p);
+	src->nf = nrows(tri);
+	src->dim = ncols(p);
+}
+
+static double lazyRealValue(const lazyRealT *src, R_xlen_t i)
+{
+	const double *points = src->points;
+	const int *cells = src->cells;
+	R_xlen_t n = src->n, nf = src->nf;
+	R_xlen_t row = i % src->nrow, col = i / src->nrow;
+	int dim = src->dim, id, j, k;
+
+	switch (src->kind)
+	{
+	case LAZY_SINGLE:
+		return ((double)src->single[i]);
+	case LAZY_VERTEXcoords:
+		id = cells[i];
+		return ((id < 0 || id >= n) ? NA_REAL : points[id]);
+	case LAZY_FIRSTvertex:
+		id = cells[row];
+		return ((id < 0 || id >= n) ? NA_REAL : points[id + n * col]);
+	case LAZY_VOLUME:
+	{
+		/* |det(v[k] - v[0])| / dim!, the area qhull gives a Delaunay
+		   facet projected back to the input space */
+		double a[MESH_DIMmax * MESH_DIMmax], volume;
+		int first = cells[row];
+		if (dim > MESH_DIMmax || first < 0 || first >= n)
+			return (NA_REAL);
+		for (k = 1; k <= dim; k++)
+		{
+			id = cells[row + nf * k];
+			if (id < 0 || id >= n)
+				return (NA_REAL);
+			for (j = 0; j < dim; j++)
+				a[(k - 1) * dim + j] = points[id + n * j] - points[first + n * j];
+		}
+		volume = fabs(determinant(a, dim));
+		for (k = 2; k <= dim; k++)
+			volume /= k;
+		return (volume);
+	}
+	}
+	return (NA_REAL);
+}
+
+static double lazyRealCompute(SEXP x, R_xlen_t i)
+{
+	lazyRealT src;
+	lazyRealSource(x, &src);
+	return (lazyRealValue(&src, i));
+}
+
+static void lazyRealChunk(void *ctx, R_xlen_t begin, R_xlen_t end)
+{
+	lazyRealT *src = (lazyRealT *)ctx;
+	R_xlen_t i;
+	for (i = begin; i < end; i++)
+		src->values[i] = lazyRealValue(src, i);
+}
+
+static SEXP lazyRealMaterialise(SEXP x)
+{
+	SEXP values = R_altrep_data2(x);
+	if (values == R_NilValue)
+	{
+		lazyRealT src;
+		PROTECT(values = allocVector(REALSXP, lazyLength(x)));
+		lazyRealSource(x, &src);
+		src.values = REAL(values);
+		parallelFor(XLENGTH(values), THREADS_GRAIN, lazyRealChunk, &src);
+		R_set_altrep_data2(x, values);
+		UNPROTECT(1);
+	}
+	return (values);
+}
+
+static void *lazyRealDataptr(SEXP x, Rboolean writeable)
+{
+	return (REAL(lazyRealMaterialise(x)));
+}
+
+static const void *lazyRealDataptrOrNull(SEXP x)
+{
+	SEXP values = R_altrep_data2(x);
+	return (values == R_NilValue ? NULL : REAL(values));
+}
+
+static double lazyRealElt(SEXP x, R_xlen_t i)
+{
+	SEXP values = R_altrep_data2(x);
+	return (values == R_NilValue ? lazyRealCompute(x, i) : REAL(values)[i]);
+}
+
+static R_xlen_t lazyRealGetRegion(SEXP x, R_xlen_t start, R_xlen_t size, double *buf)
+{
+	R_xlen_t i, len = lazyLength(x);
+	if (start + size > len)
+		size = len - start;
+	for (i = 0; i < size; i++)
+		buf[i] = lazyRealElt(x, start + i);
+	return (size);
+}
+
+static SEXP newLazyReal(int kind, SEXP p, SEXP tri, int nrow, int ncol)
+{
+	SEXP data, info, x;
+
+	/* The vector reads tri and p whenever it is accessed */
+	if (kind != LAZY_SINGLE)
+	{
+		MARK_NOT_MUTABLE(p);
+		MARK_NOT_MUTABLE(tri);
+	}
+	PROTECT(data = allocVector(VECSXP, 3));
+	PROTECT(info = allocVector(INTSXP, 3));
+	INTEGER(info)[0] = kind;
+	INTEGER(info)[1] = nrow;
+	INTEGER(info)[2] = ncol;
+	SET_VECTOR_ELT(data, 0, info);
+	SET_VECTOR_ELT(data, 1, p);
+	SET_VECTOR_ELT(data, 2, tri);
+	PROTECT(x = R_new_altrep(lazyRealClass, data, R_NilValue));
+	if (kind != LAZY_VOLUME)
+	{
+		SEXP dims = allocVector(INTSXP, 2);
+		INTEGER(dims)[0] = nrow;
+		INTEGER(dims)[1] = ncol;
+		setAttrib(x, R_DimSymbol, dims);
+	}
+	UNPROTECT(3);
+	return (x);
+}
+
+/* The nf-by-(d+1) matrix of the first coordinate of each vertex of each
+   simplex of the 0-based triangulation tri */
+SEXP lazySimplexPoints(SEXP p, SEXP tri)
+{
+	return (newLazyReal(LAZY_VERTEXcoords, p, tri, nrows(tri), ncols(tri)));
+}
+
+/* The nf-by-d matrix of the coordinates of the first vertex of each
+   simplex of the 0-based triangulation tri */
+SEXP lazyFirstVertices(SEXP p, SEXP tri)
+{
+	return (newLazyReal(LAZY_FIRSTvertex, p, tri, nrows(tri), ncols(p)));
+}
+
+/* The volume (area in 2D) of each simplex of the 0-based triangulation */
+SEXP lazySimplexVolumes(SEXP p, SEXP tri)
+{
+	return (newLazyReal(LAZY_VOLUME, p, tri, nrows(tri), 1));
+}
+
+/* ------------------------------------------------------------------ */
+/* Coordinates held in single precision                               */
+
+static void nativeBufferFinalizer(SEXP buffer)
+{
+	free(R_ExternalPtrAddr(buffer));
+	R_ClearExternalPtr(buffer);
+}
+
+/* An external pointer to a native array of n floats, see lazySingle() */
+SEXP newSingleBuffer(R_xlen_t n)
+{
+	SEXP buffer;
+	float *data = (float *)malloc((n + 1) * sizeof(float));
+	if (!data)
+		error("Unable to allocate memory for %ld coordinates", (long)n);
+	PROTECT(buffer = R_MakeExternalPtr(data, R_NilValue, R_NilValue));
+	R_RegisterCFinalizerEx(buffer, nativeBufferFinalizer, TRUE);
+	UNPROTECT(1);
+	return (buffer);
+}
+
+float *singleBufferData(SEXP buffer)
+{
+	return ((float *)R_ExternalPtrAddr(buffer));
+}
+
+/* The nrow-by-ncol double matrix of the floats in buffer, which take
+   half the memory of the matrix until it is materialised */
+SEXP lazySingle(SEXP buffer, int nrow, int ncol)
+{
+	return (newLazyReal(LAZY_SINGLE, buffer, R_NilValue, nrow, ncol));
+}
+
+/* ------------------------------------------------------------------ */
+/* Lists of neighbours held in a native buffer                        */
+
+/* An external pointer to a native array of ncells * nv ints, freed when
+   the last vector referring to it is garbage collected */
+SEXP newNeighbourBuffer(R_xlen_t ncells, int nv)
+{
+	SEXP buffer;
+	int *data = (int *)calloc(ncells * nv + 1, sizeof(int));
+	if (!data)
+		error("Unable to allocate memory for the neighbours of %ld simplices", (long)ncells);
+	PROTECT(buffer = R_MakeExternalPtr(data, R_NilValue, R_NilValue));
+	R_RegisterCFinalizerEx(buffer, nativeBufferFinalizer, TRUE);
+	UNPROTECT(1);
+	return (buffer);
+}
+
+int *neighbourBufferData(SEXP buffer)
+{
+	return ((int *)R_ExternalPtrAddr(buffer));
+}
+
+/* Neighbours of cell i: every stored id, or only the positive ones (the
+   1-based indices of neighbouring simplices) */
+static SEXP neighbourElt(const int *data, int nv, R_xlen_t i, boolT positive)
+{
+	SEXP neighbour;
+	int k, len = 0;
+	const int *ids = data + i * nv;
+
+	for (k = 0; k < nv; k++)
+		if (!positive || ids[k] > 0)
+			len++;
+	neighbour = allocVector(INTSXP, len);
+	for (k = 0, len = 0; k < nv; k++)
+		if (!positive || ids[k] > 0)
+			INTEGER(neighbour)[len++] = ids[k];
+	return (neighbour);
+}
+
+#ifdef LAZY_LISTS
+static SEXP lazyListCompute(SEXP x, R_xlen_t i)
+{
+	SEXP data = R_altrep_data1(x);
+	int *info = INTEGER(VECTOR_ELT(data, 0));
+	return (neighbourElt(neighbourBufferData(VECTOR_ELT(data, 1)), info[2], i,
+						 info[0] == LAZY_POSITIVE));
+}
+
+/* Elements are kept once computed, so that a list element read twice is
+   the same object */
+static SEXP lazyListValues(SEXP x)
+{
+	SEXP values = R_altrep_data2(x);
+	if (values == R_NilValue)
+	{
+		PROTECT(values = allocVector(VECSXP, lazyLength(x)));
+		R_set_altrep_data2(x, values);
+		UNPROTECT(1);
+	}
+	return (values);
+}
+
+static SEXP lazyListElt(SEXP x, R_xlen_t i)
+{
+	SEXP values = lazyListValues(x), elt = VECTOR_ELT(values, i);
+	if (elt == R_NilValue)
+	{
+		PROTECT(elt = lazyListCompute(x, i));
+		SET_VECTOR_ELT(values, i, elt);
+		UNPROTECT(1);
+	}
+	return (elt);
+}
+
+static SEXP lazyListMaterialise(SEXP x)
+{
+	R_xlen_t i, len = lazyLength(x);
+	for (i = 0; i < len; i++)
+		lazyListElt(x, i);
+	return (R_altrep_data2(x));
+}
+
+static void lazyListSetElt(SEXP x, R_xlen_t i, SEXP v)
+{
+	SET_VECTOR_ELT(lazyListMaterialise(x), i, v);
+}
+
+static void *lazyListDataptr(SEXP x, Rboolean writeable)
+{
+	return ((void *)DATAPTR_RO(lazyListMaterialise(x)));
+}
+
+static const void *lazyListDataptrOrNull(SEXP x)
+{
+	return (NULL);
+}
+#endif
+
+/* The list of the neighbours of each of ncells simplices, nv per simplex
+   in buffer (see newNeighbourBuffer()). With positive, only neighbouring
+   simplices are listed, otherwise every id qhull gave. */
+SEXP lazyNeighbours(SEXP buffer, R_xlen_t ncells, int nv, boolT positive)
+{
+	SEXP x;
+#ifdef LAZY_LISTS
+	SEXP data, info;
+	PROTECT(data = allocVector(VECSXP, 2));
+	PROTECT(info = allocVector(INTSXP, 3));
+	INTEGER(info)[0] = positive ? LAZY_POSITIVE : LAZY_NEIGHBOURS;
+	INTEGER(info)[1] = (int)ncells;
+	INTEGER(info)[2] = nv;
+	SET_VECTOR_ELT(data, 0, info);
+	SET_VECTOR_ELT(data, 1, buffer);
+	x = R_new_altrep(lazyListClass, data, R_NilValue);
+	UNPROTECT(2);
+#else
+	/* Lists cannot be ALTREP before R 4.3.0 */
+	R_xlen_t i;
+	const int *data = neighbourBufferData(buffer);
+	PROTECT(x = allocVector(VECSXP, ncells));
+	for (i = 0; i < ncells; i++)
+		SET_VECTOR_ELT(x, i, neighbourElt(data, nv, i, positive));
+	UNPROTECT(1);
+#endif
+	return (x);
+}
+
+/* Approximate memory held by x, without materialising it */
+size_t lazyBytes(SEXP x)
+{
+	SEXP values = R_altrep_data2(x);
+	if (values != R_NilValue)
+		return ((size_t)XLENGTH(values) * (TYPEOF(x) == REALSXP ? sizeof(double) : sizeof(SEXP)));
+	/* Only the single precision buffers are native memory of their own */
+	if (TYPEOF(x) == REALSXP && TYPEOF(R_altrep_data1(x)) == VECSXP && lazyKind(x) == LAZY_SINGLE)
+		return ((size_t)lazyLength(x) * sizeof(float));
+	return (0);
+}
+
+void registerLazyClasses(DllInfo *dll)
+{
+	lazyRealClass = R_make_altreal_class("lazy_real", "compGeometeR", dll);
+	R_set_altrep_Length_method(lazyRealClass, lazyLength);
+	R_set_altrep_Inspect_method(lazyRealClass, lazyInspect);
+	R_set_altvec_Dataptr_method(lazyRealClass, lazyRealDataptr);
+	R_set_altvec_Dataptr_or_null_method(lazyRealClass, lazyRealDataptrOrNull);
+	R_set_altreal_Elt_method(lazyRealClass, lazyRealElt);
+	R_set_altreal_Get_region_method(lazyRealClass, lazyRealGetRegion);
+
+#ifdef LAZY_LISTS
+	lazyListClass = R_make_altlist_class("lazy_list", "compGeometeR", dll);
+	R_set_altrep_Length_method(lazyListClass, lazyLength);
+	R_set_altrep_Inspect_method(lazyListClass, lazyInspect);
+	R_set_altvec_Dataptr_method(lazyListClass, lazyListDataptr);
+	R_set_altvec_Dataptr_or_null_method(lazyListClass, lazyListDataptrOrNull);
+	R_set_altlist_Elt_method(lazyListClass, lazyListElt);
+	R_set_altlist_Set_elt_method(lazyListClass, lazyListSetElt);
+#endif
+}
@@ -0,0 +1,192 @@
+/* Copyright (C) 2018
+
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+*/
+#include "RcompGeomete.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Small dense linear programs, solved by the two-phase simplex method
+   on a full tableau with Bland's rule, which cannot cycle on the
+   degenerate programs that points in general position give. Meant for
+   programs with a few rows, one per dimension, and up to some thousands
+   of columns. No R API is used, so programs may be solved on the
+   threads of the pool. */
+
+typedef struct
+{
+	int m, n;	  /* rows, and columns before the m artificial ones */
+	int width;	  /* n + m columns and the right-hand side */
+	double *t;	  /* (m + 1) x width, the last row the reduced costs */
+	int *basis;	  /* column basic in each row */
+} tableauT;
+
+#define T(tab, i, j) ((tab)->t[(size_t)(i) * (tab)->width + (j)])
+
+static void pivot(tableauT *tab, int row, int col)
+{
+	int i, j, rhs = tab->width - 1;
+	double factor, p = T(tab, row, col);
+
+	for (j = 0; j <= rhs; j++)
+		T(tab, row, j) /= p;
+	for (i = 0; i <= tab->m; i++)
+	{
+		if (i == row || T(tab, i, col) == 0)
+			continue;
+		factor = T(tab, i, col);
+		for (j = 0; j <= rhs; j++)
+			T(tab, i, j) -= factor * T(tab, row, j);
+		T(tab, i, col) = 0;
+	}
+	tab->basis[row] = col;
+}
+
+/* Minimise the costs in the last row of the tableau, letting only
+   columns below ncols enter. Returns LP_OPTIMAL or LP_UNBOUNDED. */
+static int simplex(tableauT *tab, int ncols)
+{
+	int i, j, row, col, iter, rhs = tab->width - 1;
+	int maxiter = 50 * (tab->m + tab->n) + 1000;
+	double ratio, best;
+
+	for (iter = 0; iter < maxiter; iter++)
+	{
+		/* Bland's rule: the first column that improves the objective */
+		col = -1;
+		for (j = 0; j < ncols; j++)
+			if (T(tab, tab->m, j) < -LP_EPSILON)
+			{
+				col = j;
+				break;
+			}
+		if (col < 0)
+			return (LP_OPTIMAL);
+		row = -1;
+		best = 0;
+		for (i = 0; i < tab->m; i++)
+			if (T(tab, i, col) > LP_EPSILON)
+			{
+				ratio = T(tab, i, rhs) / T(tab, i, col);
+				if (row < 0 || ratio < best - LP_EPSILON ||
+					(ratio <= best + LP_EPSILON && tab->basis[i] < tab->basis[row]))
+				{
+					row = i;
+					best = ratio;
+				}
+			}
+		if (row < 0)
+			return (LP_UNBOUNDED);
+		pivot(tab, row, col);
+	}
+	return (LP_OPTIMAL);
+}
+
+/* Minimise c x subject to A x = b and x >= 0, where A is m-by-n
+   (row-major) and b >= 0. c may be NULL to only find a feasible x.
+   Returns LP_OPTIMAL with x (n) and the duals y (m) of the constraints,
+   which satisfy y A <= c; LP_INFEASIBLE with y a certificate that
+   y A <= 0 and y b > 0; LP_UNBOUNDED; or LP_ERROR if out of memory. The
+   optimal or, if infeasible, the least infeasibility is put in
+   *value. */
+int lpSolve(const double *A, const double *b, const double *c, int m, int n,
+			double *x, double *y, double *value)
+{
+	tableauT tab;
+	int i, j, k, status, rhs;
+	double phase1;
+
+	tab.m = m;
+	tab.n = n;
+	tab.width = n + m + 1;
+	rhs = tab.width - 1;
+	tab.t = (double *)calloc((size_t)(m + 1) * tab.width, sizeof(double));
+	tab.basis = (int *)malloc(m * sizeof(int));
+	if (!tab.t || !tab.basis)
+	{
+		free(tab.t);
+		free(tab.basis);
+		return (LP_ERROR);
+	}
+
+	/* Phase one: minimise the sum of the artificial variables, starting
+	   from the basis they form */
+	for (i = 0; i < m; i++)
+	{
+		for (j = 0; j < n; j++)
+		{
+			T(&tab, i, j) = A[(size_t)i * n + j];
+			T(&tab, m, j) -= A[(size_t)i * n + j];
+		}
+		T(&tab, i, n + i) = 1;
+		T(&tab, i, rhs) = b[i];
+		T(&tab, m, rhs) -= b[i];
+		tab.basis[i] = n + i;
+	}
+	simplex(&tab, n);
+	phase1 = -T(&tab, m, rhs);
+	if (phase1 > LP_EPSILON)
+	{
+		/* The artificial columns hold 1 - y */
+		if (y)
+			for (i = 0; i < m; i++)
+				y[i] = 1 - T(&tab, m, n + i);
+		*value = phase1;
+		free(tab.t);
+		free(tab.basis);
+		return (LP_INFEASIBLE);
+	}
+
+	/* Drive out the artificial variables left in the basis at zero,
+	   where another column can replace them */
+	for (i = 0; i < m; i++)
+		if (tab.basis[i] >= n)
+			for (j = 0; j < n; j++)
+				if (fabs(T(&tab, i, j)) > LP_EPSILON)
+				{
+					pivot(&tab, i, j);
+					break;
+				}
+
+	/* Phase two: the reduced costs of c in the final basis */
+	for (j = 0; j <= rhs; j++)
+		T(&tab, m, j) = (c && j < n) ? c[j] : 0;
+	for (i = 0; i < m; i++)
+	{
+		k = tab.basis[i];
+		double cost = (c && k < n) ? c[k] : 0;
+		if (cost != 0)
+			for (j = 0; j <= rhs; j++)
+				T(&tab, m, j) -= cost * T(&tab, i, j);
+	}
+	status = simplex(&tab, n);
+
+	if (x)
+	{
+		memset(x, 0, n * sizeof(double));
+		for (i = 0; i < m; i++)
+			if (tab.basis[i] < n)
+				x[tab.basis[i]] = T(&tab, i, rhs);
+	}
+	/* The artificial columns, of cost 0, hold -y */
+	if (y)
+		for (i = 0; i < m; i++)
+			y[i] = -T(&tab, m, n + i);
+	*value = -T(&tab, m, rhs);
+	free(tab.t);
+	free(tab.basis);
+	return (status);
+}
@@ -0,0 +1,423 @@
+/* Copyright (C) 2018
+
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+*/
+#include "RcompGeomete.h"
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* An index of sites for finding the nearest sites of query points, that
+   is the Voronoi cells they lie in, held by an external pointer so that
+   it is built once and queried many times.
+
+   The sites are kept in an implicit kd-tree: the range of sites below a
+   node is split at its median along the dimension of greatest extent,
+   and the median site is stored between the two halves, down to buckets
+   of a few sites that are scanned. Ties in distance go to the lower
+   site id, so that the answer does not depend on the search.
+
+   If the index is built from a Delaunay triangulation, the search for
+   the nearest site is seeded by walking its edges from the nearest site
+   of the previous query, moving to whichever neighbour is nearest until
+   none is nearer. A site that is not the nearest always has a nearer
+   Delaunay neighbour, so the walk ends at the nearest site, and for
+   coherent queries such as a grid it takes a step or two; the search of
+   the tree that follows then only visits the buckets that may hold a
+   site as near, which settles ties and any sites missing from the
+   triangulation. */
+
+#define NEAREST_BUCKET 8
+
+typedef struct
+{
+	int dim;
+	R_xlen_t n;
+	double *points;		/* n x dim, row-major, in tree order */
+	int *ids;			/* the 0-based site at each place in tree order */
+	unsigned char *split; /* the dimension split at each median */
+	R_xlen_t *place;	/* the place in tree order of each site */
+	R_xlen_t *offsets;	/* the Delaunay edges of the sites, see meshEdges(), */
+	int *adjacent;		/* or NULL */
+} siteIndexT;
+
+typedef struct
+{
+	const siteIndexT *index;
+	const double *x; /* n x dim, column-major as in R */
+	R_xlen_t n;
+	int k;
+	int *sites; /* n x k, column-major, 0-based or -1 */
+	double *distances;
+} nearestT;
+
+static void freeSiteIndex(siteIndexT *index)
+{
+	free(index->points);
+	free(index->ids);
+	free(index->split);
+	free(index->place);
+	free(index->offsets);
+	free(index->adjacent);
+	free(index);
+}
+
+static void siteIndexFinalizer(SEXP ptr)
+{
+	siteIndexT *index = R_ExternalPtrAddr(ptr);
+	if (!index)
+		return;
+	freeSiteIndex(index);
+	R_ClearExternalPtr(ptr);
+}
+
+static siteIndexT *siteIndex(SEXP ptr)
+{
+	siteIndexT *index;
+	if (TYPEOF(ptr) != EXTPTRSXP || !(index = R_ExternalPtrAddr(ptr)))
+		error("The site index is no longer valid; rebuild it with site_index().");
+	return index;
+}
+
+/* Partially sort ids[lo..hi-1] by coordinate j of the sites in
+   pt_array so that ids[mid] is their median, by Wirth's selection */
+static void selectMedian(const double *pt_array, int dim, int *ids, R_xlen_t lo, R_xlen_t hi,
+						 R_xlen_t mid, int j)
+{
+	R_xlen_t a, b, l = lo, r = hi - 1;
+	double pivot;
+	int swap;
+
+	while (l < r)
+	{
+		pivot = pt_array[(R_xlen_t)ids[mid] * dim + j];
+		a = l;
+		b = r;
+		do
+		{
+			while (pt_array[(R_xlen_t)ids[a] * dim + j] < pivot)
+				a++;
+			while (pivot < pt_array[(R_xlen_t)ids[b] * dim + j])
+				b--;
+			if (a <= b)
+			{
+				swap = ids[a];
+				ids[a++] = ids[b];
+				ids[b--] = swap;
+			}
+		} while (a <= b);
+		if (b < mid)
+			l = a;
+		if (mid < a)
+			r = b;
+	}
+}
+
+static void buildTree(siteIndexT *index, const double *pt_array, R_xlen_t lo, R_xlen_t hi)
+{
+	R_xlen_t i, mid;
+	double lo_j, hi_j, extent, widest = -1;
+	int j, best = 0, dim = index->dim;
+
+	while (hi - lo > NEAREST_BUCKET)
+	{
+		for (j = 0; j < dim; j++)
+		{
+			lo_j = hi_j = pt_array[(R_xlen_t)index->ids[lo] * dim + j];
+			for (i = lo + 1; i < hi; i++)
+			{
+				lo_j = fmin(lo_j, pt_array[(R_xlen_t)index->ids[i] * dim + j]);
+				hi_j = fmax(hi_j, pt_array[(R_xlen_t)index->ids[i] * dim + j]);
+			}
+			extent = hi_j - lo_j;
+			if (extent > widest)
+			{
+				widest = extent;
+				best = j;
+			}
+		}
+		mid = lo + (hi - lo) / 2;
+		selectMedian(pt_array, dim, index->ids, lo, hi, mid, best);
+		index->split[mid] = (unsigned char)best;
+		buildTree(index, pt_array, lo, mid);
+		lo = mid + 1;
+		widest = -1;
+	}
+}
+
+static double distance2(const double *a, const double *b, int dim)
+{
+	double d2 = 0, diff;
+	int j;
+	for (j = 0; j < dim; j++)
+	{
+		diff = a[j] - b[j];
+		d2 += diff * diff;
+	}
+	return (d2);
+}
+
+/* Offer site id at squared distance d2 to the k nearest found so far,
+   kept in order of distance and then of id */
+static void offerSite(int k, int *count, int *best, double *bestd2, int id, double d2)
+{
+	int i;
+	if (*count == k && (d2 > bestd2[k - 1] || (d2 == bestd2[k - 1] && id > best[k - 1])))
+		return;
+	i = (*count < k) ? (*count)++ : k - 1;
+	for (; i > 0 && (bestd2[i - 1] > d2 || (bestd2[i - 1] == d2 && best[i - 1] > id)); i--)
+	{
+		best[i] = best[i - 1];
+		bestd2[i] = bestd2[i - 1];
+	}
+	best[i] = id;
+	bestd2[i] = d2;
+}
+
+static void searchTree(const siteIndexT *index, const double *x, R_xlen_t lo, R_xlen_t hi, int k,
+					   int *count, int *best, double *bestd2)
+{
+	R_xlen_t i, mid;
+	double diff;
+	int dim = index->dim;
+
+	while (hi - lo > NEAREST_BUCKET)
+	{
+		mid = lo + (hi - lo) / 2;
+		offerSite(k, count, best, bestd2, index->ids[mid], distance2(x, index->points + mid * dim, dim));
+		diff = x[index->split[mid]] - index->points[mid * dim + index->split[mid]];
+		/* The nearer half first, then the further one if it may hold a
+		   site as near as the kth, as the search of the nearer half
+		   tightens the bound */
+		if (diff < 0)
+		{
+			searchTree(index, x, lo, mid, k, count, best, bestd2);
+			if (*count == k && diff * diff > bestd2[k - 1])
+				return;
+			lo = mid + 1;
+		}
+		else
+		{
+			searchTree(index, x, mid + 1, hi, k, count, best, bestd2);
+			if (*count == k && diff * diff > bestd2[k - 1])
+				return;
+			hi = mid;
+		}
+	}
+	for (i = lo; i < hi; i++)
+		offerSite(k, count, best, bestd2, index->ids[i], distance2(x, index->points + i * dim, dim));
+}
+
+/* The nearest site to x by a walk along the Delaunay edges from site */
+static int walkSites(const siteIndexT *index, const double *x, int site, double *d2)
+{
+	const double *p;
+	double nearest, d;
+	int next, t, dim = index->dim;
+	R_xlen_t e;
+
+	nearest = distance2(x, index->points + index->place[site] * dim, dim);
+	for (;;)
+	{
+		next = site;
+		for (e = index->offsets[site]; e < index->offsets[site + 1]; e++)
+		{
+			t = index->adjacent[e];
+			p = index->points + index->place[t] * dim;
+			d = distance2(x, p, dim);
+			if (d < nearest || (d == nearest && t < next))
+			{
+				nearest = d;
+				next = t;
+			}
+		}
+		if (next == site)
+			break;
+		site = next;
+	}
+	*d2 = nearest;
+	return (site);
+}
+
+static void nearestChunk(void *ctx, R_xlen_t begin, R_xlen_t end)
+{
+	const nearestT *task = (const nearestT *)ctx;
+	const siteIndexT *index = task->index;
+	double x[MESH_DIMmax], *bestd2;
+	int *best, count, k = task->k, j, previous = -1;
+	boolT missing;
+	R_xlen_t i;
+
+	best = (int *)malloc(k * sizeof(int));
+	bestd2 = (double *)malloc(k * sizeof(double));
+	for (i = begin; i < end; i++)
+	{
+		missing = !best || !bestd2;
+		for (j = 0; j < index->dim; j++)
+		{
+			x[j] = task->x[i + task->n * j];
+			missing |= ISNAN(x[j]);
+		}
+		count = 0;
+		if (missing)
+			;
+		else
+		{
+			if (k == 1 && index->adjacent && previous >= 0)
+			{
+				best[0] = walkSites(index, x, previous, bestd2);
+				count = 1;
+			}
+			searchTree(index, x, 0, index->n, k, &count, best, bestd2);
+		}
+		if (count)
+			previous = best[0];
+		for (j = 0; j < k; j++)
+		{
+			task->sites[i + task->n * j] = (j < count) ? best[j] : -1;
+			task->distances[i + task->n * j] = (j < count) ? sqrt(bestd2[j]) : 0;
+		}
+	}
+	free(best);
+	free(bestd2);
+}
+
+/* Build the index of the sites p. If simplices is not NULL, the sites
+   are the points of the Delaunay triangulation with these simplices
+   (see meshCellsFromMatrices()), and queries for the nearest site walk along
+   its edges. */
+SEXP C_siteIndex(const SEXP p, const SEXP simplices)
+{
+	siteIndexT *index;
+	meshT mesh;
+	double *pt_array;
+	boolT ismalloc, walk;
+	R_xlen_t i;
+	SEXP ptr, result, names;
+
+	if (!isMatrix(p) || !isReal(p))
+		error("points must be a real matrix");
+	if (ncols(p) < 1 || ncols(p) > MESH_DIMmax)
+		error("at most %d dimensions are supported", MESH_DIMmax);
+	if (nrows(p) >= INT_MAX)
+		error("too many sites");
+	index = (siteIndexT *)calloc(1, sizeof(siteIndexT));
+	if (!index)
+		error("Unable to allocate memory for the site index");
+	index->dim = ncols(p);
+	index->n = nrows(p);
+	index->points = (double *)malloc((index->n ? index->n : 1) * index->dim * sizeof(double));
+	index->ids = (int *)malloc((index->n ? index->n : 1) * sizeof(int));
+	index->split = (unsigned char *)calloc(index->n ? index->n : 1, 1);
+	index->place = (R_xlen_t *)malloc((index->n ? index->n : 1) * sizeof(R_xlen_t));
+	if (!index->points || !index->ids || !index->split || !index->place)
+	{
+		freeSiteIndex(index);
+		error("Unable to allocate memory for the site index");
+	}
+	/* The external pointer frees the index if anything below fails */
+	PROTECT(ptr = R_MakeExternalPtr(index, install("site_index"), R_NilValue));
+	R_RegisterCFinalizerEx(ptr, siteIndexFinalizer, TRUE);
+
+	pt_array = copyPoints(p, &ismalloc);
+	for (i = 0; i < index->n; i++)
+		index->ids[i] = (int)i;
+	buildTree(index, pt_array, 0, index->n);
+	for (i = 0; i < index->n; i++)
+	{
+		memcpy(index->points + i * index->dim, pt_array + (R_xlen_t)index->ids[i] * index->dim,
+			   index->dim * sizeof(double));
+		index->place[index->ids[i]] = i;
+	}
+	freePoints(p, pt_array);
+
+	walk = False;
+	if (!isNull(simplices))
+	{
+		meshCellsFromMatrices(p, simplices, True, &mesh);
+		index->offsets = (R_xlen_t *)malloc((index->n + 1) * sizeof(R_xlen_t));
+		if (!index->offsets || !meshEdges(&mesh, index->offsets, &index->adjacent))
+			error("Unable to allocate memory for the edges of the triangulation");
+		walk = mesh.ncells > 0;
+		if (!walk)
+		{
+			free(index->offsets);
+			free(index->adjacent);
+			index->offsets = NULL;
+			index->adjacent = NULL;
+		}
+	}
+
+	PROTECT(result = allocVector(VECSXP, 4));
+	PROTECT(names = allocVector(STRSXP, 4));
+	SET_VECTOR_ELT(result, 0, ptr);
+	SET_STRING_ELT(names, 0, mkChar("pointer"));
+	SET_VECTOR_ELT(result, 1, ScalarInteger(index->dim));
+	SET_STRING_ELT(names, 1, mkChar("dim"));
+	SET_VECTOR_ELT(result, 2, ScalarReal((double)index->n));
+	SET_STRING_ELT(names, 2, mkChar("n_points"));
+	SET_VECTOR_ELT(result, 3, ScalarLogical(walk));
+	SET_STRING_ELT(names, 3, mkChar("walk"));
+	setAttrib(result, R_NamesSymbol, names);
+	UNPROTECT(3);
+	return (result);
+}
+
+/* The k nearest sites of each test point, nearest first, as 1-based
+   site ids and distances in n-by-k matrices, NA where a test point has
+   an NA coordinate or there are fewer than k sites */
+SEXP C_nearestSites(const SEXP ptr, const SEXP testPoints, const SEXP k)
+{
+	nearestT task;
+	SEXP result, names, sites, distances;
+	R_xlen_t i;
+
+	task.index = siteIndex(ptr);
+	if (!isMatrix(testPoints) || !isReal(testPoints) || ncols(testPoints) != task.index->dim)
+		error("test_points must have the same dimensions as the sites");
+	task.k = asInteger(k);
+	if (task.k < 1)
+		error("k must be at least 1");
+	task.x = REAL(testPoints);
+	task.n = nrows(testPoints);
+	PROTECT(sites = allocMatrix(INTSXP, task.n, task.k));
+	PROTECT(distances = allocMatrix(REALSXP, task.n, task.k));
+	task.sites = INTEGER(sites);
+	task.distances = REAL(distances);
+	if (task.index->n > 0)
+		parallelFor(task.n, 256, nearestChunk, &task);
+	else
+		for (i = 0; i < task.n * task.k; i++)
+			task.sites[i] = -1;
+	for (i = 0; i < task.n * task.k; i++)
+		if (task.sites[i] < 0)
+		{
+			task.sites[i] = NA_INTEGER;
+			task.distances[i] = NA_REAL;
+		}
+		else
+			task.sites[i]++;
+
+	PROTECT(result = allocVector(VECSXP, 2));
+	PROTECT(names = allocVector(STRSXP, 2));
+	SET_VECTOR_ELT(result, 0, sites);
+	SET_STRING_ELT(names, 0, mkChar("site"));
+	SET_VECTOR_ELT(result, 1, distances);
+	SET_STRING_ELT(names, 1, mkChar("distance"));
+	setAttrib(result, R_NamesSymbol, names);
+	UNPROTECT(4);
+	return (result);
+}
@@ -0,0 +1,398 @@
+/* Copyright (C) 2018
+
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+*/
+#include "RcompGeomete.h"
+#include <stdint.h>
+#include <string.h>
+#include <R_ext/Rdynload.h>
+#include <R_ext/Altrep.h>
+
+/* Point matrices mapped from binary files.
+
+   C_pointFile() maps a file holding n points of dimension dim as 32 or
+   64-bit floats, either point after point (row-major) or coordinate
+   after coordinate (column-major), from a byte offset, and returns it
+   as an n-by-dim ALTREP double matrix. The functions that build hulls
+   read the mapping directly: row-major doubles are handed to qhull in
+   place (see copyPoints()), and other layouts are converted or
+   transposed straight into qhull's array, so the points are never
+   copied into R memory. Column-major doubles are also read in place by
+   R code that only reads. Otherwise elements are converted as they are
+   read, and the whole matrix is allocated in R memory only when
+   something asks to write to its data.
+
+   C_singlePoints() makes the same kind of matrix from an R matrix, with
+   the coordinates held in memory as row-major floats, which take half
+   the memory of the R matrix. qhull itself works in double precision,
+   so it is given a double copy to build from.
+
+   data1 is an external pointer to the pointFileT, protecting the file
+   name; data2 is the materialised matrix, or R_NilValue until then. */
+
+#define POINTS_FLOAT32 1
+#define POINTS_FLOAT64 2
+#define POINTS_ROWS 1
+#define POINTS_COLUMNS 2
+
+typedef struct
+{
+	mappedFileT map; /* the mapped file, or nothing for... */
+	float *owned;	 /* ...floats held in memory */
+	const char *data; /* the first coordinate, offset bytes into the file */
+	int type, layout, dim;
+	R_xlen_t n;
+} pointFileT;
+
+static R_altrep_class_t pointFileClass;
+
+static void pointFileFinalizer(SEXP ptr)
+{
+	pointFileT *pf = (pointFileT *)R_ExternalPtrAddr(ptr);
+	if (!pf)
+		return;
+	unmapFile(&pf->map);
+	free(pf->owned);
+	free(pf);
+	R_ClearExternalPtr(ptr);
+}
+
+/* R_altrep_inherits() needs R 3.6.0, so recognise the external
+   pointer instead */
+boolT isPointFile(SEXP p)
+{
+	SEXP ptr;
+	if (!ALTREP(p) || TYPEOF(p) != REALSXP)
+		return (False);
+	ptr = R_altrep_data1(p);
+	return (TYPEOF(ptr) == EXTPTRSXP && R_ExternalPtrTag(ptr) == install("point_file"));
+}
+
+static const pointFileT *pointFile(SEXP p)
+{
+	return ((const pointFileT *)R_ExternalPtrAddr(R_altrep_data1(p)));
+}
+
+/* The coordinates of p, in the mapping or in memory, or NULL if p is
+   not a point file */
+const void *pointFileMapping(SEXP p)
+{
+	return (isPointFile(p) ? pointFile(p)->data : NULL);
+}
+
+/* Whether the coordinates are doubles in the order given, and aligned
+   so that they can be read in place */
+static boolT pointFileIs(const pointFileT *pf, int layout)
+{
+	return (pf->type == POINTS_FLOAT64 && pf->layout == layout &&
+			(uintptr_t)pf->data % sizeof(double) == 0);
+}
+
+/* The row-major doubles of p that qhull can read in place, or NULL if
+   p is not such a point file or R has materialised (and so may have
+   modified) it */
+const double *pointFileRows(SEXP p)
+{
+	if (!isPointFile(p) || R_altrep_data2(p) != R_NilValue || !pointFileIs(pointFile(p), POINTS_ROWS))
+		return (NULL);
+	return ((const double *)pointFile(p)->data);
+}
+
+static double pointFileValue(const pointFileT *pf, R_xlen_t row, int col)
+{
+	R_xlen_t at = (pf->layout == POINTS_ROWS) ? row * pf->dim + col : row + pf->n * col;
+	if (pf->type == POINTS_FLOAT64)
+	{
+		double value;
+		memcpy(&value, pf->data + at * sizeof(double), sizeof(double));
+		return (value);
+	}
+	else
+	{
+		float value;
+		memcpy(&value, pf->data + at * sizeof(float), sizeof(float));
+		return ((double)value);
+	}
+}
+
+/* ------------------------------------------------------------------ */
+/* Conversion on the threads of the pool                              */
+
+typedef struct
+{
+	const pointFileT *pf;
+	const double *columns; /* the materialised matrix, or NULL */
+	double *out;
+	boolT *finite; /* one flag per chunk, see pointFileCheck() */
+} pointCopyT;
+
+/* Rows [begin, end) into the row-major array qhull reads. Reading the
+   dim columns of a column-major file for a run of rows at once keeps
+   each of them sequential. */
+static void copyRowsChunk(void *ctx, R_xlen_t begin, R_xlen_t end)
+{
+	pointCopyT *copy = (pointCopyT *)ctx;
+	const pointFileT *pf = copy->pf;
+	R_xlen_t i;
+	int j;
+
+	for (i = begin; i < end; i++)
+		for (j = 0; j < pf->dim; j++)
+			copy->out[i * pf->dim + j] = copy->columns ? copy->columns[i + pf->n * j]
+													   : pointFileValue(pf, i, j);
+}
+
+/* Elements [begin, end) of the column-major matrix R holds */
+static void copyColumnsChunk(void *ctx, R_xlen_t begin, R_xlen_t end)
+{
+	pointCopyT *copy = (pointCopyT *)ctx;
+	R_xlen_t i;
+
+	for (i = begin; i < end; i++)
+		copy->out[i] = pointFileValue(copy->pf, i % copy->pf->n, (int)(i / copy->pf->n));
+}
+
+/* Whether every coordinate of chunk k of THREADS_GRAIN rows is finite */
+static void checkChunk(void *ctx, R_xlen_t begin, R_xlen_t end)
+{
+	pointCopyT *copy = (pointCopyT *)ctx;
+	const pointFileT *pf = copy->pf;
+	R_xlen_t k, i, last;
+	int j;
+
+	for (k = begin; k < end; k++)
+	{
+		copy->finite[k] = True;
+		last = (k + 1) * THREADS_GRAIN < pf->n ? (k + 1) * THREADS_GRAIN : pf->n;
+		for (i = k * THREADS_GRAIN; i < last && copy->finite[k]; i++)
+			for (j = 0; j < pf->dim; j++)
+				if (!R_FINITE(pointFileValue(pf, i, j)))
+					copy->finite[k] = False;
+	}
+}
+
+/* Fill rows with the n x dim row-major coordinates of p */
+void pointFileCopyRows(SEXP p, double *rows)
+{
+	pointCopyT copy;
+	SEXP values = R_altrep_data2(p);
+
+	copy.pf = pointFile(p);
+	copy.columns = (values == R_NilValue) ? NULL : REAL(values);
+	copy.out = rows;
+	parallelFor(copy.pf->n, THREADS_GRAIN, copyRowsChunk, &copy);
+}
+
+static boolT pointFileCheck(const pointFileT *pf)
+{
+	pointCopyT copy;
+	R_xlen_t k, chunks = (pf->n + THREADS_GRAIN - 1) / THREADS_GRAIN;
+	boolT finite = True;
+
+	copy.pf = pf;
+	copy.finite = (boolT *)R_alloc(chunks, sizeof(boolT));
+	parallelFor(chunks, 1, checkChunk, &copy);
+	for (k = 0; k < chunks; k++)
+		finite = finite && copy.finite[k];
+	return (finite);
+}
+
+/* ------------------------------------------------------------------ */
+/* ALTREP methods                                                     */
+
+static R_xlen_t pointFileLength(SEXP x)
+{
+	const pointFileT *pf = pointFile(x);
+	return (pf->n * pf->dim);
+}
+
+static Rboolean pointFileInspect(SEXP x, int pre, int deep, int pvec,
+								 void (*inspect_subtree)(SEXP, int, int, int))
+{
+	const pointFileT *pf = pointFile(x);
+	Rprintf(" compGeometeR points (%s, %s-major, %s)\n",
+			pf->type == POINTS_FLOAT64 ? "float64" : "float32",
+			pf->layout == POINTS_ROWS ? "row" : "column",
+			R_altrep_data2(x) != R_NilValue ? "materialised" : (pf->owned ? "in memory" : "mapped"));
+	return TRUE;
+}
+
+static SEXP pointFileMaterialise(SEXP x)
+{
+	SEXP values = R_altrep_data2(x);
+	if (values == R_NilValue)
+	{
+		pointCopyT copy;
+		PROTECT(values = allocVector(REALSXP, pointFileLength(x)));
+		copy.pf = pointFile(x);
+		copy.out = REAL(values);
+		parallelFor(XLENGTH(values), THREADS_GRAIN, copyColumnsChunk, &copy);
+		R_set_altrep_data2(x, values);
+		UNPROTECT(1);
+	}
+	return (values);
+}
+
+static void *pointFileDataptr(SEXP x, Rboolean writeable)
+{
+	const pointFileT *pf = pointFile(x);
+	if (!writeable && R_altrep_data2(x) == R_NilValue && pointFileIs(pf, POINTS_COLUMNS))
+		return ((void *)pf->data);
+	return (REAL(pointFileMaterialise(x)));
+}
+
+static const void *pointFileDataptrOrNull(SEXP x)
+{
+	SEXP values = R_altrep_data2(x);
+	const pointFileT *pf = pointFile(x);
+	if (values != R_NilValue)
+		return (REAL(values));
+	return (pointFileIs(pf, POINTS_COLUMNS) ? pf->data : NULL);
+}
+
+static double pointFileElt(SEXP x, R_xlen_t i)
+{
+	SEXP values = R_altrep_data2(x);
+	const pointFileT *pf = pointFile(x);
+	return (values == R_NilValue ? pointFileValue(pf, i % pf->n, (int)(i / pf->n)) : REAL(values)[i]);
+}
+
+static R_xlen_t pointFileGetRegion(SEXP x, R_xlen_t start, R_xlen_t size, double *buf)
+{
+	R_xlen_t i, len = pointFileLength(x);
+	if (start + size > len)
+		size = len - start;
+	for (i = 0; i < size; i++)
+		buf[i] = pointFileElt(x, start + i);
+	return (size);
+}
+
+/* Coordinates are checked when the file is mapped, but R may since
+   have modified a materialised matrix */
+static int pointFileNoNA(SEXP x)
+{
+	return (R_altrep_data2(x) == R_NilValue);
+}
+
+void registerPointFileClass(DllInfo *dll)
+{
+	pointFileClass = R_make_altreal_class("point_file", "compGeometeR", dll);
+	R_set_altrep_Length_method(pointFileClass, pointFileLength);
+	R_set_altrep_Inspect_method(pointFileClass, pointFileInspect);
+	R_set_altvec_Dataptr_method(pointFileClass, pointFileDataptr);
+	R_set_altvec_Dataptr_or_null_method(pointFileClass, pointFileDataptrOrNull);
+	R_set_altreal_Elt_method(pointFileClass, pointFileElt);
+	R_set_altreal_Get_region_method(pointFileClass, pointFileGetRegion);
+	R_set_altreal_No_NA_method(pointFileClass, pointFileNoNA);
+}
+
+/* Map n points of dimension dim from file, stored as type ("float32" or
+   "float64") in layout ("row" or "column") order from byte offset. An
+   n of NA reads every point to the end of the file. */
+SEXP C_pointFile(const SEXP file, const SEXP dim, const SEXP type, const SEXP layout,
+				 const SEXP offset, const SEXP n)
+{
+	const char *path;
+	pointFileT *pf;
+	double start, count, available;
+	size_t size;
+	SEXP ptr, x, dims;
+
+	if (!isString(file) || length(file) != 1 || !isString(type) || !isString(layout))
+		error("file, type and layout must be single strings.");
+	path = R_ExpandFileName(CHAR(STRING_ELT(file, 0)));
+	pf = (pointFileT *)calloc(1, sizeof(pointFileT));
+	if (!pf)
+		error("Unable to allocate memory");
+	pf->dim = asInteger(dim);
+	pf->type = strcmp(CHAR(STRING_ELT(type, 0)), "float32") ? POINTS_FLOAT64 : POINTS_FLOAT32;
+	pf->layout = strcmp(CHAR(STRING_ELT(layout, 0)), "column") ? POINTS_ROWS : POINTS_COLUMNS;
+	size = (pf->type == POINTS_FLOAT64) ? sizeof(double) : sizeof(float);
+	start = asReal(offset);
+	count = asReal(n);
+
+	/* Wrap the mapping at once, so that it is unmapped on any error */
+	PROTECT(ptr = R_MakeExternalPtr(pf, install("point_file"), file));
+	R_RegisterCFinalizerEx(ptr, pointFileFinalizer, TRUE);
+	if (pf->dim < 1 || pf->dim == NA_INTEGER)
+		error("dim must be a positive whole number.");
+	if (!mapFile(&pf->map, path, 0))
+		error("Unable to map '%s'.", CHAR(STRING_ELT(file, 0)));
+	if (ISNAN(start) || start < 0 || start > (double)pf->map.size)
+		error("offset must be between 0 and the size of '%s'.", CHAR(STRING_ELT(file, 0)));
+	available = floor(((double)pf->map.size - start) / ((double)size * pf->dim));
+	if (ISNAN(count))
+	{
+		if (((double)pf->map.size - start) != available * size * pf->dim)
+			error("'%s' does not hold a whole number of %d-dimensional points after the offset.",
+				  CHAR(STRING_ELT(file, 0)), pf->dim);
+		count = available;
+	}
+	else if (count < 1 || count != floor(count) || count > available)
+		error("'%s' holds only %.0f %d-dimensional points after the offset.",
+			  CHAR(STRING_ELT(file, 0)), available, pf->dim);
+	if (count > INT_MAX)
+		error("A point file can hold at most %d points.", INT_MAX);
+	pf->n = (R_xlen_t)count;
+	pf->data = (const char *)pf->map.base + (size_t)start;
+	if (!pointFileCheck(pf))
+		error("'%s' holds coordinates that are not finite.", CHAR(STRING_ELT(file, 0)));
+
+	PROTECT(x = R_new_altrep(pointFileClass, ptr, R_NilValue));
+	PROTECT(dims = allocVector(INTSXP, 2));
+	INTEGER(dims)[0] = (int)pf->n;
+	INTEGER(dims)[1] = pf->dim;
+	setAttrib(x, R_DimSymbol, dims);
+	UNPROTECT(3);
+	return (x);
+}
+
+/* Points p (a real matrix without NAs) held in single precision */
+SEXP C_singlePoints(const SEXP p)
+{
+	pointFileT *pf;
+	R_xlen_t i, n;
+	int j;
+	SEXP ptr, x, dims;
+
+	if (!isMatrix(p) || !isReal(p))
+		error("points must be a real matrix.");
+	pf = (pointFileT *)calloc(1, sizeof(pointFileT));
+	if (!pf)
+		error("Unable to allocate memory");
+	PROTECT(ptr = R_MakeExternalPtr(pf, install("point_file"), R_NilValue));
+	R_RegisterCFinalizerEx(ptr, pointFileFinalizer, TRUE);
+	pf->n = n = nrows(p);
+	pf->dim = ncols(p);
+	pf->type = POINTS_FLOAT32;
+	pf->layout = POINTS_ROWS;
+	pf->owned = (float *)malloc((n * pf->dim + 1) * sizeof(float));
+	if (!pf->owned)
+		error("Unable to allocate memory for %ld points", (long)n);
+	for (i = 0; i < n; i++)
+		for (j = 0; j < pf->dim; j++)
+			pf->owned[i * pf->dim + j] = (float)REAL(p)[i + n * j];
+	pf->data = (const char *)pf->owned;
+	if (!pointFileCheck(pf))
+		error("points must be finite in single precision.");
+
+	PROTECT(x = R_new_altrep(pointFileClass, ptr, R_NilValue));
+	PROTECT(dims = allocVector(INTSXP, 2));
+	INTEGER(dims)[0] = (int)n;
+	INTEGER(dims)[1] = pf->dim;
+	setAttrib(x, R_DimSymbol, dims);
+	UNPROTECT(3);
+	return (x);
+}
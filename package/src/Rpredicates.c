@@ -0,0 +1,223 @@
+/* Copyright (C) 2018
+
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+*/
+#include "RcompGeomete.h"
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+/* Orientation predicates in 2-D and 3-D whose sign is always right.
+   The determinant is first computed in floating point and its sign
+   accepted when it exceeds a bound on the rounding error, as it nearly
+   always does. Otherwise, for points on or very near a common line or
+   plane such as those of a lattice, it is recomputed exactly with the
+   expansion arithmetic of Shewchuk (1997), "Adaptive precision
+   floating-point arithmetic and fast robust geometric predicates". */
+
+/* Unit roundoff and the error bounds of the floating point
+   determinants */
+#define PRED_EPSILON (DBL_EPSILON / 2)
+#define ORIENT2D_BOUND ((3.0 + 16.0 * PRED_EPSILON) * PRED_EPSILON)
+#define ORIENT3D_BOUND ((7.0 + 56.0 * PRED_EPSILON) * PRED_EPSILON)
+
+/* Largest expansions of the exact determinants */
+#define ORIENT3D_TERMSmax 192
+
+/* x + y = a + b exactly */
+static void twoSum(double a, double b, double *x, double *y)
+{
+	double bv, av;
+	*x = a + b;
+	bv = *x - a;
+	av = *x - bv;
+	*y = (a - av) + (b - bv);
+}
+
+/* x + y = a * b exactly, fma() rounding once whatever the contraction
+   the compiler applies */
+static void twoProduct(double a, double b, double *x, double *y)
+{
+	*x = a * b;
+	*y = fma(a, b, -*x);
+}
+
+/* The difference a - b as an expansion of two terms */
+static int twoDiff(double a, double b, double *h)
+{
+	twoSum(a, -b, &h[1], &h[0]);
+	return (2);
+}
+
+/* h = e + f, for nonoverlapping expansions e and f of increasing
+   magnitude, dropping zero terms. h must not overlap e or f. */
+static int expansionSum(int elen, const double *e, int flen, const double *f, double *h)
+{
+	double q, hnow;
+	int i, j, hlen = 0, hlast;
+
+	for (i = 0; i < elen; i++)
+		h[i] = e[i];
+	hlast = elen;
+	for (j = 0; j < flen; j++)
+	{
+		/* Grow h by f[j] */
+		q = f[j];
+		hlen = 0;
+		for (i = 0; i < hlast; i++)
+		{
+			twoSum(q, h[i], &q, &hnow);
+			if (hnow != 0)
+				h[hlen++] = hnow;
+		}
+		if (q != 0 || hlen == 0)
+			h[hlen++] = q;
+		hlast = hlen;
+	}
+	return (hlast);
+}
+
+/* h = b * e, dropping zero terms */
+static int scaleExpansion(int elen, const double *e, double b, double *h)
+{
+	double q, sum, product, err;
+	int i, hlen = 0;
+
+	twoProduct(e[0], b, &q, &err);
+	if (err != 0)
+		h[hlen++] = err;
+	for (i = 1; i < elen; i++)
+	{
+		twoProduct(e[i], b, &product, &err);
+		twoSum(q, err, &sum, &err);
+		if (err != 0)
+			h[hlen++] = err;
+		twoSum(product, sum, &q, &err);
+		if (err != 0)
+			h[hlen++] = err;
+	}
+	if (q != 0 || hlen == 0)
+		h[hlen++] = q;
+	return (hlen);
+}
+
+/* h = e * f; h holds up to 2 * elen * flen terms */
+static int expansionProduct(int elen, const double *e, int flen, const double *f, double *h)
+{
+	double part[2 * ORIENT3D_TERMSmax], sum[ORIENT3D_TERMSmax];
+	int j, plen, hlen = 0;
+
+	for (j = 0; j < flen; j++)
+	{
+		plen = scaleExpansion(elen, e, f[j], part);
+		hlen = expansionSum(hlen, h, plen, part, sum);
+		memcpy(h, sum, hlen * sizeof(double));
+	}
+	return (hlen);
+}
+
+/* The exact 2-by-2 determinant e11 e22 - e12 e21 of expansions */
+static int exactDet2(int len11, const double *e11, int len12, const double *e12,
+					 int len21, const double *e21, int len22, const double *e22, double *h)
+{
+	double left[ORIENT3D_TERMSmax], right[ORIENT3D_TERMSmax];
+	int llen, rlen, i;
+
+	llen = expansionProduct(len11, e11, len22, e22, left);
+	rlen = expansionProduct(len12, e12, len21, e21, right);
+	for (i = 0; i < rlen; i++)
+		right[i] = -right[i];
+	return (expansionSum(llen, left, rlen, right, h));
+}
+
+static double orient2dExact(const double *a, const double *b, const double *c)
+{
+	double acx[2], acy[2], bcx[2], bcy[2], det[16];
+	int len;
+
+	twoDiff(a[0], c[0], acx);
+	twoDiff(a[1], c[1], acy);
+	twoDiff(b[0], c[0], bcx);
+	twoDiff(b[1], c[1], bcy);
+	len = exactDet2(2, acx, 2, acy, 2, bcx, 2, bcy, det);
+	/* The largest term of an expansion has its sign */
+	return (det[len - 1]);
+}
+
+static double orient3dExact(const double *a, const double *b, const double *c, const double *d)
+{
+	double ad[3][2], bd[3][2], cd[3][2];
+	double minor[ORIENT3D_TERMSmax / 6], term[ORIENT3D_TERMSmax / 3];
+	double det[ORIENT3D_TERMSmax], sum[ORIENT3D_TERMSmax];
+	int j, mlen, tlen, len = 0;
+
+	for (j = 0; j < 3; j++)
+	{
+		twoDiff(a[j], d[j], ad[j]);
+		twoDiff(b[j], d[j], bd[j]);
+		twoDiff(c[j], d[j], cd[j]);
+	}
+	/* Expand along the row a - d, with the cofactors from b - d and
+	   c - d */
+	for (j = 0; j < 3; j++)
+	{
+		int k = (j + 1) % 3, l = (j + 2) % 3;
+		mlen = exactDet2(2, bd[k], 2, bd[l], 2, cd[k], 2, cd[l], minor);
+		tlen = expansionProduct(mlen, minor, 2, ad[j], term);
+		len = expansionSum(len, det, tlen, term, sum);
+		memcpy(det, sum, len * sizeof(double));
+	}
+	return (det[len - 1]);
+}
+
+/* Positive if a, b, c turn counterclockwise, negative if clockwise and
+   zero if they are collinear */
+double orient2d(const double *a, const double *b, const double *c)
+{
+	double left = (a[0] - c[0]) * (b[1] - c[1]);
+	double right = (a[1] - c[1]) * (b[0] - c[0]);
+	double det = left - right;
+
+	if (fabs(det) > ORIENT2D_BOUND * (fabs(left) + fabs(right)))
+		return (det);
+	return (orient2dExact(a, b, c));
+}
+
+/* Positive if d lies below the plane through a, b, c, when these turn
+   counterclockwise seen from above, negative if above and zero if the
+   four points are coplanar */
+double orient3d(const double *a, const double *b, const double *c, const double *d)
+{
+	double adx = a[0] - d[0], ady = a[1] - d[1], adz = a[2] - d[2];
+	double bdx = b[0] - d[0], bdy = b[1] - d[1], bdz = b[2] - d[2];
+	double cdx = c[0] - d[0], cdy = c[1] - d[1], cdz = c[2] - d[2];
+	double bc = bdy * cdz - bdz * cdy, ca = cdy * adz - cdz * ady, ab = ady * bdz - adz * bdy;
+	double det = adx * bc + bdx * ca + cdx * ab;
+	double permanent = (fabs(bdy * cdz) + fabs(bdz * cdy)) * fabs(adx) +
+					   (fabs(cdy * adz) + fabs(cdz * ady)) * fabs(bdx) +
+					   (fabs(ady * bdz) + fabs(adz * bdy)) * fabs(cdx);
+
+	if (fabs(det) > ORIENT3D_BOUND * permanent)
+		return (det);
+	return (orient3dExact(a, b, c, d));
+}
+
+/* The sign (-1, 0 or 1) of the orientation of the simplex v[0..dim], for
+   dim 2 or 3 */
+int simplexOrientation(const double *const *v, int dim)
+{
+	double det = (dim == 2) ? orient2d(v[0], v[1], v[2]) : orient3d(v[0], v[1], v[2], v[3]);
+	return ((det > 0) - (det < 0));
+}
@@ -0,0 +1,719 @@
+/* Copyright (C) 2018
+
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+*/
+#include "RcompGeomete.h"
+#include <stdint.h>
+#include <string.h>
+
+/* Geometry of single simplices and of meshes of simplices held in plain
+   arrays (see meshT), independent of qhull. */
+
+/* Solve the n-by-n system a x = b by Gaussian elimination with partial
+   pivoting. a (row-major) and b are overwritten; x is returned in b.
+   Returns 0 if the system is singular. */
+int solveLinear(double *a, double *b, int n)
+{
+	int i, j, k, pivot;
+	double big, factor, swap;
+
+	for (k = 0; k < n; k++)
+	{
+		pivot = k;
+		big = fabs(a[k * n + k]);
+		for (i = k + 1; i < n; i++)
+			if (fabs(a[i * n + k]) > big)
+			{
+				big = fabs(a[i * n + k]);
+				pivot = i;
+			}
+		if (big == 0.0)
+			return (0);
+		if (pivot != k)
+		{
+			for (j = 0; j < n; j++)
+			{
+				swap = a[k * n + j];
+				a[k * n + j] = a[pivot * n + j];
+				a[pivot * n + j] = swap;
+			}
+			swap = b[k];
+			b[k] = b[pivot];
+			b[pivot] = swap;
+		}
+		for (i = k + 1; i < n; i++)
+		{
+			factor = a[i * n + k] / a[k * n + k];
+			for (j = k; j < n; j++)
+				a[i * n + j] -= factor * a[k * n + j];
+			b[i] -= factor * b[k];
+		}
+	}
+	for (k = n - 1; k >= 0; k--)
+	{
+		for (j = k + 1; j < n; j++)
+			b[k] -= a[k * n + j] * b[j];
+		b[k] /= a[k * n + k];
+	}
+	return (1);
+}
+
+/* Circumcentre and circumradius of the simplex with vertices v[0..dim].
+   Solved relative to v[0] for accuracy. Returns 0 if degenerate. */
+int simplexCircumcentre(const double *const *v, int dim, double *centre, double *radius)
+{
+	double a[MESH_DIMmax * MESH_DIMmax], b[MESH_DIMmax];
+	double r2 = 0, diff;
+	int i, j;
+
+	for (i = 0; i < dim; i++)
+	{
+		b[i] = 0;
+		for (j = 0; j < dim; j++)
+		{
+			diff = v[i + 1][j] - v[0][j];
+			a[i * dim + j] = 2 * diff;
+			b[i] += diff * diff;
+		}
+	}
+	if (!solveLinear(a, b, dim))
+		return (0);
+	for (j = 0; j < dim; j++)
+	{
+		centre[j] = v[0][j] + b[j];
+		r2 += b[j] * b[j];
+	}
+	*radius = sqrt(r2);
+	return (1);
+}
+
+/* Barycentric coordinates lambda[0..dim] of x in the simplex v[0..dim].
+   Returns 0 if the simplex is degenerate. */
+int simplexBarycentric(const double *const *v, int dim, const double *x, double *lambda)
+{
+	double a[MESH_DIMmax * MESH_DIMmax], b[MESH_DIMmax];
+	double sum = 0;
+	int i, j;
+
+	/* Columns are v[i] - v[dim], so that x - v[dim] = a lambda[0..dim-1] */
+	for (j = 0; j < dim; j++)
+	{
+		for (i = 0; i < dim; i++)
+			a[j * dim + i] = v[i][j] - v[dim][j];
+		b[j] = x[j] - v[dim][j];
+	}
+	if (!solveLinear(a, b, dim))
+		return (0);
+	for (i = 0; i < dim; i++)
+	{
+		lambda[i] = b[i];
+		sum += b[i];
+	}
+	lambda[dim] = 1 - sum;
+	return (1);
+}
+
+/* The side of each face of the simplex v[0..dim] that x lies on, for
+   dim 2 or 3: side[i] is the sign of the barycentric coordinate of x
+   opposite v[i], decided exactly by the orientation predicates. Returns
+   0 if the simplex is flat. */
+int simplexSides(const double *const *v, int dim, const double *x, int *side)
+{
+	const double *w[4];
+	int i, sign = simplexOrientation(v, dim);
+
+	if (!sign)
+		return (0);
+	for (i = 0; i <= dim; i++)
+	{
+		memcpy(w, v, (dim + 1) * sizeof(*w));
+		w[i] = x;
+		side[i] = sign * simplexOrientation(w, dim);
+	}
+	return (1);
+}
+
+/* Unit normal and offset of the hyperplane through v[0..dim-1], oriented
+   so that inside lies on the negative side. Returns 0 if degenerate. */
+int simplexHyperplane(const double *const *v, int dim, const double *inside, double *normal, double *offset)
+{
+	double a[MESH_DIMmax * MESH_DIMmax];
+	double norm = 0, side = 0;
+	int i, j, k, col;
+
+	/* normal[k] is the signed minor of the differences v[i] - v[0]
+	   with column k removed */
+	for (k = 0; k < dim; k++)
+	{
+		for (i = 1; i < dim; i++)
+			for (j = 0, col = 0; j < dim; j++)
+				if (j != k)
+					a[(i - 1) * (dim - 1) + col++] = v[i][j] - v[0][j];
+		normal[k] = ((k % 2) ? -1 : 1) * determinant(a, dim - 1);
+		norm += normal[k] * normal[k];
+	}
+	norm = sqrt(norm);
+	if (norm == 0.0)
+		return (0);
+	*offset = 0;
+	for (k = 0; k < dim; k++)
+	{
+		normal[k] /= norm;
+		*offset -= normal[k] * v[0][k];
+		side += normal[k] * inside[k];
+	}
+	if (side + *offset > 0)
+	{
+		for (k = 0; k < dim; k++)
+			normal[k] = -normal[k];
+		*offset = -*offset;
+	}
+	return (1);
+}
+
+/* Determinant of the n-by-n row-major matrix a, which is overwritten */
+double determinant(double *a, int n)
+{
+	int i, j, k, pivot;
+	double det = 1, big, factor, swap;
+
+	for (k = 0; k < n; k++)
+	{
+		pivot = k;
+		big = fabs(a[k * n + k]);
+		for (i = k + 1; i < n; i++)
+			if (fabs(a[i * n + k]) > big)
+			{
+				big = fabs(a[i * n + k]);
+				pivot = i;
+			}
+		if (big == 0.0)
+			return (0);
+		if (pivot != k)
+		{
+			for (j = 0; j < n; j++)
+			{
+				swap = a[k * n + j];
+				a[k * n + j] = a[pivot * n + j];
+				a[pivot * n + j] = swap;
+			}
+			det = -det;
+		}
+		det *= a[k * n + k];
+		for (i = k + 1; i < n; i++)
+		{
+			factor = a[i * n + k] / a[k * n + k];
+			for (j = k; j < n; j++)
+				a[i * n + j] -= factor * a[k * n + j];
+		}
+	}
+	return (det);
+}
+
+/* ------------------------------------------------------------------ */
+
+static void sortFace(int *face, int n)
+{
+	int i, j, v;
+	for (i = 1; i < n; i++)
+	{
+		v = face[i];
+		for (j = i - 1; j >= 0 && face[j] > v; j--)
+			face[j + 1] = face[j];
+		face[j + 1] = v;
+	}
+}
+
+/* The face of cell c opposite its vertex k, as sorted point ids */
+static void cellFace(const meshT *mesh, R_xlen_t c, int k, int *face)
+{
+	int i, f = 0;
+	for (i = 0; i < mesh->nv; i++)
+		if (i != k)
+			face[f++] = mesh->cells[c * mesh->nv + i];
+	sortFace(face, mesh->nv - 1);
+}
+
+static uint64_t hashFace(const int *face, int n)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	int i;
+	for (i = 0; i < n; i++)
+	{
+		h ^= (uint32_t)face[i];
+		h *= 0x100000001b3ULL;
+		h ^= h >> 29;
+	}
+	return (h);
+}
+
+/* Fill neighbours[c * nv + k] with the 1-based index of the cell that
+   shares the face of cell c opposite its vertex k, or 0 if there is
+   none. Faces are matched through an open-addressing hash table, so
+   this is linear in the number of cells. */
+void meshNeighbours(const meshT *mesh, int *neighbours)
+{
+	R_xlen_t c, slot, nfaces = mesh->ncells * mesh->nv;
+	R_xlen_t size = 16, mask;
+	int face[MESH_DIMmax + 1], other[MESH_DIMmax + 1];
+	int k, nf = mesh->nv - 1;
+	R_xlen_t *table;
+
+	while (size < 2 * nfaces)
+		size *= 2;
+	mask = size - 1;
+	table = (R_xlen_t *)malloc(size * sizeof(R_xlen_t));
+	if (!table)
+		error("Unable to allocate memory for %ld faces", (long)nfaces);
+	for (slot = 0; slot < size; slot++)
+		table[slot] = -1;
+	memset(neighbours, 0, nfaces * sizeof(int));
+
+	for (c = 0; c < mesh->ncells; c++)
+		for (k = 0; k < mesh->nv; k++)
+		{
+			cellFace(mesh, c, k, face);
+			slot = hashFace(face, nf) & mask;
+			while (table[slot] >= 0)
+			{
+				R_xlen_t id = table[slot];
+				cellFace(mesh, id / mesh->nv, id % mesh->nv, other);
+				if (!memcmp(face, other, nf * sizeof(int)))
+					break;
+				slot = (slot + 1) & mask;
+			}
+			if (table[slot] >= 0)
+			{
+				R_xlen_t id = table[slot];
+				neighbours[c * mesh->nv + k] = id / mesh->nv + 1;
+				neighbours[id] = c + 1;
+			}
+			else
+				table[slot] = c * mesh->nv + k;
+		}
+	free(table);
+}
+
+static int compareIds(const void *a, const void *b)
+{
+	int x = *(const int *)a, y = *(const int *)b;
+	return ((x > y) - (x < y));
+}
+
+typedef struct
+{
+	const R_xlen_t *offsets;
+	int *edges;
+	R_xlen_t *distinct;
+} edgeSortT;
+
+/* Sort the neighbours of each point and move the distinct ones to the
+   front of its list */
+static void edgeSortChunk(void *ctx, R_xlen_t begin, R_xlen_t end)
+{
+	const edgeSortT *task = (const edgeSortT *)ctx;
+	R_xlen_t i, e, kept;
+	int *list;
+
+	for (i = begin; i < end; i++)
+	{
+		list = task->edges + task->offsets[i];
+		qsort(list, task->offsets[i + 1] - task->offsets[i], sizeof(int), compareIds);
+		kept = 0;
+		for (e = 0; e < task->offsets[i + 1] - task->offsets[i]; e++)
+			if (e == 0 || list[e] != list[kept - 1])
+				list[kept++] = list[e];
+		task->distinct[i] = kept;
+	}
+}
+
+/* The edges of the cells as adjacency lists in compressed sparse row
+   form: the points adjacent to point i are (*adjacent)[offsets[i] ..
+   offsets[i + 1] - 1], in increasing order. offsets has npoints + 1
+   entries; *adjacent is malloc()ed. The edges of each point are bucketed
+   by a count over the cells, then sorted and deduplicated point by
+   point on the thread pool, so the work is linear in the number of
+   cells. No R API is used. Returns 0 if out of memory. */
+int meshEdges(const meshT *mesh, R_xlen_t *offsets, int **adjacent)
+{
+	R_xlen_t c, i, n = mesh->npoints, kept = 0, *fill;
+	int k, m, nv = mesh->nv, *edges, *grown;
+	const int *cell;
+	edgeSortT task;
+
+	memset(offsets, 0, (n + 1) * sizeof(R_xlen_t));
+	for (c = 0; c < mesh->ncells; c++)
+		for (k = 0; k < nv; k++)
+			offsets[mesh->cells[c * nv + k] + 1] += nv - 1;
+	for (i = 0; i < n; i++)
+		offsets[i + 1] += offsets[i];
+	edges = (int *)malloc((offsets[n] ? offsets[n] : 1) * sizeof(int));
+	fill = (R_xlen_t *)malloc((n ? n : 1) * sizeof(R_xlen_t));
+	if (!edges || !fill)
+	{
+		free(edges);
+		free(fill);
+		return (0);
+	}
+	memcpy(fill, offsets, n * sizeof(R_xlen_t));
+	for (c = 0; c < mesh->ncells; c++)
+	{
+		cell = mesh->cells + c * nv;
+		for (k = 0; k < nv; k++)
+			for (m = 0; m < nv; m++)
+				if (m != k)
+					edges[fill[cell[k]]++] = cell[m];
+	}
+
+	task.offsets = offsets;
+	task.edges = edges;
+	task.distinct = fill;
+	parallelFor(n, 256, edgeSortChunk, &task);
+
+	/* Close up the distinct neighbours of the points */
+	for (i = 0; i < n; i++)
+	{
+		memmove(edges + kept, edges + offsets[i], fill[i] * sizeof(int));
+		offsets[i] = kept;
+		kept += fill[i];
+	}
+	offsets[n] = kept;
+	free(fill);
+	grown = (int *)realloc(edges, (kept ? kept : 1) * sizeof(int));
+	*adjacent = grown ? grown : edges;
+	return (1);
+}
+
+static void cellVertices(const meshT *mesh, R_xlen_t c, const double **v)
+{
+	int i;
+	for (i = 0; i < mesh->nv; i++)
+		v[i] = mesh->points + (R_xlen_t)mesh->cells[c * mesh->nv + i] * mesh->dim;
+}
+
+/* The barycentric coordinates lambda of x in cell c and the side of
+   each face of the cell that x lies on: side[i] is the sign of lambda[i],
+   decided exactly in 2-D and 3-D, where points on a lattice often lie on
+   faces, and to within MESH_EPSILON otherwise. Returns 0 if the cell is
+   degenerate. */
+static int cellSides(const meshT *mesh, R_xlen_t c, const double *x, double *lambda, int *side)
+{
+	const double *v[MESH_DIMmax + 1];
+	int i;
+	cellVertices(mesh, c, v);
+	if (!simplexBarycentric(v, mesh->dim, x, lambda))
+		return (0);
+	if (mesh->dim == 2 || mesh->dim == 3)
+		return (simplexSides(v, mesh->dim, x, side));
+	for (i = 0; i <= mesh->dim; i++)
+		side[i] = (lambda[i] > MESH_EPSILON) - (lambda[i] < -MESH_EPSILON);
+	return (1);
+}
+
+static int cellContains(const meshT *mesh, R_xlen_t c, const double *x, double *lambda, int *side)
+{
+	int i;
+	if (!cellSides(mesh, c, x, lambda, side))
+		return (0);
+	for (i = 0; i <= mesh->dim; i++)
+		if (side[i] < 0)
+			return (0);
+	return (1);
+}
+
+/* Return the 1-based index of a cell of the triangulation that contains
+   x, or 0 if there is none, with the barycentric coordinates of x in it
+   and the sides of its faces, see cellSides(). The search walks from
+   cell *start towards x across the face with the most negative
+   barycentric coordinate, which is fast for coherent queries such as
+   grids. As the sides are exact in 2-D and 3-D the walk cannot cycle
+   there, so every cell is only tested if the walk leaves a mesh that
+   does not cover the convex hull of its points (an alpha complex, say)
+   or reaches a flat cell. */
+R_xlen_t meshLocate(const meshT *mesh, const double *x, R_xlen_t *start, double *lambda, int *side)
+{
+	R_xlen_t c = *start, steps, next;
+	int i, k;
+
+	if (mesh->ncells == 0)
+		return (0);
+	if (c < 0 || c >= mesh->ncells)
+		c = 0;
+	for (steps = 0; mesh->neighbours && steps < mesh->ncells; steps++)
+	{
+		if (!cellSides(mesh, c, x, lambda, side))
+			break;
+		k = -1;
+		for (i = 0; i <= mesh->dim; i++)
+			if (side[i] < 0 && (k < 0 || lambda[i] < lambda[k]))
+				k = i;
+		if (k < 0)
+		{
+			*start = c;
+			return (c + 1);
+		}
+		next = mesh->neighbours[c * mesh->nv + k];
+		if (next <= 0 || next > mesh->ncells)
+		{
+			if (mesh->convex)
+				return (0);
+			break;
+		}
+		c = next - 1;
+	}
+
+/* Exhaustive search */
+	for (c = 0; c < mesh->ncells; c++)
+		if (cellContains(mesh, c, x, lambda, side))
+		{
+			*start = c;
+			return (c + 1);
+		}
+	return (0);
+}
+
+/* Find the cells containing many points at once, see meshLocateAll().
+   The walk for each point starts from a cell chosen by the point alone,
+   from a coarse grid of buckets over the points of the mesh, so that
+   the cell found does not depend on the other points queried with it.
+   A raster split into tiles is then labelled exactly as a whole one,
+   whatever the number of threads. */
+#define LOCATE_BUCKETSmax 1048576
+
+typedef struct
+{
+	const meshT *mesh;
+	const double *x; /* n x dim, column-major as in R */
+	R_xlen_t n;
+	int *found;
+	int buckets;		   /* buckets along each dimension */
+	double lo[MESH_DIMmax], width[MESH_DIMmax];
+	const R_xlen_t *start; /* cell to start from in each bucket */
+	const R_xlen_t *starts; /* offsets into star of the cells of each point */
+	const int *star;
+	const char *keep;	   /* the cells that may be found, or NULL for all */
+} locateT;
+
+static R_xlen_t locateBucket(const locateT *task, const double *x)
+{
+	R_xlen_t b = 0;
+	int j, k;
+	for (j = task->mesh->dim - 1; j >= 0; j--)
+	{
+		k = (task->width[j] > 0) ? (int)((x[j] - task->lo[j]) / task->width[j] * task->buckets) : 0;
+		k = (k < 0) ? 0 : (k >= task->buckets ? task->buckets - 1 : k);
+		b = b * task->buckets + k;
+	}
+	return (b);
+}
+
+static void locateChunk(void *ctx, R_xlen_t begin, R_xlen_t end)
+{
+	const locateT *task = (const locateT *)ctx;
+	const meshT *mesh = task->mesh;
+	double x[MESH_DIMmax], lambda[MESH_DIMmax + 1];
+	int side[MESH_DIMmax + 1];
+	R_xlen_t i, c, d, s, start, from, best;
+	int j, k;
+	boolT missing, onFace, kept;
+
+	for (i = begin; i < end; i++)
+	{
+		missing = False;
+		for (j = 0; j < mesh->dim; j++)
+		{
+			x[j] = task->x[i + task->n * j];
+			missing |= ISNAN(x[j]);
+		}
+		if (missing)
+		{
+			task->found[i] = 0;
+			continue;
+		}
+		start = task->start[locateBucket(task, x)];
+		c = meshLocate(mesh, x, &start, lambda, side);
+		/* A point on a face shared by several cells is given the last of
+		   them. These have the points of the face, so are among the
+		   cells of the points of the cell found, but where flat cells
+		   join faces that are split differently they are only reached
+		   through later cells, so the search goes on from each later
+		   cell found until there is none. Cells that are not kept are
+		   passed through but never given. */
+		best = (c && (!task->keep || task->keep[c - 1])) ? c : 0;
+		onFace = False;
+		for (j = 0; c && j <= mesh->dim; j++)
+			onFace |= (side[j] == 0);
+		while (onFace)
+		{
+			from = c;
+			for (j = 0; j < mesh->nv; j++)
+			{
+				k = mesh->cells[(from - 1) * mesh->nv + j];
+				for (s = task->starts[k]; s < task->starts[k + 1]; s++)
+				{
+					d = task->star[s];
+					kept = !task->keep || task->keep[d];
+					if ((d >= c || (kept && d >= best)) && cellContains(mesh, d, x, lambda, side))
+					{
+						if (d >= c)
+							c = d + 1;
+						if (kept && d >= best)
+							best = d + 1;
+					}
+				}
+			}
+			onFace = (c != from);
+		}
+		task->found[i] = (int)best;
+	}
+}
+
+/* Write to found the 1-based index of the last cell containing each of
+   the n points x (column-major, n x dim), or 0 if there is none or the
+   point has a missing coordinate. If keep is not NULL only the cells
+   with keep set are found, though the whole mesh is walked. The points
+   are located on the threads of the pool. */
+void meshLocateAll(const meshT *mesh, const double *x, R_xlen_t n, const char *keep, int *found)
+{
+	locateT task;
+	R_xlen_t c, b, nbuckets = 1, *start, *starts, *next;
+	double hi[MESH_DIMmax], centroid[MESH_DIMmax];
+	int *star;
+	int j, k;
+
+	task.mesh = mesh;
+	task.x = x;
+	task.n = n;
+	task.keep = keep;
+	task.found = found;
+
+	/* About one cell per bucket */
+	task.buckets = (int)pow((double)mesh->ncells, 1.0 / mesh->dim);
+	while (task.buckets > 1 && pow((double)task.buckets, mesh->dim) > LOCATE_BUCKETSmax)
+		task.buckets--;
+	if (task.buckets < 1)
+		task.buckets = 1;
+	for (j = 0; j < mesh->dim; j++)
+		nbuckets *= task.buckets;
+	for (j = 0; j < mesh->dim; j++)
+	{
+		task.lo[j] = R_PosInf;
+		hi[j] = R_NegInf;
+	}
+	for (c = 0; c < mesh->npoints; c++)
+		for (j = 0; j < mesh->dim; j++)
+		{
+			task.lo[j] = fmin(task.lo[j], mesh->points[c * mesh->dim + j]);
+			hi[j] = fmax(hi[j], mesh->points[c * mesh->dim + j]);
+		}
+	for (j = 0; j < mesh->dim; j++)
+		task.width[j] = (hi[j] > task.lo[j]) ? hi[j] - task.lo[j] : 0;
+
+	/* Each bucket starts from the first cell whose centroid lies in it,
+	   or else from the start of the bucket before */
+	start = (R_xlen_t *)R_alloc(nbuckets, sizeof(R_xlen_t));
+	for (b = 0; b < nbuckets; b++)
+		start[b] = -1;
+	task.start = start;
+	for (c = 0; c < mesh->ncells; c++)
+	{
+		for (j = 0; j < mesh->dim; j++)
+		{
+			centroid[j] = 0;
+			for (k = 0; k < mesh->nv; k++)
+				centroid[j] += mesh->points[(R_xlen_t)mesh->cells[c * mesh->nv + k] * mesh->dim + j];
+			centroid[j] /= mesh->nv;
+		}
+		b = locateBucket(&task, centroid);
+		if (start[b] < 0)
+			start[b] = c;
+	}
+	for (b = 0; b < nbuckets; b++)
+		if (start[b] < 0)
+			start[b] = (b > 0) ? start[b - 1] : 0;
+
+	/* The cells of each point, for points on shared faces */
+	starts = (R_xlen_t *)R_alloc(mesh->npoints + 1, sizeof(R_xlen_t));
+	star = (int *)R_alloc(mesh->ncells * mesh->nv + 1, sizeof(int));
+	memset(starts, 0, (mesh->npoints + 1) * sizeof(R_xlen_t));
+	for (c = 0; c < mesh->ncells * mesh->nv; c++)
+		starts[mesh->cells[c] + 1]++;
+	for (b = 0; b < mesh->npoints; b++)
+		starts[b + 1] += starts[b];
+	next = (R_xlen_t *)R_alloc(mesh->npoints + 1, sizeof(R_xlen_t));
+	memcpy(next, starts, (mesh->npoints + 1) * sizeof(R_xlen_t));
+	for (c = 0; c < mesh->ncells; c++)
+		for (k = 0; k < mesh->nv; k++)
+			star[next[mesh->cells[c * mesh->nv + k]]++] = (int)c;
+	task.starts = starts;
+	task.star = star;
+
+	parallelFor(n, 256, locateChunk, &task);
+}
+
+/* Test many points against the facet hyperplanes of a convex hull, see
+   hullContainsAll() */
+typedef struct
+{
+	const double *normals, *offsets;
+	R_xlen_t nfacets, n;
+	int dim;
+	double tolerance;
+	const double *x;
+	int *inside;
+} hullTestT;
+
+static void hullTestChunk(void *ctx, R_xlen_t begin, R_xlen_t end)
+{
+	const hullTestT *task = (const hullTestT *)ctx;
+	R_xlen_t i, f;
+	int j;
+	double dist;
+
+	for (i = begin; i < end; i++)
+	{
+		task->inside[i] = TRUE;
+		for (f = 0; f < task->nfacets; f++)
+		{
+			dist = task->offsets[f];
+			for (j = 0; j < task->dim; j++)
+				dist += task->normals[f * task->dim + j] * task->x[i + task->n * j];
+			if (dist >= task->tolerance)
+			{
+				task->inside[i] = FALSE;
+				break;
+			}
+		}
+	}
+}
+
+/* Set inside[i] to whether point i of the n points x (column-major,
+   n x dim) lies within tolerance of the inside of every facet
+   hyperplane normal . x + offset = 0 (normals row-major, pointing
+   out). The points are tested on the threads of the pool. */
+void hullContainsAll(const double *normals, const double *offsets, R_xlen_t nfacets, int dim,
+					 double tolerance, const double *x, R_xlen_t n, int *inside)
+{
+	hullTestT task;
+	task.normals = normals;
+	task.offsets = offsets;
+	task.nfacets = nfacets;
+	task.n = n;
+	task.dim = dim;
+	task.tolerance = tolerance;
+	task.x = x;
+	task.inside = inside;
+	parallelFor(n, THREADS_GRAIN, hullTestChunk, &task);
+}
@@ -0,0 +1,303 @@
+/* Copyright (C) 2018
+
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+*/
+#include "RcompGeomete.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* The package's native thread pool.
+
+   Every parallel kernel goes through parallelFor(), which splits an
+   index range over one fixed set of threads, so the number of threads
+   the package uses is set in one place: the compGeometeR.threads
+   option, or else the COMPGEOMETER_THREADS, OMP_THREAD_LIMIT and
+   OMP_NUM_THREADS environment variables, or else the number of online
+   processors.
+
+   Each thread starts with an equal share of the range and takes it in
+   chunks of grain indices. A thread that runs out steals the upper half
+   of what is left to another thread, so uneven work (points that need
+   an exhaustive search, say) is balanced without a shared queue. Loop
+   bodies write only to their own indices, so results do not depend on
+   the number of threads or on which thread ran which chunk.
+
+   parallelFor() is called from the main R thread only, and loop bodies
+   must not use the R API. */
+
+#define THREADS_MAX 256
+
+typedef struct
+{
+	pthread_mutex_t lock;
+	R_xlen_t next, end; /* indices not yet taken */
+	char pad[64];		/* keep the ranges of different threads apart */
+} rangeT;
+
+static struct
+{
+	int threads;		 /* threads in the pool, counting the calling thread */
+	pthread_t *workers;	 /* threads - 1 workers */
+	rangeT *ranges;		 /* one per thread */
+	pthread_mutex_t lock;
+	pthread_cond_t start, done;
+	unsigned long generation; /* number of loops started */
+	int busy;				  /* workers still running the current loop */
+	boolT stop;
+	void (*body)(void *, R_xlen_t, R_xlen_t);
+	void *ctx;
+	R_xlen_t grain;
+} pool = {0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+		   PTHREAD_COND_INITIALIZER, 0, 0, False, NULL, NULL, 0};
+
+/* Take the next chunk of thread self's range, stealing half of another
+   thread's range when its own is empty. Returns False when no work is
+   left anywhere. */
+static boolT takeChunk(int self, R_xlen_t *begin, R_xlen_t *end)
+{
+	rangeT *own = &pool.ranges[self], *victim;
+	R_xlen_t left, mid, stolen;
+	int i;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&own->lock);
+		if (own->next < own->end)
+		{
+			*begin = own->next;
+			*end = (own->end - own->next > pool.grain) ? own->next + pool.grain : own->end;
+			own->next = *end;
+			pthread_mutex_unlock(&own->lock);
+			return (True);
+		}
+		pthread_mutex_unlock(&own->lock);
+
+		for (i = 1; i < pool.threads; i++)
+		{
+			victim = &pool.ranges[(self + i) % pool.threads];
+			pthread_mutex_lock(&victim->lock);
+			left = victim->end - victim->next;
+			if (left > 0)
+			{
+				mid = (left > pool.grain) ? victim->next + left / 2 : victim->next;
+				stolen = victim->end;
+				victim->end = mid;
+				pthread_mutex_unlock(&victim->lock);
+				pthread_mutex_lock(&own->lock);
+				own->next = mid;
+				own->end = stolen;
+				pthread_mutex_unlock(&own->lock);
+				break;
+			}
+			pthread_mutex_unlock(&victim->lock);
+		}
+		if (i == pool.threads)
+			return (False);
+	}
+}
+
+static void runChunks(int self)
+{
+	R_xlen_t begin, end;
+	while (takeChunk(self, &begin, &end))
+		pool.body(pool.ctx, begin, end);
+}
+
+static void *poolWorker(void *arg)
+{
+	int self = (int)(intptr_t)arg;
+	unsigned long seen = 0;
+
+	pthread_mutex_lock(&pool.lock);
+	for (;;)
+	{
+		while (!pool.stop && pool.generation == seen)
+			pthread_cond_wait(&pool.start, &pool.lock);
+		if (pool.stop)
+			break;
+		seen = pool.generation;
+		pthread_mutex_unlock(&pool.lock);
+		runChunks(self);
+		pthread_mutex_lock(&pool.lock);
+		if (--pool.busy == 0)
+			pthread_cond_signal(&pool.done);
+	}
+	pthread_mutex_unlock(&pool.lock);
+	return (NULL);
+}
+
+/* Stop and join the workers */
+void stopThreadPool(void)
+{
+	int i;
+	if (!pool.ranges)
+		return;
+	pthread_mutex_lock(&pool.lock);
+	pool.stop = True;
+	pthread_cond_broadcast(&pool.start);
+	pthread_mutex_unlock(&pool.lock);
+	for (i = 0; i < pool.threads - 1; i++)
+		pthread_join(pool.workers[i], NULL);
+	for (i = 0; i < pool.threads; i++)
+		pthread_mutex_destroy(&pool.ranges[i].lock);
+	free(pool.workers);
+	free(pool.ranges);
+	pool.workers = NULL;
+	pool.ranges = NULL;
+	pool.threads = 0;
+	pool.stop = False;
+}
+
+/* A child forked by R (parallel::mclapply, say) has none of the
+   workers, so it starts again without a pool */
+static void forgetThreadPool(void)
+{
+	pool.threads = 0;
+	pool.workers = NULL;
+	pool.ranges = NULL;
+	pool.busy = 0;
+	pool.stop = False;
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.start, NULL);
+	pthread_cond_init(&pool.done, NULL);
+}
+
+/* Start a pool of threads threads, or as many as can be created */
+static void startThreadPool(int threads)
+{
+	static boolT atfork = False;
+	int i;
+
+	if (!atfork)
+	{
+		pthread_atfork(NULL, NULL, forgetThreadPool);
+		atfork = True;
+	}
+	pool.workers = (pthread_t *)malloc((threads - 1) * sizeof(pthread_t));
+	pool.ranges = (rangeT *)calloc(threads, sizeof(rangeT));
+	if (!pool.workers || !pool.ranges)
+	{
+		free(pool.workers);
+		free(pool.ranges);
+		pool.workers = NULL;
+		pool.ranges = NULL;
+		pool.threads = 0;
+		return;
+	}
+	for (i = 0; i < threads; i++)
+		pthread_mutex_init(&pool.ranges[i].lock, NULL);
+	pool.generation = 0;
+	for (i = 0; i < threads - 1; i++)
+		if (pthread_create(&pool.workers[i], NULL, poolWorker, (void *)(intptr_t)(i + 1)))
+			break;
+	pool.threads = i + 1;
+}
+
+static int parseThreads(const char *text)
+{
+	char *end;
+	long value;
+	if (!text || !*text)
+		return (0);
+	value = strtol(text, &end, 10);
+	return ((*end || value < 1) ? 0 : (value > THREADS_MAX ? THREADS_MAX : (int)value));
+}
+
+/* The number of threads parallel kernels may use */
+int threadCount(void)
+{
+	static const char *variables[] = {"COMPGEOMETER_THREADS", "OMP_THREAD_LIMIT", "OMP_NUM_THREADS"};
+	SEXP option = GetOption1(install("compGeometeR.threads"));
+	const char *check;
+	long cores;
+	size_t i;
+	int threads;
+
+	if (option != R_NilValue)
+	{
+		double value = asReal(option);
+		if (ISNAN(value) || value < 1)
+			error("The compGeometeR.threads option must be a positive whole number.");
+		return (value > THREADS_MAX ? THREADS_MAX : (int)value);
+	}
+	for (i = 0; i < sizeof(variables) / sizeof(variables[0]); i++)
+		if ((threads = parseThreads(getenv(variables[i]))))
+			return (threads);
+	/* R CMD check allows packages two cores */
+	check = getenv("_R_CHECK_LIMIT_CORES_");
+	cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if (check && *check && strcmp(check, "false") && strcmp(check, "FALSE") && cores > 2)
+		cores = 2;
+	return ((cores < 1) ? 1 : (cores > THREADS_MAX ? THREADS_MAX : (int)cores));
+}
+
+/* Call body(ctx, begin, end) on disjoint ranges covering [0, n), in
+   chunks of about grain indices, on the threads of the pool */
+void parallelFor(R_xlen_t n, R_xlen_t grain, void (*body)(void *ctx, R_xlen_t begin, R_xlen_t end), void *ctx)
+{
+	int i, threads = threadCount();
+	R_xlen_t share;
+
+	if (grain < 1)
+		grain = 1;
+	if (threads <= 1 || n <= grain)
+	{
+		if (n > 0)
+			body(ctx, 0, n);
+		return;
+	}
+	if (pool.threads != threads)
+	{
+		stopThreadPool();
+		startThreadPool(threads);
+		if (pool.threads <= 1)
+		{
+			stopThreadPool();
+			body(ctx, 0, n);
+			return;
+		}
+	}
+
+	pool.body = body;
+	pool.ctx = ctx;
+	pool.grain = grain;
+	share = n / pool.threads;
+	for (i = 0; i < pool.threads; i++)
+	{
+		pool.ranges[i].next = share * i;
+		pool.ranges[i].end = (i == pool.threads - 1) ? n : share * (i + 1);
+	}
+	pthread_mutex_lock(&pool.lock);
+	pool.busy = pool.threads - 1;
+	pool.generation++;
+	pthread_cond_broadcast(&pool.start);
+	pthread_mutex_unlock(&pool.lock);
+
+	runChunks(0);
+
+	pthread_mutex_lock(&pool.lock);
+	while (pool.busy)
+		pthread_cond_wait(&pool.done, &pool.lock);
+	pthread_mutex_unlock(&pool.lock);
+}
+
+/* Number of threads the package uses, for geometry_threads() */
+SEXP C_threadCount(void)
+{
+	return (ScalarInteger(threadCount()));
+}
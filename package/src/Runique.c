@@ -0,0 +1,119 @@
+/* Copyright (C) 2018
+
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+*/
+#include "RcompGeomete.h"
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Duplicate points, found before the points are given to qhull, which
+   would otherwise treat every copy as a coplanar point. Points are
+   compared through an open-addressing hash table of their coordinates,
+   optionally rounded to multiples of a tolerance, so the pass is linear
+   in the number of points. */
+
+typedef struct
+{
+	const double *x; /* n x dim, column-major as in R */
+	R_xlen_t n;
+	int dim;
+	double tolerance; /* 0 to compare coordinates exactly */
+} duplicateT;
+
+/* Coordinate j of point i as compared: rounded to a multiple of the
+   tolerance, and with -0 made +0 so that it hashes as it compares */
+static double duplicateKey(const duplicateT *task, R_xlen_t i, int j)
+{
+	double x = task->x[i + task->n * j];
+	if (task->tolerance > 0)
+		x = nearbyint(x / task->tolerance);
+	return (x + 0.0);
+}
+
+static uint64_t hashPoint(const duplicateT *task, R_xlen_t i)
+{
+	uint64_t h = 0xcbf29ce484222325ULL, word;
+	double key;
+	int j;
+	for (j = 0; j < task->dim; j++)
+	{
+		key = duplicateKey(task, i, j);
+		memcpy(&word, &key, sizeof(word));
+		h ^= word;
+		h *= 0x100000001b3ULL;
+		h ^= h >> 29;
+	}
+	/* splitmix64 finaliser */
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	return (h ^ (h >> 31));
+}
+
+static int samePoint(const duplicateT *task, R_xlen_t a, R_xlen_t b)
+{
+	int j;
+	for (j = 0; j < task->dim; j++)
+		if (duplicateKey(task, a, j) != duplicateKey(task, b, j))
+			return (0);
+	return (1);
+}
+
+/* For each point of p, the 1-based index of the first point equal to it,
+   which is its own index unless it is a duplicate. With a positive
+   tolerance, points whose coordinates round to the same multiples of it
+   are equal. */
+SEXP C_duplicatePoints(SEXP p, SEXP tolerance)
+{
+	duplicateT task;
+	R_xlen_t i, slot, size = 16, mask, *table;
+	SEXP first;
+	int *id;
+
+	if (!isMatrix(p) || !isReal(p))
+		error("points must be a real matrix");
+	task.n = nrows(p);
+	task.dim = ncols(p);
+	task.tolerance = asReal(tolerance);
+	if (ISNAN(task.tolerance) || task.tolerance < 0)
+		error("tolerance must be zero or positive");
+	task.x = REAL(p);
+
+	while (size < 2 * task.n)
+		size *= 2;
+	mask = size - 1;
+	table = (R_xlen_t *)malloc(size * sizeof(R_xlen_t));
+	if (!table)
+		error("Unable to allocate memory for %ld points", (long)task.n);
+	for (slot = 0; slot < size; slot++)
+		table[slot] = -1;
+
+	PROTECT(first = allocVector(INTSXP, task.n));
+	id = INTEGER(first);
+	for (i = 0; i < task.n; i++)
+	{
+		slot = hashPoint(&task, i) & mask;
+		while (table[slot] >= 0 && !samePoint(&task, table[slot], i))
+			slot = (slot + 1) & mask;
+		if (table[slot] < 0)
+			table[slot] = i;
+		id[i] = (int)table[slot] + 1;
+	}
+	free(table);
+	UNPROTECT(1);
+	return (first);
+}
@@ -19,82 +19,69 @@
 //[[Rcpp::plugins(cpp11)]]
 
 #include "RcompGeomete.h"
-#include <unistd.h> /* For unlink() */
 
-SEXP C_voronoiR(const SEXP p, const SEXP options, SEXP tmpdir)
+SEXP C_voronoiR(const SEXP p, const SEXP options, const SEXP what)
 {
-  SEXP retlist, retnames;                                  /* Return list and names */
-  int retlen = 5;                                          /* Length of return list */
-  SEXP tri, circumRadii;                                   /* The triangulation, array of circumradii */
-  SEXP neighbour, neighbours;                              /* List of neighbours */
-  SEXP voronoiRegion, voronoiRegions;                      /*voronoi region */
-  SEXP voronoiVertices, point0, pointRegion, pointRegions; /* voronoi vertices and  */
-  int i, j;
-  unsigned dim, n, simpliexDim, simplexRow, nk;
-  int exitcode = 1;
-  boolT ismalloc;
+  SEXP retlist;
   char flags[250]; /* option flags for qhull, see qh_opt.htm */
+  char kind[16];
   double *pt_array;
+  boolT ismalloc;
+  int exitcode;
 
-  /* Initialise return values */
-  tri = voronoiVertices = point0 = retlist = circumRadii = voronoiRegions = pointRegions = R_NilValue;
-
-  /* We cannot print directly to stdout in R, and the alternative of
-   using R_Outputfile does not seem to work for all
-   architectures. Setting outfile to NULL, is not an option, as an
-   open file handle is required for a call to freopen in the Qhull
-   code when qh_new_qhull() is called. Therefore use the ersatz
-   stdout, tmpstdout (see below). */
-  /* FILE *outfile = NULL; */
-  /* qh_fprintf() in userprint.c has been redefined so that a NULL
-   errfile results in printing via REprintf(). */
-  FILE *errfile = NULL;
-
-  if (!isString(options) || length(options) != 1)
-  {
-    error("Second argument must be a single string.");
-  }
-  if (!isMatrix(p) || !isReal(p))
+  checkQhullInput(p, options);
+  if (!isInteger(what) || length(what) != 1)
   {
-    error("First argument should be a real matrix.");
+    error("Third argument must be a single integer.");
   }
+  snprintf(flags, sizeof(flags), QHULL_DELAUNAYcmd, CHAR(STRING_ELT(options, 0)));
 
-  /* Read options into command */
-  i = LENGTH(STRING_ELT(options, 0));
-  if (i > 200)
-    error("Option string too long");
-  snprintf(flags, sizeof(flags), "qhull d Qbb T0 Fn %s", CHAR(STRING_ELT(options, 0)));
+  /* Return the earlier result if this geometry has been built before */
+  snprintf(kind, sizeof(kind), "voronoi%d", INTEGER(what)[0]);
+  retlist = cacheLookup(kind, p, options);
+  if (retlist != R_NilValue)
+    return retlist;
 
-  /* Check input matrix */
-  dim = ncols(p);
-  n = nrows(p);
-  if (dim <= 0 || n <= 0)
-  {
-    error("Invalid input matrix.");
-  }
-  if (n <= dim)
+  pt_array = copyPoints(p, &ismalloc);
+  qhT *qh = (qhT *)malloc(sizeof(qhT));
+  if (!qh)
   {
-    error("Number of points is not greater than the number of dimensions.");
+    freePoints(p, pt_array);
+    error("Unable to allocate memory for qhull");
   }
+  exitcode = runQhull(qh, newMessageStream(), pt_array, ncols(p), nrows(p), ismalloc, flags, NULL);
+  return voronoiResult(qh, exitcode, pt_array, p, options, INTEGER(what)[0]);
+}
 
-  i = 0, j = 0;
-
-  pt_array = (double *)R_alloc(n * dim, sizeof(double));
-  for (i = 0; i < n; i++)
-    for (j = 0; j < dim; j++)
-      pt_array[dim * i + j] = REAL(p)[i + n * j];
-  ismalloc = False; /* True if qhull should free points in qh_freeqhull() or reallocation */
+/* Extract the Voronoi diagram built by runQhull() into an R list with
+   the components selected by want. Takes ownership of qh and pt_array;
+   the hull is attached to the result, or freed if qhull failed. Also
+   used to collect background jobs, see Rjob.c. */
+SEXP voronoiResult(qhT *qh, int exitcode, double *pt_array, const SEXP p, const SEXP options, int want)
+{
+  SEXP retlist, retnames;                                  /* Return list and names */
+  int retlen = 6;                                          /* Length of return list */
+  SEXP tri, circumRadii;                                   /* The triangulation, array of circumradii */
+  SEXP neighbours, buffer;                                 /* List of neighbours, native store of their ids */
+  SEXP single;                                             /* Native store of single precision voronoi vertices */
+  void *vertices;
+  SEXP voronoiRegion, voronoiRegions;                      /*voronoi region */
+  SEXP voronoiVertices, point0, pointRegions;              /* voronoi vertices and  */
+  int j, *neighbourIds;
+  int nprotect;
+  char kind[16];
+  unsigned dim = ncols(p), n = nrows(p), simpliexDim, simplexRow;
 
-  const char *name;
+  /* Initialise return values */
+  tri = voronoiVertices = point0 = retlist = circumRadii = voronoiRegions = pointRegions = single = R_NilValue;
+  vertices = NULL;
 
-  name = R_tmpnam("Rf", CHAR(STRING_ELT(tmpdir, 0)));
-  qhT *qh = (qhT *)malloc(sizeof(qhT));
-  qh_zero(qh, errfile);
+  /* We cannot print directly to stdout in R. qhull is given no
+   outfile, and its errfile is an in-memory stream (see
+   newMessageStream()) whose contents are returned to R on error. */
+  FILE *errfile = qh->qhmem.ferr;
+  snprintf(kind, sizeof(kind), "voronoi%d", want);
 
-  exitcode = qh_new_qhull(qh, dim, n, pt_array, ismalloc, flags, tmpstdout, errfile);
-  unlink(name);
-  free((char *)name);
-  exitcode = setjmp(qh->errexit);
   if (!exitcode)
   { /* 0 if no error from qhull */
 
@@ -109,9 +96,6 @@ SEXP C_voronoiR(const SEXP p, const SEXP options, SEXP tmpdir)
     qh->VORONOI = True;
     qh->SCALElast = True; /* 'Qbb' */
     qh->KEEPcoplanar = True;
-    printvridgeT printvridge = NULL;
-    boolT inorder = True;
-    qh_RIDGE innerouter = qh_RIDGEall;
 
     if (dim >= 5)
     {
@@ -127,12 +111,11 @@ SEXP C_voronoiR(const SEXP p, const SEXP options, SEXP tmpdir)
       {
         nf++;
       }
-      nk = nf;
       /* Double check. Non-simplicial facets will cause segfault
        below */
       if (!facet->simplicial)
       {
-        Rprintf("Qhull returned non-simplicial facets -- try delaunayn with different options");
+        messageStreamPrintf(errfile, "Qhull returned non-simplicial facets -- try delaunayn with different options\n");
         exitcode = 1;
         break;
       }
@@ -192,12 +175,36 @@ SEXP C_voronoiR(const SEXP p, const SEXP options, SEXP tmpdir)
     /* Iterate through facets to extract information */
     int i = 0;
 
-    /* Alocate the space in R */
+    /* Neighbour ids are the numbers given to the lower facets */
+    numberDelaunayFacets(qh);
+
+    /* Alocate the space in R for the requested components only */
+    nprotect = 2;
     PROTECT(tri = allocMatrix(INTSXP, nf, dim + 1));
-    // PROTECT(circumRadii = allocMatrix(REALSXP, nf, 1));
-    PROTECT(neighbours = allocVector(VECSXP, nf));
-    PROTECT(voronoiVertices = allocMatrix(REALSXP, nf, dim));
-    PROTECT(point0 = allocMatrix(REALSXP, nf, dim));
+    if (want & WANT_CIRCUMRADII)
+    {
+      PROTECT(circumRadii = allocVector(REALSXP, nf));
+      nprotect++;
+    }
+    if (want & WANT_NEIGHBOURS)
+    {
+      PROTECT(buffer = newNeighbourBuffer(nf, dim + 1));
+      nprotect++;
+      neighbourIds = neighbourBufferData(buffer);
+    }
+    if ((want & WANT_CIRCUMCENTRES) && (want & WANT_SINGLE))
+    {
+      PROTECT(single = newSingleBuffer((R_xlen_t)nf * dim));
+      nprotect++;
+      vertices = singleBufferData(single);
+    }
+    else if (want & WANT_CIRCUMCENTRES)
+    {
+      PROTECT(voronoiVertices = allocMatrix(REALSXP, nf, dim));
+      nprotect++;
+      vertices = REAL(voronoiVertices);
+    }
+    facetT **lower = (facetT **)R_alloc(nf, sizeof(facetT *));
     FORALLfacets
     {
 
@@ -208,14 +215,10 @@ SEXP C_voronoiR(const SEXP p, const SEXP options, SEXP tmpdir)
           error("Trying to access non-existent facet %i", i);
         }
 
-        qh_eachvoronoi_all(qh, errfile, printvridge, qh->UPPERdelaunay, innerouter, inorder);
-
         /* ********************* Point Region *****************************************/
 
         /* region point */
 
-        PROTECT(pointRegion = allocVector(INTSXP, qh_setsize(qh, facet->coplanarset)));
-
         if (facet->coplanarset)
         {
 
@@ -239,12 +242,6 @@ SEXP C_voronoiR(const SEXP p, const SEXP options, SEXP tmpdir)
 
         /* **************** Triangulation *************************************/
 
-        boolT inorder = True;
-
-        qh_RIDGE innerouter = qh_RIDGEall;
-        printvridgeT printvridge = NULL;
-        qh_eachvoronoi_all(qh, errfile, printvridge, qh->UPPERdelaunay, innerouter, inorder);
-
         int j = 0;
 
         if (qh->hull_dim == 3 && facet->toporient == qh_ORIENTclock)
@@ -315,67 +312,39 @@ SEXP C_voronoiR(const SEXP p, const SEXP options, SEXP tmpdir)
         /* **************** END Triangulation *************************************/
 
         /* ***************************************Neighbours***************************** */
-        PROTECT(neighbour = allocVector(INTSXP, qh_setsize(qh, facet->neighbors)));
-        j = 0;
-        FOREACHneighbor_(facet)
-        {
-
-          INTEGER(neighbour)
-          [j] = neighbor->visitid ? neighbor->visitid : 0 - neighbor->id;
-
-          j++;
-        }
-        SET_VECTOR_ELT(neighbours, i, neighbour);
-        UNPROTECT(2);
-
-        /* ***************************************End Neighbours***************************** */
-
-        /* voronoi vertices */
-        int k, num;
-
-        if (qh->CENTERtype == qh_ASvoronoi)
+        if (want & WANT_NEIGHBOURS)
         {
-          num = qh->hull_dim - 1;
-
-          if (!facet->normal || !facet->upperdelaunay || !qh->ATinfinity)
-          {
-            if (!facet->center)
-              facet->center = qh_facetcenter(qh, facet->vertices);
-
-            for (k = 0; k < num; k++)
-            {
-
-              REAL(voronoiVertices)
-              [i + nf * k] = facet->center[k];
-            }
-          }
-          else
+          j = 0;
+          FOREACHneighbor_(facet)
           {
-            for (k = 0; k < num; k++)
-            {
-              REAL(voronoiVertices)
-              [i + nf * k] = qh_INFINITE;
-            }
+            if (j > dim)
+              break;
+            neighbourIds[i * (dim + 1) + j] = neighbor->visitid ? neighbor->visitid : 0 - neighbor->id;
+            j++;
           }
         }
-        else /* qh.CENTERtype == qh_AScentrum */
-        {
-          num = qh->hull_dim;
-          num--;
 
-          if (!facet->center)
-            facet->center = qh_getcentrum(qh, facet);
-          for (k = 0; k < num; k++)
-          {
-            REAL(voronoiVertices)
-            [i + nf * k] = facet->center[k];
-          }
-        }
+        /* ***************************************End Neighbours***************************** */
+
+        /* Voronoi vertices and circumradii are computed from the
+           vertices afterwards */
+        lower[i] = facet;
 
         i++;
       }
     }
 
+    /* voronoi vertices, and circumradii, the distance from the voronoi
+       vertex to a vertex */
+    if (want & (WANT_CIRCUMCENTRES | WANT_CIRCUMRADII))
+      delaunayCircumspheres(qh, lower, nf, dim, vertices, single != R_NilValue,
+                            (want & WANT_CIRCUMRADII) ? REAL(circumRadii) : NULL);
+    if (single != R_NilValue)
+    {
+      PROTECT(voronoiVertices = lazySingle(single, nf, dim));
+      nprotect++;
+    }
+
     unsigned int firstTemp = 0, secondTemp = 0;
     simpliexDim = ncols(tri);
     simplexRow = nrows(tri);
@@ -391,24 +360,14 @@ SEXP C_voronoiR(const SEXP p, const SEXP options, SEXP tmpdir)
       [i + simplexRow] = firstTemp;
     }
 
-    i = 0, j = 0;
-
-    int k = 0;
-    for (j = 0; j < nrows(tri); j++)
+    // the neighbours and first point of each simplex are computed when used, see Rlazy.c
+    if (want & WANT_NEIGHBOURS)
     {
-      // get the point value using the trigulation index
-      int value = INTEGER(tri)[j];
-      REAL(point0)
-      [j] = REAL(p)[value];
-
-      for (i = 1; i < ncols(p); i++)
-      {
-
-        REAL(point0)
-        [k + nk * i] = REAL(p)[value + nrows(p) * i];
-      }
-      k++;
+      PROTECT(neighbours = lazyNeighbours(buffer, nf, dim + 1, False));
+      nprotect++;
     }
+    PROTECT(point0 = lazyFirstVertices(p, tri));
+    nprotect++;
 
     /* ********************CIRCUMRADII ******************************************
      * commented out, now done in R
@@ -425,8 +384,8 @@ SEXP C_voronoiR(const SEXP p, const SEXP options, SEXP tmpdir)
   }
   else
   { /* exitcode != 1 */
-    /* There has been an error; Qhull will print the error
-   message */
+    /* There has been an error; Qhull has written the error message
+       to errfile, which is returned to R below */
     PROTECT(tri = allocMatrix(INTSXP, 0, dim + 1));
     PROTECT(neighbours = allocVector(VECSXP, 0));
     // PROTECT(circumRadii = allocMatrix(REALSXP, 0, 1));
@@ -434,6 +393,7 @@ SEXP C_voronoiR(const SEXP p, const SEXP options, SEXP tmpdir)
     PROTECT(point0 = allocMatrix(REALSXP, 0, dim));
     // PROTECT(voronoiRegions = allocVector(VECSXP, 0));
     PROTECT(pointRegions = allocVector(VECSXP, 0));
+    nprotect = 5;
 
     /* If the error been because the points are colinear, coplanar
      &c., then avoid mentioning an error by setting exitcode=2*/
@@ -448,9 +408,8 @@ SEXP C_voronoiR(const SEXP p, const SEXP options, SEXP tmpdir)
   SET_VECTOR_ELT(retlist, 0, voronoiVertices);
   SET_VECTOR_ELT(retnames, 0, mkChar("voronoi_vertices"));
 
-  // done in R
-  // SET_VECTOR_ELT(retlist, 1,circumRadii);
-  // SET_VECTOR_ELT(retnames, 1, mkChar("circumRadii"));
+  SET_VECTOR_ELT(retlist, 5, circumRadii);
+  SET_VECTOR_ELT(retnames, 5, mkChar("circumradii"));
 
   SET_VECTOR_ELT(retlist, 1, tri);
   SET_VECTOR_ELT(retnames, 1, mkChar("tri"));
@@ -467,7 +426,8 @@ SEXP C_voronoiR(const SEXP p, const SEXP options, SEXP tmpdir)
   SET_VECTOR_ELT(retnames, 4, mkChar("point_regions"));
 
   setAttrib(retlist, R_NamesSymbol, retnames);
-  UNPROTECT(8);
+  UNPROTECT(nprotect + 2);
+  PROTECT(retlist);
 
   /* Register qhullFinalizer() for garbage collection and attach a
    pointer to the hull as an attribute for future use. */
@@ -478,26 +438,23 @@ SEXP C_voronoiR(const SEXP p, const SEXP options, SEXP tmpdir)
   PROTECT(ptr = R_MakeExternalPtr(qh, tag, R_NilValue));
   if (exitcode)
   {
-    // qhullFinalizer(ptr);
+    /* Hand qhull's messages back to R, see qhull_check() */
+    if (exitcode != 2)
+      setQhullError(retlist, exitcode, errfile);
+    R_ClearExternalPtr(ptr);
+    /* qhull takes ownership of pt_array once it has read the points */
+    boolT owned = (qh->first_point == pt_array || qh->input_points == pt_array);
+    freeQhull(qh);
+    if (!owned)
+      freePoints(p, pt_array);
   }
   else
   {
-    // R_RegisterCFinalizerEx(ptr, qhullFinalizer, TRUE);
+    R_RegisterCFinalizerEx(ptr, qhullFinalizer, TRUE);
     setAttrib(retlist, tag, ptr);
+    cacheStore(kind, p, options, retlist);
   }
-  UNPROTECT(1);
-
-  if (exitcode & (exitcode != 2))
-  {
-    if (exitcode == 1)
-    {
-      error("Qhull returned non-simplicial facets -- try delaunayn with different options. exitcode %d", exitcode);
-    }
-    else
-    {
-      error("Received error code %d from qhull.", exitcode);
-    }
-  }
+  UNPROTECT(3);
 
   return retlist;
 }
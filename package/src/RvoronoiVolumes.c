@@ -0,0 +1,450 @@
+/* Copyright (C) 2018
+
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+*/
+#include "RcompGeomete.h"
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The areas (volumes in 3D and above) of the Voronoi cells of the
+   points of a Delaunay triangulation.
+
+   A cell is the union of the pyramids from its site over its faces.
+   The face shared with a Delaunay neighbour lies on the bisector of
+   their edge, at half its length from the site, and has as vertices
+   the circumcentres of the simplices about the edge. In 2 and 3
+   dimensions the cells are summed from these stars of simplices, the
+   face about each edge of the site in 3D being found by walking the
+   ring of tetrahedra around the edge, in order. Cells that are
+   unbounded or cut by the box, that touch a flat simplex, or that are
+   in more dimensions are instead intersected from the halfspaces of
+   their bisectors and the box. */
+
+#define VORONOI_MEASURED 0
+#define VORONOI_MISSING 1 /* the point is in no simplex */
+#define VORONOI_FAILED 2
+
+typedef struct
+{
+	const meshT *mesh;
+	const R_xlen_t *starts; /* offsets into star of the cells of each point */
+	const R_xlen_t *star;
+	double *centres; /* ncells x dim */
+	double *radii;	 /* 0 for flat cells */
+	const double *mins, *maxs; /* the box, or NULL */
+	double *volumes;
+	char *status;
+} voronoiT;
+
+/* The neighbours of a site and buffers for its halfspaces and the
+   faces about its edges, grown as needed */
+typedef struct
+{
+	int *sites;
+	int nsites, sizeSites;
+	double *ring;
+	int sizeRing;
+	double *halfspaces;
+	int sizeHalfspaces;
+	FILE *errfile;
+	boolT failed;
+} cellBufferT;
+
+/* The circumcentres of the cells begin..end-1, with a radius of 0 for
+   flat cells */
+static void cellCentreChunk(void *ctx, R_xlen_t begin, R_xlen_t end)
+{
+	const voronoiT *task = (const voronoiT *)ctx;
+	const meshT *mesh = task->mesh;
+	const double *v[MESH_DIMmax + 1];
+	double a[MESH_DIMmax * MESH_DIMmax], size, length;
+	R_xlen_t c;
+	int dim = mesh->dim, j, k;
+
+	for (c = begin; c < end; c++)
+	{
+		size = 0;
+		for (k = 0; k < mesh->nv; k++)
+		{
+			v[k] = mesh->points + (R_xlen_t)mesh->cells[c * mesh->nv + k] * dim;
+			if (k == 0)
+				continue;
+			length = 0;
+			for (j = 0; j < dim; j++)
+			{
+				a[(k - 1) * dim + j] = v[k][j] - v[0][j];
+				length += a[(k - 1) * dim + j] * a[(k - 1) * dim + j];
+			}
+			size = fmax(size, sqrt(length));
+		}
+		if (fabs(determinant(a, dim)) <= MESH_EPSILON * pow(size, dim) ||
+			!simplexCircumcentre(v, dim, task->centres + c * dim, task->radii + c))
+			task->radii[c] = 0;
+	}
+}
+
+static void addSite(cellBufferT *buffer, int q)
+{
+	int k, *grown;
+	for (k = 0; k < buffer->nsites; k++)
+		if (buffer->sites[k] == q)
+			return;
+	if (buffer->nsites == buffer->sizeSites)
+	{
+		buffer->sizeSites = buffer->sizeSites ? 2 * buffer->sizeSites : 64;
+		grown = (int *)realloc(buffer->sites, buffer->sizeSites * sizeof(int));
+		if (!grown)
+		{
+			buffer->failed = True;
+			return;
+		}
+		buffer->sites = grown;
+	}
+	buffer->sites[buffer->nsites++] = q;
+}
+
+static double pointDistance(const meshT *mesh, int p, int q)
+{
+	const double *x = mesh->points + (R_xlen_t)p * mesh->dim, *y = mesh->points + (R_xlen_t)q * mesh->dim;
+	double d2 = 0;
+	int j;
+	for (j = 0; j < mesh->dim; j++)
+		d2 += (x[j] - y[j]) * (x[j] - y[j]);
+	return (sqrt(d2));
+}
+
+/* The area of the cell of the 2D site p: the face shared with each
+   neighbour a of a triangle joins its circumcentre to that of the
+   triangle across their edge, and each edge is met from both of its
+   triangles. */
+static int starArea(const voronoiT *task, int p, double *area)
+{
+	const meshT *mesh = task->mesh;
+	const double *c0, *c1;
+	R_xlen_t s, t, nb;
+	int k, ip;
+
+	*area = 0;
+	for (s = task->starts[p]; s < task->starts[p + 1]; s++)
+	{
+		t = task->star[s];
+		for (ip = 0; mesh->cells[t * 3 + ip] != p; ip++)
+			;
+		for (k = 0; k < 3; k++)
+		{
+			if (k == ip)
+				continue;
+			nb = mesh->neighbours[t * 3 + (3 - ip - k)] - 1;
+			if (nb < 0)
+				return (0);
+			c0 = task->centres + t * 2;
+			c1 = task->centres + nb * 2;
+			*area += pointDistance(mesh, p, mesh->cells[t * 3 + k]) *
+					 sqrt((c1[0] - c0[0]) * (c1[0] - c0[0]) + (c1[1] - c0[1]) * (c1[1] - c0[1])) / 8;
+		}
+	}
+	return (1);
+}
+
+/* The volume of the cell of the 3D site p: the face shared with each
+   neighbour q is the polygon of the circumcentres of the ring of
+   tetrahedra about the edge pq, which is walked in order across the
+   triangles that hold the edge. */
+static int starVolume(const voronoiT *task, int p, cellBufferT *buffer, double *volume)
+{
+	const meshT *mesh = task->mesh;
+	const double *r0, *r1, *r2;
+	double *grown, normal[3], u[3], w[3];
+	R_xlen_t s, t, cur, nb, steps;
+	int a, k, j, q, x, y, z, count, nstar = (int)(task->starts[p + 1] - task->starts[p]);
+
+	*volume = 0;
+	if (buffer->sizeRing < nstar)
+	{
+		grown = (double *)realloc(buffer->ring, (size_t)nstar * 3 * sizeof(double));
+		if (!grown)
+			return (0);
+		buffer->ring = grown;
+		buffer->sizeRing = nstar;
+	}
+	for (a = 0; a < buffer->nsites; a++)
+	{
+		q = buffer->sites[a];
+		/* A tetrahedron on the edge, and its other two points */
+		for (s = task->starts[p]; s < task->starts[p + 1]; s++)
+		{
+			t = task->star[s];
+			for (k = 0; k < 4 && mesh->cells[t * 4 + k] != q; k++)
+				;
+			if (k < 4)
+				break;
+		}
+		x = y = -1;
+		for (k = 0; k < 4; k++)
+		{
+			z = mesh->cells[t * 4 + k];
+			if (z == p || z == q)
+				continue;
+			if (x < 0)
+				x = z;
+			else
+				y = z;
+		}
+
+		/* Step across the triangle pqy to the next tetrahedron, whose
+		   fourth point is the next y */
+		count = 0;
+		cur = t;
+		for (steps = 0; steps < nstar; steps++)
+		{
+			memcpy(buffer->ring + (size_t)count++ * 3, task->centres + cur * 3, 3 * sizeof(double));
+			for (k = 0; mesh->cells[cur * 4 + k] != x; k++)
+				;
+			nb = mesh->neighbours[cur * 4 + k] - 1;
+			if (nb < 0)
+				return (0);
+			for (k = 0; k < 4; k++)
+			{
+				z = mesh->cells[nb * 4 + k];
+				if (z != p && z != q && z != y)
+					break;
+			}
+			x = y;
+			y = z;
+			cur = nb;
+			if (cur == t)
+				break;
+		}
+		if (cur != t)
+			return (0);
+
+		/* The area of the polygon from its vector area */
+		memset(normal, 0, sizeof(normal));
+		r0 = buffer->ring;
+		for (k = 1; k + 1 < count; k++)
+		{
+			r1 = buffer->ring + (size_t)k * 3;
+			r2 = r1 + 3;
+			for (j = 0; j < 3; j++)
+			{
+				u[j] = r1[j] - r0[j];
+				w[j] = r2[j] - r0[j];
+			}
+			normal[0] += u[1] * w[2] - u[2] * w[1];
+			normal[1] += u[2] * w[0] - u[0] * w[2];
+			normal[2] += u[0] * w[1] - u[1] * w[0];
+		}
+		*volume += pointDistance(mesh, p, q) *
+				   sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]) / 12;
+	}
+	return (1);
+}
+
+/* The volume of the cell of site p as the intersection of the
+   halfspaces of the bisectors with its neighbours and of the box,
+   taken about p. It is infinite if the halfspaces are unbounded. */
+static int halfspaceVolume(const voronoiT *task, int p, cellBufferT *buffer, double *volume)
+{
+	const meshT *mesh = task->mesh;
+	const double *x = mesh->points + (R_xlen_t)p * mesh->dim, *y;
+	double *h, *grown, norm, scale = 0;
+	size_t row = (mesh->dim + 1) * sizeof(double);
+	int a, j, m, exitcode, dim = mesh->dim;
+	intersectionT result;
+
+	m = buffer->nsites + (task->mins ? 2 * dim : 0);
+	if (m > buffer->sizeHalfspaces)
+	{
+		grown = (double *)realloc(buffer->halfspaces, m * row);
+		if (!grown)
+			return (0);
+		buffer->halfspaces = grown;
+		buffer->sizeHalfspaces = m;
+	}
+	if (!buffer->errfile && !(buffer->errfile = openMessageStream()))
+		return (0);
+
+	h = buffer->halfspaces;
+	for (a = 0; a < buffer->nsites; a++)
+	{
+		y = mesh->points + (R_xlen_t)buffer->sites[a] * dim;
+		norm = 0;
+		for (j = 0; j < dim; j++)
+		{
+			h[j] = y[j] - x[j];
+			norm += h[j] * h[j];
+		}
+		norm = sqrt(norm);
+		scale = fmax(scale, norm);
+		for (j = 0; j < dim; j++)
+			h[j] /= norm;
+		h[dim] = -norm / 2;
+		h += dim + 1;
+	}
+	if (task->mins)
+		for (j = 0; j < dim; j++)
+		{
+			memset(h, 0, 2 * row);
+			h[j] = 1;
+			h[dim] = x[j] - task->maxs[j];
+			h += dim + 1;
+			h[j] = -1;
+			h[dim] = task->mins[j] - x[j];
+			h += dim + 1;
+			scale = fmax(scale, task->maxs[j] - task->mins[j]);
+		}
+
+	exitcode = intersectHalfspaces(buffer->halfspaces, m, dim, MESH_EPSILON * scale,
+								   buffer->errfile, &result);
+	*volume = (result.radius < INFINITY) ? result.volume : INFINITY;
+	freeIntersection(&result);
+	return (!exitcode);
+}
+
+static void voronoiChunk(void *ctx, R_xlen_t begin, R_xlen_t end)
+{
+	const voronoiT *task = (const voronoiT *)ctx;
+	const meshT *mesh = task->mesh;
+	const double *centre;
+	cellBufferT buffer;
+	R_xlen_t i, s, t;
+	int j, k, p, dim = mesh->dim;
+	boolT hull, flat, inside, done;
+
+	memset(&buffer, 0, sizeof(buffer));
+	for (i = begin; i < end; i++)
+	{
+		task->status[i] = VORONOI_MEASURED;
+		if (task->starts[i] == task->starts[i + 1])
+		{
+			task->status[i] = VORONOI_MISSING;
+			continue;
+		}
+
+		/* The neighbours of the site, and whether it is on the convex
+		   hull, touches a flat simplex, or has all of the vertices of
+		   its cell in the box */
+		p = (int)i;
+		buffer.nsites = 0;
+		hull = flat = False;
+		inside = True;
+		for (s = task->starts[i]; s < task->starts[i + 1]; s++)
+		{
+			t = task->star[s];
+			flat |= (task->radii[t] == 0);
+			for (k = 0; k < mesh->nv; k++)
+			{
+				if (mesh->cells[t * mesh->nv + k] == p)
+					continue;
+				addSite(&buffer, mesh->cells[t * mesh->nv + k]);
+				hull |= !mesh->neighbours[t * mesh->nv + k];
+			}
+			centre = task->centres + t * dim;
+			for (j = 0; task->mins && j < dim; j++)
+				inside &= (centre[j] >= task->mins[j] && centre[j] <= task->maxs[j]);
+		}
+		if (buffer.failed)
+		{
+			task->status[i] = VORONOI_FAILED;
+			continue;
+		}
+
+		if (hull && !task->mins)
+		{
+			task->volumes[i] = INFINITY;
+			continue;
+		}
+		done = False;
+		if (!hull && !flat && inside)
+		{
+			if (dim == 2)
+				done = starArea(task, p, &task->volumes[i]);
+			else if (dim == 3)
+				done = starVolume(task, p, &buffer, &task->volumes[i]);
+		}
+		if (!done && !halfspaceVolume(task, p, &buffer, &task->volumes[i]))
+			task->status[i] = VORONOI_FAILED;
+	}
+	free(buffer.sites);
+	free(buffer.ring);
+	free(buffer.halfspaces);
+	if (buffer.errfile)
+		freeMessageStream(buffer.errfile);
+}
+
+/* The area (volume in 3D and above) of the Voronoi cell of each point
+   of the Delaunay triangulation with the given simplices (see
+   meshFromMatrices()), on the threads of the package's pool. Cells are
+   clipped to the box from mins to maxs, or if these are NULL unbounded
+   cells are Inf. Points in no simplex, such as copies of a point, are
+   NA, as are cells that Qhull fails to intersect, with a warning. */
+SEXP C_voronoiVolumes(const SEXP points, const SEXP simplices, const SEXP mins, const SEXP maxs)
+{
+	meshT mesh;
+	voronoiT task;
+	R_xlen_t *starts, *star, *next, c, i;
+	int k, nfailed = 0;
+	SEXP result;
+
+	meshFromMatrices(points, simplices, True, &mesh);
+	if (mesh.npoints >= INT_MAX)
+		error("Too many points to measure their Voronoi cells");
+	task.mins = task.maxs = NULL;
+	if (!isNull(mins))
+	{
+		if (!isReal(mins) || !isReal(maxs) || XLENGTH(mins) != mesh.dim || XLENGTH(maxs) != mesh.dim)
+			error("mins and maxs must give a number for each dimension");
+		task.mins = REAL(mins);
+		task.maxs = REAL(maxs);
+	}
+
+	/* The cells of each point, in compressed sparse row form */
+	starts = (R_xlen_t *)R_alloc(mesh.npoints + 1, sizeof(R_xlen_t));
+	next = (R_xlen_t *)R_alloc(mesh.npoints + 1, sizeof(R_xlen_t));
+	star = (R_xlen_t *)R_alloc(mesh.ncells * mesh.nv + 1, sizeof(R_xlen_t));
+	memset(starts, 0, (mesh.npoints + 1) * sizeof(R_xlen_t));
+	for (c = 0; c < mesh.ncells * mesh.nv; c++)
+		starts[mesh.cells[c] + 1]++;
+	for (i = 0; i < mesh.npoints; i++)
+		starts[i + 1] += starts[i];
+	memcpy(next, starts, (mesh.npoints + 1) * sizeof(R_xlen_t));
+	for (c = 0; c < mesh.ncells; c++)
+		for (k = 0; k < mesh.nv; k++)
+			star[next[mesh.cells[c * mesh.nv + k]]++] = c;
+
+	task.mesh = &mesh;
+	task.starts = starts;
+	task.star = star;
+	task.centres = (double *)R_alloc(mesh.ncells + 1, mesh.dim * sizeof(double));
+	task.radii = (double *)R_alloc(mesh.ncells + 1, sizeof(double));
+	task.status = (char *)R_alloc(mesh.npoints + 1, sizeof(char));
+	parallelFor(mesh.ncells, THREADS_GRAIN, cellCentreChunk, &task);
+
+	PROTECT(result = allocVector(REALSXP, mesh.npoints));
+	task.volumes = REAL(result);
+	parallelFor(mesh.npoints, 64, voronoiChunk, &task);
+	for (i = 0; i < mesh.npoints; i++)
+		if (task.status[i] != VORONOI_MEASURED)
+		{
+			nfailed += (task.status[i] == VORONOI_FAILED);
+			task.volumes[i] = NA_REAL;
+		}
+	if (nfailed)
+		warning("Qhull could not intersect %d Voronoi cells, which are NA", nfailed);
+	UNPROTECT(1);
+	return (result);
+}
@@ -9,21 +9,80 @@
 
 /* .Call calls */
 extern SEXP C_delaunayn(SEXP, SEXP, SEXP);
-extern SEXP C_convex(SEXP, SEXP, SEXP);
+extern SEXP C_convex(SEXP, SEXP);
 extern SEXP C_voronoiR(SEXP, SEXP, SEXP);
 extern SEXP C_inconvexhull(SEXP, SEXP);
-extern SEXP C_findSimplex(SEXP, SEXP);
+extern SEXP C_findSimplex(SEXP, SEXP, SEXP, SEXP, SEXP);
 extern SEXP C_compGeomete(SEXP,SEXP,SEXP);
+extern SEXP C_cacheStats(void);
+extern SEXP C_cacheClear(void);
+extern SEXP C_saveGeometry(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP C_loadGeometry(SEXP);
+extern SEXP C_mappedFindSimplex(SEXP, SEXP, SEXP);
+extern SEXP C_mappedAlphaComplex(SEXP, SEXP);
+extern SEXP C_mappedInHull(SEXP, SEXP);
+extern SEXP C_jobStart(SEXP, SEXP, SEXP, SEXP);
+extern SEXP C_jobStatus(SEXP);
+extern SEXP C_jobWait(SEXP, SEXP);
+extern SEXP C_jobCancel(SEXP);
+extern SEXP C_jobValue(SEXP);
+extern SEXP C_threadCount(void);
+extern SEXP C_pointFile(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP C_singlePoints(SEXP);
+extern SEXP C_duplicatePoints(SEXP, SEXP);
+extern SEXP C_extremePoints(SEXP);
+extern SEXP C_hullMetrics(SEXP);
+extern SEXP C_hullIntersection(SEXP);
+extern SEXP C_hullOverlaps(SEXP);
+extern SEXP C_interpolate(SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP C_siteIndex(SEXP, SEXP);
+extern SEXP C_nearestSites(SEXP, SEXP, SEXP);
+extern SEXP C_delaunayEdges(SEXP, SEXP, SEXP);
+extern SEXP C_minimumSpanningTree(SEXP, SEXP, SEXP);
+extern SEXP C_alphaComponents(SEXP, SEXP, SEXP, SEXP);
+extern SEXP C_alphaFaces(SEXP, SEXP);
+extern SEXP C_voronoiVolumes(SEXP, SEXP, SEXP, SEXP);
+extern void registerLazyClasses(DllInfo *dll);
+extern void registerPointFileClass(DllInfo *dll);
+extern void stopThreadPool(void);
 
 
 static const R_CallMethodDef CallEntries[] =
 {
 	 {"C_inconvexhull", (DL_FUNC) &C_inconvexhull, 2},
    {"C_delaunayn", (DL_FUNC) &C_delaunayn, 3},
-   {"C_convex", (DL_FUNC) &C_convex, 3},
+   {"C_convex", (DL_FUNC) &C_convex, 2},
 	 {"C_voronoiR", (DL_FUNC) &C_voronoiR, 3},
 	 {"C_compGeomete", (DL_FUNC) &C_compGeomete, 3},
-	 {"C_findSimplex", (DL_FUNC) &C_findSimplex, 2},
+	 {"C_findSimplex", (DL_FUNC) &C_findSimplex, 5},
+	 {"C_cacheStats", (DL_FUNC) &C_cacheStats, 0},
+	 {"C_cacheClear", (DL_FUNC) &C_cacheClear, 0},
+	 {"C_saveGeometry", (DL_FUNC) &C_saveGeometry, 6},
+	 {"C_loadGeometry", (DL_FUNC) &C_loadGeometry, 1},
+	 {"C_mappedFindSimplex", (DL_FUNC) &C_mappedFindSimplex, 3},
+	 {"C_mappedAlphaComplex", (DL_FUNC) &C_mappedAlphaComplex, 2},
+	 {"C_mappedInHull", (DL_FUNC) &C_mappedInHull, 2},
+	 {"C_jobStart", (DL_FUNC) &C_jobStart, 4},
+	 {"C_jobStatus", (DL_FUNC) &C_jobStatus, 1},
+	 {"C_jobWait", (DL_FUNC) &C_jobWait, 2},
+	 {"C_jobCancel", (DL_FUNC) &C_jobCancel, 1},
+	 {"C_jobValue", (DL_FUNC) &C_jobValue, 1},
+	 {"C_threadCount", (DL_FUNC) &C_threadCount, 0},
+	 {"C_pointFile", (DL_FUNC) &C_pointFile, 6},
+	 {"C_singlePoints", (DL_FUNC) &C_singlePoints, 1},
+	 {"C_duplicatePoints", (DL_FUNC) &C_duplicatePoints, 2},
+	 {"C_extremePoints", (DL_FUNC) &C_extremePoints, 1},
+	 {"C_hullMetrics", (DL_FUNC) &C_hullMetrics, 1},
+	 {"C_hullIntersection", (DL_FUNC) &C_hullIntersection, 1},
+	 {"C_hullOverlaps", (DL_FUNC) &C_hullOverlaps, 1},
+	 {"C_interpolate", (DL_FUNC) &C_interpolate, 5},
+	 {"C_siteIndex", (DL_FUNC) &C_siteIndex, 2},
+	 {"C_nearestSites", (DL_FUNC) &C_nearestSites, 3},
+	 {"C_delaunayEdges", (DL_FUNC) &C_delaunayEdges, 3},
+	 {"C_minimumSpanningTree", (DL_FUNC) &C_minimumSpanningTree, 3},
+	 {"C_alphaComponents", (DL_FUNC) &C_alphaComponents, 4},
+	 {"C_alphaFaces", (DL_FUNC) &C_alphaFaces, 2},
+	 {"C_voronoiVolumes", (DL_FUNC) &C_voronoiVolumes, 4},
 
     {NULL, NULL, 0}
 };
@@ -32,4 +91,12 @@ void R_init_compGeometeR(DllInfo *dll)
 {
     R_registerRoutines(dll, NULL, CallEntries, NULL, NULL);
     R_useDynamicSymbols(dll, FALSE);
+    registerLazyClasses(dll);
+    registerPointFileClass(dll);
+}
+
+/* The workers must not outlive the code they run */
+void R_unload_compGeometeR(DllInfo *dll)
+{
+    stopThreadPool();
 }
@@ -392,6 +392,10 @@ void qh_buildhull(qhT *qh) {
   }
   qh->facet_next= qh->facet_list;      /* advance facet when processed */
   while ((furthest= qh_nextfurthest(qh, &facet))) {
+    if (qh->cancel && *qh->cancel) {  /* compGeometeR: background job cancelled */
+      qh_fprintf(qh, qh->ferr, 6400, "qhull input error (qh_buildhull): cancelled with %d points left to add\n", qh->num_outside);
+      qh_errexit(qh, qh_ERRinput, NULL, NULL);
+    }
     qh->num_outside--;  /* if ONLYmax, furthest may not be outside */
     if (!qh_addpoint(qh, furthest, facet, qh->ONLYmax))
       break;
@@ -785,6 +785,8 @@ struct qhT {
   qhmemT  qhmem;          /* Qhull managed memory (mem_r.h) */
   /* After qhmem because its size depends on the number of statistics */
   qhstatT qhstat;         /* Qhull statistics (stat_r.h) */
+  /* compGeometeR: after qhstat so that qh_initqhull_start2() leaves it set */
+  volatile int *cancel;   /* qh_buildhull stops with an error once *cancel is set */
 };
 
 /*=========== -macros- =========================*/
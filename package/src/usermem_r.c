@@ -59,8 +59,8 @@ void qh_fprintf_stderr(int msgcode, const char *fmt, ... ) {
 
     va_start(args, fmt);
     if(msgcode)
-      fprintf(stderr, "QH%.4d ", msgcode);
-    vfprintf(stderr, fmt, args);
+      REprintf("QH%.4d ", msgcode);
+    REvprintf(fmt, args);
     va_end(args);
 } /* fprintf_stderr */
 
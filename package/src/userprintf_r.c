@@ -51,12 +51,20 @@ void qh_fprintf(qhT *qh, FILE *fp, int msgcode, const char *fmt, ... ) {
         qh_errexit(qh, 6232, NULL, NULL);
     }
     va_start(args, fmt);
-    if (qh && qh->ANNOTATEoutput) {
-      fprintf(fp, "[QH%.4d]", msgcode);
-    }else if (msgcode >= MSG_ERROR && msgcode < MSG_STDERR ) {
-      fprintf(fp, "QH%.4d ", msgcode);
+    if (isMessageStream(fp)) {
+      /* compGeometeR: qhull only ever writes to an in-memory stream */
+      if (qh && qh->ANNOTATEoutput) {
+        messageStreamPrintf(fp, "[QH%.4d]", msgcode);
+      }else if (msgcode >= MSG_ERROR && msgcode < MSG_STDERR ) {
+        messageStreamPrintf(fp, "QH%.4d ", msgcode);
+      }
+      messageStreamVprintf(fp, fmt, args);
+    }else {
+      if (msgcode >= MSG_ERROR && msgcode < MSG_STDERR ) {
+        REprintf("QH%.4d ", msgcode);
+      }
+      REvprintf(fmt, args);
     }
-    vfprintf(fp, fmt, args);
     va_end(args);
 
     /* Place debugging traps here. Use with option 'Tn' */